@@ -0,0 +1,225 @@
+// перехват вызовов libc для счётчиков e4pipe_bench. Символы экспортируются
+// из исполняемого файла (ENABLE_EXPORTS), поэтому перехватываются и вызовы
+// из libevent. Исходные функции находятся через dlsym(RTLD_NEXT).
+#undef _FORTIFY_SOURCE
+#define _GNU_SOURCE
+
+#include "bench_sys.h"
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+_Thread_local unsigned long bench_nsys;
+
+static long fd_live;
+static long fd_base;
+static long fd_max;
+
+void bench_fd_reset(void)
+{
+    long live = __atomic_load_n(&fd_live, __ATOMIC_RELAXED);
+    __atomic_store_n(&fd_base, live, __ATOMIC_RELAXED);
+    __atomic_store_n(&fd_max, live, __ATOMIC_RELAXED);
+}
+
+long bench_fd_peak(void)
+{
+    return __atomic_load_n(&fd_max, __ATOMIC_RELAXED) -
+        __atomic_load_n(&fd_base, __ATOMIC_RELAXED);
+}
+
+static void bench_fd_add(long n)
+{
+    long live = __atomic_add_fetch(&fd_live, n, __ATOMIC_RELAXED);
+    long max = __atomic_load_n(&fd_max, __ATOMIC_RELAXED);
+    while (live > max && !__atomic_compare_exchange_n(&fd_max, &max, live,
+        1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// адрес исходной функции, ищется при первом вызове
+#define BENCH_REAL(name) \
+    static __typeof__(&name) real; \
+    if (!real) \
+        real = (__typeof__(&name))dlsym(RTLD_NEXT, #name); \
+    ++bench_nsys
+
+ssize_t read(int fd, void *buf, size_t n)
+{
+    BENCH_REAL(read);
+    return real(fd, buf, n);
+}
+
+ssize_t write(int fd, const void *buf, size_t n)
+{
+    BENCH_REAL(write);
+    return real(fd, buf, n);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int n)
+{
+    BENCH_REAL(readv);
+    return real(fd, iov, n);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int n)
+{
+    BENCH_REAL(writev);
+    return real(fd, iov, n);
+}
+
+ssize_t recv(int fd, void *buf, size_t n, int flags)
+{
+    BENCH_REAL(recv);
+    return real(fd, buf, n, flags);
+}
+
+ssize_t send(int fd, const void *buf, size_t n, int flags)
+{
+    BENCH_REAL(send);
+    return real(fd, buf, n, flags);
+}
+
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out,
+    size_t len, unsigned int flags)
+{
+    BENCH_REAL(splice);
+    return real(fd_in, off_in, fd_out, off_out, len, flags);
+}
+
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags)
+{
+    BENCH_REAL(tee);
+    return real(fd_in, fd_out, len, flags);
+}
+
+ssize_t vmsplice(int fd, const struct iovec *iov, size_t n, unsigned int flags)
+{
+    BENCH_REAL(vmsplice);
+    return real(fd, iov, n, flags);
+}
+
+int ioctl(int fd, unsigned long req, ...)
+{
+    BENCH_REAL(ioctl);
+    va_list ap;
+    va_start(ap, req);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return real(fd, req, arg);
+}
+
+int fcntl(int fd, int cmd, ...)
+{
+    BENCH_REAL(fcntl);
+    va_list ap;
+    va_start(ap, cmd);
+    void *arg = va_arg(ap, void *);
+    va_end(ap);
+    return real(fd, cmd, arg);
+}
+
+int poll(struct pollfd *fds, nfds_t n, int timeout)
+{
+    BENCH_REAL(poll);
+    return real(fds, n, timeout);
+}
+
+int epoll_wait(int epfd, struct epoll_event *ev, int n, int timeout)
+{
+    BENCH_REAL(epoll_wait);
+    return real(epfd, ev, n, timeout);
+}
+
+int epoll_ctl(int epfd, int op, int fd, struct epoll_event *ev)
+{
+    BENCH_REAL(epoll_ctl);
+    return real(epfd, op, fd, ev);
+}
+
+// io_uring_setup/enter/register идут через syscall()
+long syscall(long nr, ...)
+{
+    BENCH_REAL(syscall);
+    va_list ap;
+    va_start(ap, nr);
+    long a1 = va_arg(ap, long);
+    long a2 = va_arg(ap, long);
+    long a3 = va_arg(ap, long);
+    long a4 = va_arg(ap, long);
+    long a5 = va_arg(ap, long);
+    long a6 = va_arg(ap, long);
+    va_end(ap);
+    return real(nr, a1, a2, a3, a4, a5, a6);
+}
+
+int pipe(int p[2])
+{
+    BENCH_REAL(pipe);
+    int rc = real(p);
+    if (rc == 0)
+        bench_fd_add(2);
+    return rc;
+}
+
+int pipe2(int p[2], int flags)
+{
+    BENCH_REAL(pipe2);
+    int rc = real(p, flags);
+    if (rc == 0)
+        bench_fd_add(2);
+    return rc;
+}
+
+int socketpair(int domain, int type, int proto, int sv[2])
+{
+    BENCH_REAL(socketpair);
+    int rc = real(domain, type, proto, sv);
+    if (rc == 0)
+        bench_fd_add(2);
+    return rc;
+}
+
+int socket(int domain, int type, int proto)
+{
+    BENCH_REAL(socket);
+    int fd = real(domain, type, proto);
+    if (fd >= 0)
+        bench_fd_add(1);
+    return fd;
+}
+
+int accept(int fd, struct sockaddr *addr, socklen_t *len)
+{
+    BENCH_REAL(accept);
+    int rc = real(fd, addr, len);
+    if (rc >= 0)
+        bench_fd_add(1);
+    return rc;
+}
+
+int eventfd(unsigned int val, int flags)
+{
+    BENCH_REAL(eventfd);
+    int fd = real(val, flags);
+    if (fd >= 0)
+        bench_fd_add(1);
+    return fd;
+}
+
+int close(int fd)
+{
+    BENCH_REAL(close);
+    int rc = real(fd);
+    if (rc == 0)
+        bench_fd_add(-1);
+    return rc;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+// счётчики e4pipe_bench, см. bench_sys.c
+
+// системные вызовы текущего потока
+extern _Thread_local unsigned long bench_nsys;
+
+// начать отсчёт пика открытых дескрипторов с текущего числа
+void bench_fd_reset(void);
+
+// сколько дескрипторов сверх открытых на bench_fd_reset было максимум
+long bench_fd_peak(void);
@@ -0,0 +1,860 @@
+#define _GNU_SOURCE
+
+#include "bench_sys.h"
+
+#include "e4pipe/infinitybuf.h"
+#include "e4pipe/infinitypipe_struct.h"
+#include "e4pipe/pipeevent.h"
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/event.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MIB (1024u * 1024u)
+// кусок записи источника и вызовов evbuffer
+#define BENCH_CHUNK (64u * 1024u)
+// сколько держим в буфере за один проход тестов в памяти
+#define BENCH_FILL (8u * BENCH_MIB)
+// сколько держим в output пересылки, прежде чем остановить чтение
+#define BENCH_HWM (4u * BENCH_MIB)
+// буфер приложения в removev
+#define BENCH_PAGE 4096u
+
+static size_t bench_bytes = 256u * BENCH_MIB;
+static const char *bench_filter;
+static int bench_pool;
+static char *bench_data;
+
+static const size_t bench_caps[] = {
+    16u * 1024u, 64u * 1024u, 256u * 1024u, 1024u * 1024u
+};
+#define BENCH_N_CAPS (sizeof(bench_caps) / sizeof(bench_caps[0]))
+
+enum bench_transport
+{
+    BENCH_PIPE,
+    BENCH_UNIX,
+    BENCH_TCP
+};
+
+static const char *const bench_transport_name[] = { "pipe", "unix", "tcp" };
+
+struct bench_stat
+{
+    double secs;
+    size_t bytes;
+    unsigned long nsys;
+};
+
+struct bench_clock
+{
+    double t;
+    unsigned long nsys;
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_start(struct bench_clock *c)
+{
+    c->nsys = bench_nsys;
+    c->t = bench_now();
+}
+
+static void bench_stop(const struct bench_clock *c, struct bench_stat *st)
+{
+    st->secs += bench_now() - c->t;
+    st->nsys += bench_nsys - c->nsys;
+}
+
+static int bench_skip(const char *name, const char *where)
+{
+    if (!bench_filter)
+        return 0;
+
+    char full[64];
+    snprintf(full, sizeof(full), "%s/%s", name, where);
+    return strstr(full, bench_filter) == NULL;
+}
+
+static void bench_report(const char *name, const char *where, size_t cap,
+    const struct bench_stat *st)
+{
+    // до 20 цифр size_t, "K" и завершающий ноль
+    char capbuf[24] = "-";
+    if (cap)
+        snprintf(capbuf, sizeof(capbuf), "%zuK", cap / 1024u);
+
+    double mib = (double)st->bytes / BENCH_MIB;
+    double gbs = st->secs > 0 ? (double)st->bytes / st->secs / 1e9 : 0;
+    printf("%-20s %-6s %6s %8.2f %10.1f %6ld\n", name, where, capbuf,
+        gbs, mib > 0 ? (double)st->nsys / mib : 0, bench_fd_peak());
+    fflush(stdout);
+}
+
+// пул сегментов потока включается флагом -p
+static void bench_pool_setup(size_t cap)
+{
+    if (bench_pool)
+        infinityseg_pool_init(infinityseg_pool_thread(), cap,
+            O_NONBLOCK|O_CLOEXEC, 256);
+}
+
+static void bench_pool_clear(void)
+{
+    infinityseg_pool_clear(infinityseg_pool_thread());
+}
+
+static void bench_ip_init(struct infinitypipe *ip, size_t cap)
+{
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = cap;
+    cfg.flags = IP_NONBLOCK|IP_CLOEXEC;
+    infinitypipe_init_config(ip, &cfg);
+}
+
+static void bench_ip_fill(struct infinitypipe *ip, size_t len)
+{
+    for (size_t off = 0; off < len; off += BENCH_CHUNK)
+    {
+        size_t n = len - off < BENCH_CHUNK ? len - off : BENCH_CHUNK;
+        if (infinitypipe_add(ip, bench_data, n) != (ssize_t)n)
+        {
+            perror("infinitypipe_add");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static void bench_evbuffer_fill(struct evbuffer *buf, size_t len)
+{
+    for (size_t off = 0; off < len; off += BENCH_CHUNK)
+    {
+        size_t n = len - off < BENCH_CHUNK ? len - off : BENCH_CHUNK;
+        evbuffer_add(buf, bench_data, n);
+    }
+}
+
+/* тесты в памяти: один проход над BENCH_FILL байт */
+
+enum bench_mem_op
+{
+    BENCH_MOVE,
+    BENCH_MOVE_PARTIAL,
+    BENCH_TEE_PIPE,
+    BENCH_DISCARD,
+    BENCH_COPYOUT,
+    BENCH_REMOVE,
+    BENCH_REMOVEV,
+    BENCH_SEG_READ,
+    BENCH_EVBUFFER_READ,
+    BENCH_EVBUFFER_WRITE,
+    BENCH_EVBUFFER_ADD_BUFFER
+};
+
+static const char *const bench_mem_name[] = {
+    "move",
+    "move_partial",
+    "tee_pipe",
+    "discard",
+    "copyout",
+    "remove",
+    "removev",
+    "seg_read",
+    "evbuffer_read",
+    "evbuffer_write",
+    "evbuffer_add_buffer"
+};
+
+struct bench_mem
+{
+    struct infinitypipe src;
+    struct infinitypipe dst;
+    struct evbuffer *ev_src;
+    struct evbuffer *ev_dst;
+    // приёмник tee_pipe
+    int p[2];
+    char *out;
+    // out по страницам для removev
+    struct iovec *vec;
+    size_t cap;
+};
+
+static void bench_mem_round(struct bench_mem *m, enum bench_mem_op op,
+    struct bench_stat *st)
+{
+    struct bench_clock c;
+    size_t len = BENCH_FILL;
+
+    switch (op)
+    {
+    case BENCH_MOVE:
+        bench_ip_fill(&m->src, len);
+        bench_start(&c);
+        infinitypipe_move(&m->dst, &m->src, len);
+        bench_stop(&c, st);
+        infinitypipe_discard(&m->dst, len);
+        break;
+
+    case BENCH_MOVE_PARTIAL:
+    {
+        // шаг не кратен сегменту - каждый move режет сегмент
+        size_t step = m->cap * 3u / 4u + 1u;
+        bench_ip_fill(&m->src, len);
+        bench_start(&c);
+        while (m->src.total_len)
+        {
+            if (infinitypipe_move(&m->dst, &m->src, step) <= 0)
+                break;
+        }
+        bench_stop(&c, st);
+        infinitypipe_discard(&m->dst, len);
+        break;
+    }
+
+    case BENCH_TEE_PIPE:
+    {
+        // src наполнен один раз, tee его не меняет
+        if (!m->src.total_len)
+            bench_ip_fill(&m->src, len);
+        struct infinitypipe_mark mark = { NULL };
+        size_t done = 0;
+        while (done < len)
+        {
+            bench_start(&c);
+            ssize_t rc = infinitypipe_tee_pipe(&m->src, &mark, m->p[1],
+                len - done);
+            bench_stop(&c, st);
+            if (rc <= 0)
+                break;
+            done += (size_t)rc;
+
+            // сливаем приёмник вне замера
+            size_t left = (size_t)rc;
+            while (left)
+            {
+                ssize_t k = read(m->p[0], m->out, left < len ? left : len);
+                if (k <= 0)
+                    break;
+                left -= (size_t)k;
+            }
+        }
+        len = done;
+        break;
+    }
+
+    case BENCH_DISCARD:
+        bench_ip_fill(&m->src, len);
+        bench_start(&c);
+        infinitypipe_discard(&m->src, len);
+        bench_stop(&c, st);
+        break;
+
+    case BENCH_COPYOUT:
+    {
+        if (!m->src.total_len)
+            bench_ip_fill(&m->src, len);
+        struct iovec vec = { m->out, len };
+        bench_start(&c);
+        ssize_t rc = infinitypipe_copyout(&m->src, &vec, 1);
+        bench_stop(&c, st);
+        len = rc > 0 ? (size_t)rc : 0;
+        break;
+    }
+
+    case BENCH_REMOVE:
+    {
+        bench_ip_fill(&m->src, len);
+        bench_start(&c);
+        ssize_t rc = infinitypipe_remove(&m->src, m->out, len);
+        bench_stop(&c, st);
+        len = rc > 0 ? (size_t)rc : 0;
+        break;
+    }
+
+    case BENCH_REMOVEV:
+    {
+        // приёмник нарезан страницами, как список буферов приложения
+        bench_ip_fill(&m->src, len);
+        for (size_t i = 0; i < BENCH_FILL / BENCH_PAGE; ++i)
+        {
+            m->vec[i].iov_base = m->out + i * BENCH_PAGE;
+            m->vec[i].iov_len = BENCH_PAGE;
+        }
+        bench_start(&c);
+        ssize_t rc = infinitypipe_removev(&m->src, m->vec,
+            (int)(BENCH_FILL / BENCH_PAGE));
+        bench_stop(&c, st);
+        len = rc > 0 ? (size_t)rc : 0;
+        break;
+    }
+
+    case BENCH_SEG_READ:
+    {
+        // то, что заменяет removev: read на сегмент через infinityseg_read
+        bench_ip_fill(&m->src, len);
+        size_t off = 0;
+        bench_start(&c);
+        for (struct infinityseg *s = m->src.head; s; s = s->next)
+        {
+            ssize_t rc = infinityseg_read(s, m->out + off, s->len);
+            if (rc <= 0)
+                break;
+            off += (size_t)rc;
+        }
+        bench_stop(&c, st);
+        // сегменты вычитаны мимо буфера: пересоздаём его вне замера
+        infinitypipe_free(&m->src);
+        bench_ip_init(&m->src, m->cap);
+        len = off;
+        break;
+    }
+
+    case BENCH_EVBUFFER_READ:
+        bench_evbuffer_fill(m->ev_src, len);
+        bench_start(&c);
+        while (evbuffer_get_length(m->ev_src))
+        {
+            if (infinitypipe_read(&m->src, m->ev_src, len) <= 0)
+                break;
+        }
+        bench_stop(&c, st);
+        infinitypipe_discard(&m->src, len);
+        break;
+
+    case BENCH_EVBUFFER_WRITE:
+        bench_ip_fill(&m->src, len);
+        bench_start(&c);
+        while (m->src.total_len)
+        {
+            if (infinitypipe_write(&m->src, m->ev_dst, len) <= 0)
+                break;
+        }
+        bench_stop(&c, st);
+        evbuffer_drain(m->ev_dst, len);
+        break;
+
+    case BENCH_EVBUFFER_ADD_BUFFER:
+        bench_evbuffer_fill(m->ev_src, len);
+        bench_start(&c);
+        evbuffer_add_buffer(m->ev_dst, m->ev_src);
+        bench_stop(&c, st);
+        evbuffer_drain(m->ev_dst, len);
+        break;
+    }
+
+    st->bytes += len;
+}
+
+static void bench_mem_run(enum bench_mem_op op, size_t cap)
+{
+    const char *name = bench_mem_name[op];
+    if (bench_skip(name, "mem"))
+        return;
+
+    bench_fd_reset();
+    bench_pool_setup(cap ? cap : INFINITYSEG_DEFAULT_CAPACITY);
+
+    struct bench_mem m;
+    memset(&m, 0, sizeof(m));
+    m.cap = cap ? cap : INFINITYSEG_DEFAULT_CAPACITY;
+    bench_ip_init(&m.src, m.cap);
+    bench_ip_init(&m.dst, m.cap);
+    m.ev_src = evbuffer_new();
+    m.ev_dst = evbuffer_new();
+    m.out = (char *)malloc(BENCH_FILL);
+    m.vec = (struct iovec *)malloc(BENCH_FILL / BENCH_PAGE * sizeof(*m.vec));
+    if (pipe2(m.p, O_NONBLOCK|O_CLOEXEC) != 0 || !m.out || !m.vec ||
+        !m.ev_src || !m.ev_dst)
+    {
+        perror("bench_mem_run");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(m.p[1], F_SETPIPE_SZ, BENCH_MIB);
+
+    struct bench_stat st = { 0, 0, 0 };
+    while (st.bytes < bench_bytes)
+    {
+        size_t before = st.bytes;
+        bench_mem_round(&m, op, &st);
+        if (st.bytes == before)
+        {
+            fprintf(stderr, "%s: no progress\n", name);
+            break;
+        }
+    }
+
+    bench_report(name, "mem", cap, &st);
+
+    infinitypipe_free(&m.src);
+    infinitypipe_free(&m.dst);
+    evbuffer_free(m.ev_src);
+    evbuffer_free(m.ev_dst);
+    close(m.p[0]);
+    close(m.p[1]);
+    free(m.out);
+    free(m.vec);
+    bench_pool_clear();
+}
+
+/* пересылка: поток-источник -> src -> движок -> dst -> поток-приёмник */
+
+static int bench_tcp_pair(int fd[2])
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+
+    int l = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if (l < 0)
+        return -1;
+
+    int c = -1;
+    if (bind(l, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(l, 1) != 0 ||
+        getsockname(l, (struct sockaddr *)&addr, &addr_len) != 0 ||
+        (c = socket(AF_INET, SOCK_STREAM|SOCK_CLOEXEC, 0)) < 0 ||
+        connect(c, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        if (c >= 0)
+            close(c);
+        close(l);
+        return -1;
+    }
+
+    int s = accept(l, NULL, NULL);
+    close(l);
+    if (s < 0)
+    {
+        close(c);
+        return -1;
+    }
+
+    // fd[0] читает, fd[1] пишет, как у pipe
+    fd[0] = s;
+    fd[1] = c;
+    return 0;
+}
+
+static int bench_pair(enum bench_transport t, int fd[2])
+{
+    switch (t)
+    {
+    case BENCH_PIPE:
+        return pipe2(fd, O_CLOEXEC);
+    case BENCH_UNIX:
+        return socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, fd);
+    case BENCH_TCP:
+        return bench_tcp_pair(fd);
+    }
+    return -1;
+}
+
+struct bench_fwd
+{
+    struct event_base *base;
+    int src[2];
+    int dst[2];
+    // приёмник сообщает о конце через этот пайп
+    int done[2];
+    struct event *ev_done;
+    size_t cap;
+    size_t got;
+    double t_end;
+
+    struct pipeevent *pin;
+    struct pipeevent *pout;
+    struct bufferevent *bin;
+    struct bufferevent *bout;
+    struct pipeevent_uring *uring;
+};
+
+static void *bench_producer(void *arg)
+{
+    struct bench_fwd *f = (struct bench_fwd *)arg;
+
+    size_t left = bench_bytes;
+    while (left)
+    {
+        ssize_t n = write(f->src[1], bench_data,
+            left < BENCH_CHUNK ? left : BENCH_CHUNK);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        left -= (size_t)n;
+    }
+    return NULL;
+}
+
+static void *bench_sink(void *arg)
+{
+    struct bench_fwd *f = (struct bench_fwd *)arg;
+
+    char *buf = (char *)malloc(4u * BENCH_CHUNK);
+    while (buf && f->got < bench_bytes)
+    {
+        ssize_t n = read(f->dst[0], buf, 4u * BENCH_CHUNK);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        f->got += (size_t)n;
+    }
+    free(buf);
+
+    f->t_end = bench_now();
+    char c = 1;
+    if (write(f->done[1], &c, 1) != 1)
+        perror("bench_sink");
+    return NULL;
+}
+
+static void bench_on_done(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd;
+    (void)what;
+    event_base_loopbreak((struct event_base *)arg);
+}
+
+static void bench_set_nonblock(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// infinitypipe напрямую: splice_in/splice_out без event loop
+static int bench_splice_start(struct bench_fwd *f)
+{
+    struct infinitypipe ip;
+    bench_ip_init(&ip, f->cap);
+    size_t max = infinitypipe_get_max_splice(&ip);
+
+    bench_set_nonblock(f->src[0]);
+    bench_set_nonblock(f->dst[1]);
+
+    size_t moved = 0;
+    while (moved < bench_bytes)
+    {
+        ssize_t in = -1;
+        if (ip.total_len < BENCH_HWM)
+            in = infinitypipe_splice_in(&ip, f->src[0], max);
+        if (in == 0)
+            break;
+
+        ssize_t out = -1;
+        if (ip.total_len)
+            out = infinitypipe_splice_out(&ip, f->dst[1], max);
+        if (out > 0)
+            moved += (size_t)out;
+
+        if (in <= 0 && out <= 0)
+        {
+            struct pollfd pfd[2] = {
+                { f->src[0], ip.total_len < BENCH_HWM ? POLLIN : 0, 0 },
+                { f->dst[1], ip.total_len ? POLLOUT : 0, 0 }
+            };
+            poll(pfd, 2, -1);
+        }
+    }
+
+    infinitypipe_free(&ip);
+    return 0;
+}
+
+static void bench_pev_readcb(struct pipeevent *pev, void *arg)
+{
+    struct bench_fwd *f = (struct bench_fwd *)arg;
+    struct infinitypipe *out = pipeevent_get_output(f->pout);
+
+    infinitypipe_move(out, pipeevent_get_input(pev), INFINITYPIPE_MAX_SIZE);
+    if (infinitypipe_get_length(out) >= BENCH_HWM)
+        pipeevent_disable(pev, EV_READ);
+}
+
+static void bench_pev_writecb(struct pipeevent *pev, void *arg)
+{
+    (void)pev;
+    struct bench_fwd *f = (struct bench_fwd *)arg;
+    pipeevent_enable(f->pin, EV_READ);
+}
+
+static int bench_pev_new(struct bench_fwd *f)
+{
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = f->cap;
+    cfg.flags = IP_NONBLOCK|IP_CLOEXEC;
+
+    f->pin = pipeevent_socket_new_config(f->base, f->src[0], 0, &cfg);
+    f->pout = pipeevent_socket_new_config(f->base, f->dst[1], 0, &cfg);
+    return (f->pin && f->pout) ? 0 : -1;
+}
+
+static int bench_pev_start(struct bench_fwd *f)
+{
+    if (bench_pev_new(f) != 0)
+        return -1;
+
+    pipeevent_setcb(f->pin, bench_pev_readcb, NULL, NULL, f);
+    pipeevent_setcb(f->pout, NULL, bench_pev_writecb, NULL, f);
+    pipeevent_setwatermark(f->pout, EV_WRITE, BENCH_HWM / 2u, 0);
+    pipeevent_enable(f->pin, EV_READ);
+    pipeevent_enable(f->pout, EV_WRITE);
+    return 0;
+}
+
+static int bench_relay_start(struct bench_fwd *f)
+{
+    if (bench_pev_new(f) != 0)
+        return -1;
+
+    if (f->uring &&
+        (pipeevent_set_uring(f->pin, f->uring) != 0 ||
+        pipeevent_set_uring(f->pout, f->uring) != 0))
+        return -1;
+
+    if (pipeevent_relay(f->pin, f->pout, BENCH_HWM) != 0)
+        return -1;
+
+    // обратного направления у пересылки нет
+    pipeevent_disable(f->pout, EV_READ);
+    return 0;
+}
+
+static int bench_uring_start(struct bench_fwd *f)
+{
+    f->uring = pipeevent_uring_new(f->base, 0);
+    if (!f->uring)
+        return -1;
+
+    return bench_relay_start(f);
+}
+
+static void bench_bev_readcb(struct bufferevent *bev, void *arg)
+{
+    struct bench_fwd *f = (struct bench_fwd *)arg;
+    struct evbuffer *out = bufferevent_get_output(f->bout);
+
+    evbuffer_add_buffer(out, bufferevent_get_input(bev));
+    if (evbuffer_get_length(out) >= BENCH_HWM)
+        bufferevent_disable(bev, EV_READ);
+}
+
+static void bench_bev_writecb(struct bufferevent *bev, void *arg)
+{
+    (void)bev;
+    struct bench_fwd *f = (struct bench_fwd *)arg;
+    bufferevent_enable(f->bin, EV_READ);
+}
+
+static int bench_bev_start(struct bench_fwd *f)
+{
+    bench_set_nonblock(f->src[0]);
+    bench_set_nonblock(f->dst[1]);
+
+    f->bin = bufferevent_socket_new(f->base, f->src[0], 0);
+    f->bout = bufferevent_socket_new(f->base, f->dst[1], 0);
+    if (!f->bin || !f->bout)
+        return -1;
+
+    bufferevent_setcb(f->bin, bench_bev_readcb, NULL, NULL, f);
+    bufferevent_setcb(f->bout, NULL, bench_bev_writecb, NULL, f);
+    bufferevent_setwatermark(f->bout, EV_WRITE, BENCH_HWM / 2u, 0);
+    bufferevent_enable(f->bin, EV_READ);
+    bufferevent_enable(f->bout, EV_WRITE);
+    return 0;
+}
+
+static void bench_fwd_stop(struct bench_fwd *f)
+{
+    if (f->pin)
+        pipeevent_free(f->pin);
+    if (f->pout)
+        pipeevent_free(f->pout);
+    if (f->bin)
+        bufferevent_free(f->bin);
+    if (f->bout)
+        bufferevent_free(f->bout);
+    if (f->uring)
+        pipeevent_uring_free(f->uring);
+}
+
+struct bench_engine
+{
+    const char *name;
+    // зависит ли от ёмкости сегмента
+    int uses_cap;
+    int (*start)(struct bench_fwd *f);
+};
+
+static const struct bench_engine bench_engines[] = {
+    { "bufferevent", 0, bench_bev_start },
+    { "splice", 1, bench_splice_start },
+    { "pipeevent", 1, bench_pev_start },
+    { "relay", 1, bench_relay_start },
+    { "relay_uring", 1, bench_uring_start }
+};
+#define BENCH_N_ENGINES (sizeof(bench_engines) / sizeof(bench_engines[0]))
+
+static void bench_fwd_run(const struct bench_engine *e,
+    enum bench_transport t, size_t cap)
+{
+    const char *where = bench_transport_name[t];
+    if (bench_skip(e->name, where))
+        return;
+
+    struct bench_fwd f;
+    memset(&f, 0, sizeof(f));
+    f.cap = cap ? cap : INFINITYSEG_DEFAULT_CAPACITY;
+
+    if (bench_pair(t, f.src) != 0 || bench_pair(t, f.dst) != 0 ||
+        pipe2(f.done, O_CLOEXEC) != 0)
+    {
+        perror("bench_pair");
+        exit(EXIT_FAILURE);
+    }
+
+    f.base = event_base_new();
+    f.ev_done = event_new(f.base, f.done[0], EV_READ, bench_on_done, f.base);
+    event_add(f.ev_done, NULL);
+
+    // считаем только то, что открывает и вызывает сам движок
+    bench_fd_reset();
+    bench_pool_setup(f.cap);
+
+    pthread_t producer, sink;
+    struct bench_stat st = { 0, 0, 0 };
+    struct bench_clock c;
+    bench_start(&c);
+
+    pthread_create(&sink, NULL, bench_sink, &f);
+    pthread_create(&producer, NULL, bench_producer, &f);
+
+    int rc = e->start(&f);
+    if (rc == 0)
+        event_base_dispatch(f.base);
+    else
+    {
+        // приёмник ждёт данных, которых не будет
+        close(f.dst[1]);
+        f.dst[1] = -1;
+        close(f.src[0]);
+        f.src[0] = -1;
+    }
+
+    pthread_join(producer, NULL);
+    pthread_join(sink, NULL);
+
+    st.nsys = bench_nsys - c.nsys;
+    st.secs = f.t_end - c.t;
+    st.bytes = f.got;
+
+    if (rc == 0 && f.got == bench_bytes)
+        bench_report(e->name, where, e->uses_cap ? cap : 0, &st);
+    else
+        printf("%-20s %-6s %6s %s\n", e->name, where, "-",
+            rc == 0 ? "incomplete" : strerror(errno));
+
+    bench_fwd_stop(&f);
+    bench_pool_clear();
+    event_free(f.ev_done);
+    event_base_free(f.base);
+
+    int *fds[] = { f.src, f.dst, f.done };
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i)
+    {
+        if (fds[i][0] >= 0)
+            close(fds[i][0]);
+        if (fds[i][1] >= 0)
+            close(fds[i][1]);
+    }
+}
+
+static void bench_usage(const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [-n MiB] [-p] [filter]\n"
+        "  -n MiB   bytes per case (default 256)\n"
+        "  -p       enable the thread segment pool\n"
+        "  filter   run only cases whose name/transport contains it\n",
+        prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "n:ph")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            bench_bytes = (size_t)strtoul(optarg, NULL, 10) * BENCH_MIB;
+            break;
+        case 'p':
+            bench_pool = 1;
+            break;
+        default:
+            bench_usage(argv[0]);
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (optind < argc)
+        bench_filter = argv[optind];
+    if (!bench_bytes)
+        bench_bytes = BENCH_MIB;
+
+    // запись в закрытый сокет не должна убивать процесс
+    signal(SIGPIPE, SIG_IGN);
+
+    bench_data = (char *)malloc(BENCH_CHUNK);
+    if (!bench_data)
+        return EXIT_FAILURE;
+    for (size_t i = 0; i < BENCH_CHUNK; ++i)
+        bench_data[i] = (char)(i % 251u);
+
+    printf("%-20s %-6s %6s %8s %10s %6s\n",
+        "case", "where", "cap", "GB/s", "sys/MiB", "fds");
+
+    for (size_t i = 0; i < BENCH_N_CAPS; ++i)
+    {
+        for (int op = BENCH_MOVE; op < BENCH_EVBUFFER_ADD_BUFFER; ++op)
+            bench_mem_run((enum bench_mem_op)op, bench_caps[i]);
+    }
+    bench_mem_run(BENCH_EVBUFFER_ADD_BUFFER, 0);
+
+    for (int t = BENCH_PIPE; t <= BENCH_TCP; ++t)
+    {
+        for (size_t e = 0; e < BENCH_N_ENGINES; ++e)
+        {
+            const struct bench_engine *eng = &bench_engines[e];
+            size_t n_caps = eng->uses_cap ? BENCH_N_CAPS : 1;
+            for (size_t i = 0; i < n_caps; ++i)
+                bench_fwd_run(eng, (enum bench_transport)t, bench_caps[i]);
+        }
+    }
+
+    free(bench_data);
+    return EXIT_SUCCESS;
+}
@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +20,15 @@ extern "C" {
 #define INFINITYPIPE_MAX_SIZE (64u * 1024u * 1024u)
 #endif
 
+// границы ёмкости сегмента в адаптивном режиме
+#ifndef INFINITYSEG_MIN_CAPACITY
+#define INFINITYSEG_MIN_CAPACITY (4u * 1024u)
+#endif
+
+#ifndef INFINITYSEG_MAX_CAPACITY
+#define INFINITYSEG_MAX_CAPACITY (1024u * 1024u)
+#endif
+
 // структура изменения буфера
 struct infinitypipe_info
 {
@@ -32,31 +42,208 @@ typedef void (*infinitypipe_notify_fn)(void *arg);
 #define IP_NONBLOCK O_NONBLOCK
 #define IP_CLOEXEC O_CLOEXEC
 
+// флаги infinitypipe_add_reference
+// отдать страницы ядру (SPLICE_F_GIFT), data и len выровнены по странице
+#define IP_ADD_GIFT 0x01
+
+// режимы infinitypipe_config.mode
+// ёмкость новых сегментов подстраивается под байты за splice_in
+#define IP_MODE_ADAPTIVE 0x01
+// в адаптивном режиме учитывать FIONREAD источника
+#define IP_MODE_FIONREAD 0x02
+// уплотнять сегменты после move и tee_append (см. infinitypipe_compact);
+// отметки на сегментах, в которые долито, после этого дают EINVAL
+#define IP_MODE_COMPACT 0x04
+
+// сколько лишних сегментов сверх total_len / seg_capacity терпит IP_MODE_COMPACT
+#ifndef INFINITYPIPE_COMPACT_SLACK
+#define INFINITYPIPE_COMPACT_SLACK 4
+#endif
+
+// настройки экземпляра, нулевые поля - значения по умолчанию
+struct infinitypipe_config
+{
+    // ёмкость сегмента (начальная в адаптивном режиме)
+    size_t seg_capacity;
+    // границы ёмкости для IP_MODE_ADAPTIVE
+    size_t seg_min;
+    size_t seg_max;
+    // максимальный размер буфера
+    size_t max_size;
+    // сколько байт pipeevent передаёт за один splice_in/splice_out
+    size_t max_splice;
+    // флаги pipe2 (IP_NONBLOCK|IP_CLOEXEC)
+    size_t flags;
+    // IP_MODE_*
+    unsigned mode;
+    // сколько байт сверх max_size splice_in вытесняет в файл, 0 - нет
+    size_t spill_max;
+    // каталог для O_TMPFILE, NULL - memfd; строка должна жить, пока жив буфер
+    const char *spill_dir;
+};
+
+// конец строки для infinitypipe_readln, как evbuffer_eol_style
+enum infinitypipe_eol_style
+{
+    // \n
+    IP_EOL_LF,
+    // \n или \r\n
+    IP_EOL_CRLF,
+    // только \r\n
+    IP_EOL_CRLF_STRICT,
+    // \0
+    IP_EOL_NUL
+};
+
+// счётчики (сборка с E4PIPE_WITH_COUNTERS): у каждого infinitypipe свои,
+// у процесса - сумма по всем буферам всех потоков
+struct infinitypipe_counters
+{
+    // байт принято splice_in и отдано splice_out
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    // вызовов splice с fd
+    uint64_t n_splice;
+    // из них вернули EAGAIN
+    uint64_t n_eagain;
+    // и передали меньше запрошенного
+    uint64_t n_partial;
+    // сегментов взято и отдано буфером; у процесса - pipe2 и close
+    uint64_t segs_created;
+    uint64_t segs_freed;
+    // сегментов сейчас и их ёмкость (у процесса - включая пулы)
+    uint64_t segs_live;
+    uint64_t cap_held;
+};
+
 struct infinitypipe;
 
 struct infinitypipe_mark
 {
     struct infinityseg *last_before;
+    // infinityseg.gen сегмента last_before
+    uint64_t gen;
 };
 
 size_t infinitypipe_get_length(const struct infinitypipe *ip);
+
+// сколько байт ждёт в файле вытеснения (в get_length не входит)
+size_t infinitypipe_get_spill_length(const struct infinitypipe *ip);
 void infinitypipe_mark(struct infinitypipe *ip, struct infinitypipe_mark *m);
 void infinitypipe_set_max_size(struct infinitypipe *ip, size_t max_size);
 
+// сменить пул сегментов, NULL - без пула (pipe2/close на каждый сегмент)
+void infinitypipe_set_pool(struct infinitypipe *ip, struct infinityseg_pool *pool);
+
+// текущая ёмкость новых сегментов
+size_t infinitypipe_get_seg_capacity(const struct infinitypipe *ip);
+
+// сколько байт отдавать за один splice_in/splice_out
+size_t infinitypipe_get_max_splice(const struct infinitypipe *ip);
+
+// заполнить значения по умолчанию
+void infinitypipe_config_init(struct infinitypipe_config *cfg);
+
 // init/free
 int infinitypipe_init(struct infinitypipe *ip, size_t seg_capacity, size_t flags);
+int infinitypipe_init_config(struct infinitypipe *ip,
+    const struct infinitypipe_config *cfg);
 void infinitypipe_free(struct infinitypipe *ip);
 
 // callbacks setup
 void infinitypipe_setcb(struct infinitypipe *ip, infinitypipe_notify_fn fn, void *fn_arg);
 int infinitypipe_get_stat(struct infinitypipe *ip, struct infinitypipe_info *stat);
 
+// счётчики буфера, -1 и ENOSYS в сборке без E4PIPE_WITH_COUNTERS
+int infinitypipe_get_counters(const struct infinitypipe *ip,
+    struct infinitypipe_counters *c);
+
+// сумма счётчиков процесса, читается из любого потока
+int infinitypipe_get_global_counters(struct infinitypipe_counters *c);
+
 // splice/move ops
 ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_bytes);
 ssize_t infinitypipe_splice_out(struct infinitypipe *ip, int out_fd, size_t max_bytes);
+
+// то же для файла с явной позицией (как pread/pwrite): позиция файла
+// не меняется, *offset сдвигается на переданные байты. Данные идут
+// файл->пайп->fd без копирования в user space; чтение с диска может
+// блокировать, подсказки posix_fadvise остаются вызывающему
+ssize_t infinitypipe_splice_in_file(struct infinitypipe *ip, int in_fd,
+    off_t *offset, size_t max_bytes);
+ssize_t infinitypipe_splice_out_file(struct infinitypipe *ip, int out_fd,
+    off_t *offset, size_t max_bytes);
+
 ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, size_t max_bytes);
 ssize_t infinitypipe_discard(struct infinitypipe *ip, size_t max_bytes);
 
+// слить соседние недозаполненные сегменты через splice(pipe->pipe),
+// данные и их порядок не меняются; возвращает число освобождённых
+// сегментов. Отметки (infinitypipe_mark) на сегментах, в которые долиты
+// данные, становятся недействительны (EINVAL), остальные остаются
+ssize_t infinitypipe_compact(struct infinitypipe *ip);
+
+// memory ops
+// добавить копию данных, мелкие записи дописываются в tail. В сегменты
+// не больше max_size, остаток - в файл вытеснения (spill_max); места нет
+// совсем - EAGAIN. Возвращает сколько принято
+ssize_t infinitypipe_add(struct infinitypipe *ip, const void *data, size_t len);
+
+// то же для нескольких буферов: один writev на сегмент
+ssize_t infinitypipe_addv(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec);
+
+// zero-copy через vmsplice: страницы ссылаются из пайпа, поэтому память
+// нельзя менять, пока данные не ушли из буфера; с IP_ADD_GIFT страницы
+// отдаются ядру и больше не принадлежат вызывающему
+ssize_t infinitypipe_add_reference(struct infinitypipe *ip,
+    const void *data, size_t len, unsigned flags);
+
+// вставить копию data перед данными буфера (заголовок, префикс длины);
+// данные ложатся в новые сегменты, буфер не двигается. EBUSY, пока
+// голова буфера в записи io_uring
+ssize_t infinitypipe_prepend(struct infinitypipe *ip,
+    const void *data, size_t len);
+
+// то же на границе отметки: после сегмента, бывшего хвостом при
+// infinitypipe_mark (last_before == NULL - в голову). Байты, дописанные
+// в этот сегмент после отметки, остаются перед вставкой. EINVAL, если
+// сегмента отметки в буфере уже нет (в том числе если его адрес занял
+// новый сегмент)
+ssize_t infinitypipe_insert_at_mark(struct infinitypipe *ip,
+    const struct infinitypipe_mark *m, const void *data, size_t len);
+
+// забрать данные в память: readv на сегмент, длина и статистика
+// обновляются один раз на вызов
+ssize_t infinitypipe_remove(struct infinitypipe *ip, void *data, size_t len);
+ssize_t infinitypipe_removev(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec);
+
+// inspect ops (данные остаются в буфере, копируются через tee)
+// скопировать в iovec, не забирая из буфера
+ssize_t infinitypipe_copyout(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec);
+
+// скопировать до len байт начиная с offset
+ssize_t infinitypipe_peek(struct infinitypipe *ip, size_t offset,
+    void *buf, size_t len);
+
+// позиция первого вхождения what начиная с start, -1 если нет
+ssize_t infinitypipe_search(struct infinitypipe *ip,
+    const void *what, size_t len, size_t start);
+
+// извлечь строку без конца строки, результат освобождается free()
+// NULL - полной строки в буфере нет
+char *infinitypipe_readln(struct infinitypipe *ip, size_t *n_read_out,
+    enum infinitypipe_eol_style eol_style);
+
+// дописать в конец dst копию всего src через tee (src не меняется);
+// каждый сегмент src дублируется в отдельный сегмент dst
+ssize_t infinitypipe_tee_append(struct infinitypipe *dst,
+    struct infinitypipe *src);
+
+// tee в пайп pipe_fd данных за отметкой (last_before == NULL - с головы),
+// буфер не меняется. EINVAL, если сегмента отметки в буфере уже нет
 ssize_t infinitypipe_tee_pipe(struct infinitypipe *ip,
     const struct infinitypipe_mark *m, int pipe_fd, size_t max_bytes);
 
@@ -6,6 +6,8 @@ struct infinitypipe
 {
     struct infinityseg *head;
     struct infinityseg *tail;
+    // сегментов в списке
+    size_t n_segs;
     struct infinitypipe_info stat;
     size_t seg_capacity;
     size_t total_len;
@@ -16,4 +18,31 @@ struct infinitypipe
     infinitypipe_notify_fn fn;
     void *fn_arg;
     size_t notify_pending;
+    // пул пустых сегментов (по умолчанию пул потока)
+    struct infinityseg_pool *pool;
+    // настройки (infinitypipe_config)
+    size_t seg_min;
+    size_t seg_max;
+    size_t max_splice;
+    unsigned mode;
+    // среднее байт за вызов splice_in (IP_MODE_ADAPTIVE)
+    size_t adapt_avg;
+    // IP_MODE_COMPACT: следующее уплотнение не раньше этого числа сегментов
+    size_t compact_at;
+    // E4PIPE_WITH_COUNTERS
+    struct infinitypipe_counters cnt;
+    // последний splice_in не получил сегмент (бюджет или fd)
+    size_t seg_denied;
+    // вытеснение сверх max_size: файл, чтение с spill_rd, запись в spill_wr
+    int spill_fd;
+    const char *spill_dir;
+    size_t spill_max;
+    size_t spill_len;
+    off_t spill_rd;
+    off_t spill_wr;
+    // голова, отданная операции io_uring: её байтов уже нет в total_len,
+    // остаток вернётся в голову по завершении
+    struct infinityseg *inflight;
+    // байт, снятых с головы за всё время; в отличие от stat не сбрасывается
+    uint64_t drained;
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 #ifndef INFINITYSEG_DEFAULT_CAPACITY
@@ -13,16 +14,54 @@ extern "C" {
 
 struct infinityseg
 {
-    // p[0]=read, p[1]=write
+    // p[0]=read, p[1]=write; p[1] == -1 - сегмент запечатан
     int p[2];
     // bytes currently in this pipe
     size_t len;
     // pipe capacity (best effort)
     size_t cap;
+    // флаги pipe2, с которыми создан пайп
+    int flags;
+    // реальный размер пайпа, учтённый в бюджете процесса
+    size_t pipe_sz;
+    // номер выдачи: освобождённый и снова выданный по тому же адресу
+    // сегмент отличим для infinitypipe_mark
+    uint64_t gen;
 
     struct infinityseg *next;
 };
 
+// пул пустых сегментов: пайпы переиспользуются вместо pipe2/close
+// пул не потокобезопасен, используется из одного потока
+struct infinityseg_pool
+{
+    struct infinityseg *head;
+    // сегментов в пуле
+    size_t count;
+    // high-water mark, 0 - пул выключен
+    size_t max_count;
+    // ёмкость сегментов для prewarm
+    size_t cap;
+    // флаги pipe2 (O_NONBLOCK|O_CLOEXEC)
+    int flags;
+};
+
+// бюджет процесса на сегменты: fd и память пайпов (включая пулы)
+struct infinityseg_budget
+{
+    // пределы, 0 - без ограничения
+    size_t max_fds;
+    size_t max_bytes;
+    // занято сегментами сейчас
+    size_t fds;
+    size_t bytes;
+    // отказов в новом сегменте по бюджету
+    size_t n_denied;
+    // сегментов, которые ядро дало меньше запрошенного
+    size_t n_short;
+};
+
+// NULL и EAGAIN, если сегмент не влезает в бюджет процесса
 struct infinityseg *infinityseg_new(size_t cap_hint, int flags);
 
 void infinityseg_free(struct infinityseg* s);
@@ -31,6 +70,43 @@ ssize_t infinityseg_read(struct infinityseg *s, void *buf, size_t size);
 
 ssize_t infinityseg_write(struct infinityseg *s, const void *buf, size_t size);
 
+// закрыть пишущий конец: данные читаются как прежде, fd возвращается
+// в бюджет; запись в запечатанный сегмент - EAGAIN, в пул он не вернётся
+void infinityseg_seal(struct infinityseg *s);
+
+// настроить пул; max_count - сколько пустых сегментов держать.
+// Сегменты, уже лежащие в пуле, закрываются, поэтому новый пул
+// должен быть обнулён
+void infinityseg_pool_init(struct infinityseg_pool *pool,
+    size_t cap, int flags, size_t max_count);
+
+// закрыть все сегменты пула
+void infinityseg_pool_clear(struct infinityseg_pool *pool);
+
+// заранее создать до count сегментов (не больше max_count)
+// возвращает сколько сегментов в пуле или -1
+ssize_t infinityseg_pool_prewarm(struct infinityseg_pool *pool, size_t count);
+
+// пределы по умолчанию читаются один раз при первом сегменте:
+// 3/4 от RLIMIT_NOFILE и от /proc/sys/fs/pipe-user-pages-soft, чтобы
+// читатели упёрлись в бюджет раньше, чем ядро начнёт урезать пайпы
+void infinityseg_budget_get(struct infinityseg_budget *b);
+
+// задать пределы вручную, 0 - без ограничения; уже созданные сегменты
+// остаются, новые не выдаются, пока занятое не опустится ниже
+void infinityseg_budget_set(size_t max_fds, size_t max_bytes);
+
+// пул текущего потока, по умолчанию выключен (max_count == 0)
+// перед завершением потока его нужно очистить infinityseg_pool_clear
+struct infinityseg_pool *infinityseg_pool_thread(void);
+
+// взять сегмент из пула или создать новый, pool может быть NULL
+struct infinityseg *infinityseg_pool_get(struct infinityseg_pool *pool,
+    size_t cap_hint, int flags);
+
+// вернуть сегмент в пул, непустые и лишние сегменты закрываются
+void infinityseg_pool_put(struct infinityseg_pool *pool, struct infinityseg *s);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
@@ -9,6 +9,8 @@ extern "C" {
 #include <event2/event.h>
 #include <event2/bufferevent.h>
 
+#include <stdio.h>
+
 struct pipeevent;
 
 typedef void (*pipeevent_data_cb)(struct pipeevent *pev, void *ctx);
@@ -21,6 +23,173 @@ typedef void (*pipeevent_event_cb)(struct pipeevent *pev, short what, void *ctx)
 #define PEV_EVENT_ERROR BEV_EVENT_ERROR         /**< unrecoverable error encountered */
 #define PEV_EVENT_TIMEOUT BEV_EVENT_TIMEOUT     /**< user-specified timeout reached */
 
+// порог output пира по умолчанию для relay
+#ifndef PIPEEVENT_RELAY_HWM
+#define PIPEEVENT_RELAY_HWM (4u * INFINITYSEG_DEFAULT_CAPACITY)
+#endif
+
+// Token bucket, как ev_token_bucket_cfg: rate - байт за тик,
+// burst - максимум накопленного, tick - длина тика (0 - 1 секунда)
+struct pipeevent_rate_cfg
+{
+    size_t read_rate;
+    size_t read_burst;
+    size_t write_rate;
+    size_t write_burst;
+    struct timeval tick;
+};
+
+struct pipeevent_rate_group;
+
+// что делать с подписчиком, у которого output больше max_lag
+enum pipeevent_bcast_policy
+{
+    // пропустить очередную порцию для этого подписчика целиком: в его
+    // потоке выпадают целые вызовы dispatch, поэтому политика для src,
+    // где каждый dispatch - законченное сообщение. Порция, вставшая в
+    // output частично, отключает подписчика как PEV_BCAST_DETACH
+    PEV_BCAST_DROP,
+    // отключить подписчика и вызвать detachcb
+    PEV_BCAST_DETACH
+};
+
+struct pipeevent_bcast;
+
+typedef void (*pipeevent_bcast_cb)(struct pipeevent_bcast *b,
+    struct pipeevent *pev, void *ctx);
+
+// пул потоков со своими event_base
+struct pipeevent_workers;
+
+// вызывается в потоке воркера, когда pipeevent создан или переехал к нему
+typedef void (*pipeevent_worker_cb)(struct pipeevent *pev, void *ctx);
+
+// счётчики pipeevent (сборка с E4PIPE_WITH_COUNTERS)
+struct pipeevent_counters
+{
+    // splice обоих буферов: bytes_in - чтение fd, bytes_out - запись
+    struct infinitypipe_counters io;
+    // срабатываний отложенного тика
+    uint64_t n_deferred;
+    // вызовов readcb/writecb и время в них, нс
+    uint64_t n_callbacks;
+    uint64_t cb_ns;
+};
+
+// привязать поток воркера i к CPU (i % число CPU)
+#define PEV_WORKERS_PIN_CPU 0x01
+
+// движок io_uring для splice/tee, один на event_base
+struct pipeevent_uring;
+
+// размер кольца io_uring по умолчанию
+#define PIPEEVENT_URING_ENTRIES 256
+
+// через сколько повторить чтение, если сегмент не выдан по бюджету, мс
+#ifndef PIPEEVENT_BUDGET_RETRY_MS
+#define PIPEEVENT_BUDGET_RETRY_MS 50
+#endif
+
+// сколько байт файла держать в output при pipeevent_add_file
+#ifndef PIPEEVENT_FILE_CHUNK
+#define PIPEEVENT_FILE_CHUNK (256u * 1024u)
+#endif
+
+// флаги pipeevent_add_file
+// закрыть fd файла, когда он отправлен или pipeevent освобождён
+#define PEV_FILE_CLOSE 0x01
+
+// запись потока pipeevent в файлы (pipeevent_tap_attach)
+struct pipeevent_tap;
+
+// ёмкость staging-пайпа tap по умолчанию: на столько запись в файлы
+// может отстать от сокета
+#ifndef PIPEEVENT_TAP_LAG
+#define PIPEEVENT_TAP_LAG (1024u * 1024u)
+#endif
+
+// через сколько проверить staging, когда tap держит fd, мс
+#ifndef PIPEEVENT_TAP_RETRY_MS
+#define PIPEEVENT_TAP_RETRY_MS 10
+#endif
+
+// что делать, когда staging tap полон
+enum pipeevent_tap_policy
+{
+    // пропустить порцию мимо файла, байты считаются в dropped
+    PEV_TAP_DROP,
+    // остановить чтение/запись fd, пока файлы не догонят
+    PEV_TAP_BACKPRESSURE
+};
+
+struct pipeevent_tap_cfg
+{
+    // файлы <path>.000000, <path>.000001, ...
+    const char *path;
+    // новый файл после rotate_bytes байт или rotate_sec секунд,
+    // 0 - без ротации
+    size_t rotate_bytes;
+    unsigned rotate_sec;
+    // ёмкость staging-пайпа, 0 - PIPEEVENT_TAP_LAG
+    size_t max_lag;
+    enum pipeevent_tap_policy policy;
+};
+
+struct pipeevent_tap_stat
+{
+    // байт ушло в staging через tee
+    uint64_t captured;
+    // байт пропущено по PEV_TAP_DROP или после ошибки записи
+    uint64_t dropped;
+    // байт записано в файлы
+    uint64_t written;
+    // ждут записи в staging
+    size_t lag;
+    // файлов открыто
+    unsigned files;
+    // errno записи в файл, после ошибки tap только пропускает байты
+    int error;
+};
+
+// класс pipeevent в планировщике event_base (pipeevent_set_sched):
+// за проход очереди классы обслуживаются по порядку, доля за одно
+// обслуживание - quantum, умноженный на вес класса
+enum pipeevent_sched_class
+{
+    // короткие запросы и ответы, вес 4
+    PEV_SCHED_INTERACTIVE,
+    // вес 2
+    PEV_SCHED_NORMAL,
+    // массовая передача, вес 1
+    PEV_SCHED_BULK
+};
+
+#define PEV_SCHED_CLASSES 3
+
+// байт за одно обслуживание направления при весе 1
+#ifndef PIPEEVENT_SCHED_QUANTUM
+#define PIPEEVENT_SCHED_QUANTUM (64u * 1024u)
+#endif
+
+// и не больше стольких splice (по сегменту на splice)
+#ifndef PIPEEVENT_SCHED_CALLS
+#define PIPEEVENT_SCHED_CALLS 16
+#endif
+
+struct pipeevent_sched_cfg
+{
+    enum pipeevent_sched_class cls;
+    // 0 - PIPEEVENT_SCHED_QUANTUM
+    size_t quantum;
+    // 0 - PIPEEVENT_SCHED_CALLS
+    unsigned max_calls;
+};
+
+// шаг колеса тайм-аутов, мс
+#ifndef PIPEEVENT_WHEEL_TICK_MS
+#define PIPEEVENT_WHEEL_TICK_MS 10
+#endif
+
 enum pipeevent_options
 {
     PEV_OPT_CLOSE_ON_FREE = BEV_OPT_CLOSE_ON_FREE
@@ -30,6 +199,10 @@ enum pipeevent_options
 struct pipeevent* pipeevent_socket_new(struct event_base *base,
     evutil_socket_t fd, size_t options);
 
+// То же, но input/output настраиваются cfg (NULL - значения по умолчанию)
+struct pipeevent* pipeevent_socket_new_config(struct event_base *base,
+    evutil_socket_t fd, size_t options, const struct infinitypipe_config *cfg);
+
 // Освободить, при OPT_CLOSE_ON_FREE — закрыть fd
 void pipeevent_free(struct pipeevent *pev);
 
@@ -42,6 +215,223 @@ void pipeevent_setcb(struct pipeevent *pev,
     pipeevent_data_cb readcb, pipeevent_data_cb writecb,
     pipeevent_event_cb eventcb, void *cb_ctx);
 
+// Связать два pipeevent: всё прочитанное из a уходит в output b и наоборот.
+// Данные идут socket->segment->socket без readcb/writecb на каждый кусок.
+// Чтение источника приостанавливается, пока output пира больше
+// high_watermark (0 - PIPEEVENT_RELAY_HWM). После EOF источника и
+// отправки всех данных пиру делается shutdown(SHUT_WR) пира, а источник
+// получает eventcb(PEV_EVENT_EOF|PEV_EVENT_READING). a и b должны быть
+// на одном event_base (EINVAL): у воркеров пула сначала pipeevent_migrate.
+int pipeevent_relay(struct pipeevent *a, struct pipeevent *b,
+    size_t high_watermark);
+
+// Разорвать relay, вернуть обычную обработку с callbacks
+void pipeevent_unrelay(struct pipeevent *pev);
+
+// Отметки как у bufferevent_setwatermark. EV_READ: readcb только когда
+// во input не меньше lowmark, чтение останавливается на highmark (0 - без
+// ограничения) и продолжается, когда input вычитан ниже. EV_WRITE: writecb
+// когда в output осталось не больше lowmark.
+void pipeevent_setwatermark(struct pipeevent *pev, short events,
+    size_t lowmark, size_t highmark);
+
+// Получить отметки для одного из EV_READ / EV_WRITE, -1 если events неверен
+int pipeevent_getwatermark(struct pipeevent *pev, short events,
+    size_t *lowmark, size_t *highmark);
+
+// Ограничить скорость pipeevent, cfg копируется; NULL - снять лимит
+int pipeevent_set_rate_limit(struct pipeevent *pev,
+    const struct pipeevent_rate_cfg *cfg);
+
+// Общий лимит для группы pipeevent одного event_base
+struct pipeevent_rate_group *pipeevent_rate_group_new(struct event_base *base,
+    const struct pipeevent_rate_cfg *cfg);
+
+// Сменить лимит группы
+int pipeevent_rate_group_set_cfg(struct pipeevent_rate_group *g,
+    const struct pipeevent_rate_cfg *cfg);
+
+// Минимальная доля участника за раз, байт (по умолчанию 64)
+int pipeevent_rate_group_set_min_share(struct pipeevent_rate_group *g,
+    size_t share);
+
+// Освободить группу, участники выходят из неё
+void pipeevent_rate_group_free(struct pipeevent_rate_group *g);
+
+// Войти в группу (из прежней - выйти). Группа и pipeevent должны быть
+// на одном event_base (EINVAL): у воркеров пула сначала pipeevent_migrate
+int pipeevent_add_to_rate_group(struct pipeevent *pev,
+    struct pipeevent_rate_group *g);
+int pipeevent_remove_from_rate_group(struct pipeevent *pev);
+
+// Рассылка одного infinitypipe многим pipeevent: данные src дублируются
+// через tee в output каждого подписчика, без копирования в user space
+struct pipeevent_bcast *pipeevent_bcast_new(struct infinitypipe *src,
+    size_t max_lag, enum pipeevent_bcast_policy policy);
+
+// Освободить, подписчики отключаются без detachcb
+void pipeevent_bcast_free(struct pipeevent_bcast *b);
+
+// Вызывается для подписчика, отключённого по PEV_BCAST_DETACH, и по
+// PEV_BCAST_DROP, если порция дошла до него не целиком
+void pipeevent_bcast_setcb(struct pipeevent_bcast *b,
+    pipeevent_bcast_cb detachcb, void *ctx);
+
+// pipeevent может быть подписан только на одну рассылку
+int pipeevent_bcast_subscribe(struct pipeevent_bcast *b, struct pipeevent *pev);
+int pipeevent_bcast_unsubscribe(struct pipeevent *pev);
+
+// Разослать всё, что есть в src, и очистить src.
+// Возвращает сколько байт было разослано
+ssize_t pipeevent_bcast_dispatch(struct pipeevent_bcast *b);
+
+// Отставание подписчика: байт в его output и пропущено по PEV_BCAST_DROP
+int pipeevent_bcast_get_lag(struct pipeevent *pev,
+    size_t *queued, size_t *dropped);
+
+// Тайм-ауты бездействия как bufferevent_set_timeouts, NULL - выключить.
+// Чтение считается, пока оно разрешено и не приостановлено, запись - пока
+// output ждёт готовности fd. По истечении направление выключается и
+// вызывается eventcb(PEV_EVENT_TIMEOUT|PEV_EVENT_READING/WRITING).
+// Таймеры общие для event_base (колесо с шагом PIPEEVENT_WHEEL_TICK_MS),
+// сброс на активности - O(1). Тайм-аут не срабатывает раньше срока и
+// может опоздать на один-два тика.
+int pipeevent_set_timeouts(struct pipeevent *pev,
+    const struct timeval *tv_read, const struct timeval *tv_write);
+
+// Квант ввода-вывода: за одно срабатывание fd pipeevent читает и пишет
+// не больше доли своего класса, остаток ждёт в очереди планировщика
+// своего event_base и дочитывается/дописывается на следующем проходе
+// цикла, после остальных готовых fd. Один быстрый отправитель не держит
+// цикл, задержка коротких соединений не растёт рядом с массовыми.
+// cfg копируется; NULL - без планировщика. Неверный класс - EINVAL.
+int pipeevent_set_sched(struct pipeevent *pev,
+    const struct pipeevent_sched_cfg *cfg);
+
+// Заполнить cfg значениями по умолчанию (PEV_SCHED_NORMAL)
+void pipeevent_sched_cfg_init(struct pipeevent_sched_cfg *cfg);
+
+// Пул из n потоков, у каждого свой event_base и свой пул сегментов.
+// n == 0 - по числу доступных CPU.
+struct pipeevent_workers *pipeevent_workers_new(int n, unsigned flags);
+
+// Останавливает потоки и освобождает оставшиеся в них pipeevent.
+// Нельзя вызывать из потока воркера.
+void pipeevent_workers_free(struct pipeevent_workers *wp);
+
+int pipeevent_workers_count(const struct pipeevent_workers *wp);
+
+struct event_base *pipeevent_workers_get_base(struct pipeevent_workers *wp,
+    int idx);
+
+// Сколько pipeevent сейчас обслуживает воркер
+size_t pipeevent_workers_get_load(const struct pipeevent_workers *wp, int idx);
+
+// Отдать fd наименее загруженному воркеру. pipeevent создаётся в его
+// потоке, cb (тоже в его потоке) ставит callback-и и включает события.
+// Если pipeevent не удалось создать, cb получит NULL, а fd закроется
+// при PEV_OPT_CLOSE_ON_FREE. Можно вызывать из любого потока.
+int pipeevent_workers_assign(struct pipeevent_workers *wp, evutil_socket_t fd,
+    size_t options, const struct infinitypipe_config *cfg,
+    pipeevent_worker_cb cb, void *ctx);
+
+// Перенести живой pipeevent вместе с fd и сегментами input/output
+// к воркеру idx. Вызывается из потока, который сейчас обслуживает pev;
+// после возврата pev принадлежит другому потоку и трогать его нельзя.
+// Пара relay переезжает целиком. Участник rate-группы или рассылки
+// привязан к своему event_base - EBUSY.
+int pipeevent_migrate(struct pipeevent *pev, struct pipeevent_workers *wp,
+    int idx, pipeevent_worker_cb cb, void *ctx);
+
+// Выровнять нагрузку: перегруженные воркеры отдают лишние pipeevent
+// наименее загруженным (cb - pipeevent_workers_set_migrate_cb).
+// Можно вызывать из любого потока, переезд идёт асинхронно.
+int pipeevent_workers_rebalance(struct pipeevent_workers *wp);
+
+// Вызывать rebalance по таймеру, NULL - выключить
+int pipeevent_workers_set_rebalance(struct pipeevent_workers *wp,
+    const struct timeval *interval);
+
+// callback для pipeevent, переехавших при rebalance
+void pipeevent_workers_set_migrate_cb(struct pipeevent_workers *wp,
+    pipeevent_worker_cb cb, void *ctx);
+
+// Движок io_uring: splice всех pipeevent event_base уходят в кольцо и
+// отправляются одним io_uring_enter за проход цикла, завершения
+// разбираются пачкой по eventfd. NULL и errno (ENOSYS, EPERM, EINVAL),
+// если сборка или ядро его не поддерживают - тогда остаётся обычный путь.
+// entries == 0 - PIPEEVENT_URING_ENTRIES.
+struct pipeevent_uring *pipeevent_uring_new(struct event_base *base,
+    unsigned entries);
+
+// Дожидается операций в ядре; pipeevent, которые ещё используют движок,
+// переходят на обычный путь.
+void pipeevent_uring_free(struct pipeevent_uring *r);
+
+// Перевести pipeevent на движок, NULL - вернуть обычный путь.
+// Пока операция в ядре - EBUSY. Такой pipeevent нельзя перенести к
+// другому воркеру.
+int pipeevent_set_uring(struct pipeevent *pev, struct pipeevent_uring *r);
+
+// Рассылка через IORING_OP_TEE: все tee одного dispatch уходят одним
+// io_uring_enter. NULL - обычный tee.
+int pipeevent_bcast_set_uring(struct pipeevent_bcast *b,
+    struct pipeevent_uring *r);
+
+// Отправить length байт файла fd с позиции offset (length < 0 - до конца
+// файла), как sendfile, но через сегменты output: файл доливается
+// порциями по PIPEEVENT_FILE_CHUNK по мере того, как сокет их забирает,
+// байты не проходят через user space. writecb не вызывается, пока файл
+// не отправлен; данные, добавленные в output раньше, уйдут перед файлом,
+// добавленные позже - вперемешку с ним. Один файл за раз (EBUSY), не для
+// relay. Ошибка чтения файла - eventcb(PEV_EVENT_ERROR|PEV_EVENT_WRITING).
+int pipeevent_add_file(struct pipeevent *pev, int fd, off_t offset,
+    off_t length, unsigned flags);
+
+// Писать в файлы поток fd: EV_READ - всё прочитанное (и в input, и в
+// output пира relay), EV_WRITE - всё отправленное из output. Новые байты
+// дублируются tee в staging-пайп, отдельный поток переливает его в файлы
+// splice, данные не проходят через user space. Запись отстаёт не больше
+// чем на ёмкость staging, дальше - cfg->policy. Пока tap стоит, это
+// направление идёт мимо io_uring. Один tap на направление (EBUSY).
+// Каждый tap запускает свой поток записи: на тысячи соединений с tap
+// это тысячи потоков, стеков и переключений
+int pipeevent_tap_attach(struct pipeevent *pev, short what,
+    const struct pipeevent_tap_cfg *cfg);
+
+// Снять tap: остаток staging поток записи допишет в файлы сам,
+// цикл событий его не ждёт. Прочитанное, но ещё не отданное (EV_READ)
+// переходит в буфер; если оно должно встать за вытесненными данными,
+// а файл вытеснения его не взял - -1 с errno записи, tap остаётся
+int pipeevent_tap_detach(struct pipeevent *pev, short what);
+
+// Заполнить cfg значениями по умолчанию (без ротации, PEV_TAP_DROP)
+void pipeevent_tap_cfg_init(struct pipeevent_tap_cfg *cfg);
+
+// Счётчики tap, ENOENT - tap на этом направлении нет
+int pipeevent_tap_get_stat(struct pipeevent *pev, short what,
+    struct pipeevent_tap_stat *st);
+
+// Пороги в ядре, 0 - не управлять и вернуть значение по умолчанию.
+// rcvlowat - SO_RCVLOWAT: fd готов к чтению, когда пришло столько байт;
+// порог снижается, если столько уже не поместится во input (или в output
+// пира relay), EOF будит всегда. notsent_lowat - TCP_NOTSENT_LOWAT: пока
+// в output ждёт больше notsent_lowat байт, в очереди сокета остаётся не
+// больше стольких неотправленных, остальное ждёт в сегментах; когда
+// output пуст, порог снимается. Не TCP-сокет с notsent_lowat - ENOPROTOOPT.
+int pipeevent_set_lowat(struct pipeevent *pev, size_t rcvlowat,
+    size_t notsent_lowat);
+
+// Счётчики pipeevent, -1 и ENOSYS в сборке без E4PIPE_WITH_COUNTERS
+int pipeevent_get_counters(struct pipeevent *pev,
+    struct pipeevent_counters *c);
+
+// Сумма по всем pipeevent и infinitypipe процесса, из любого потока
+int pipeevent_get_global_counters(struct pipeevent_counters *c);
+
+// Записать сумму процесса в out строками "имя значение"
+int pipeevent_counters_dump(FILE *out);
+
 // Доступ к fd
 int pipeevent_get_fd(struct pipeevent *pev);
 
@@ -5,6 +5,126 @@
 
 #include <event2/event_struct.h>
 
+/* token bucket одного pipeevent или группы */
+struct pipeevent_rate_bucket {
+    struct pipeevent_rate_cfg cfg;
+    // остаток на текущий тик, может уйти в минус
+    ev_ssize_t read_limit;
+    ev_ssize_t write_limit;
+    // номер тика последнего пополнения
+    ev_uint64_t last_tick;
+};
+
+/* индивидуальный лимит pipeevent */
+struct pipeevent_rate_limit {
+    struct pipeevent_rate_bucket bucket;
+    // таймер пополнения, пока pipeevent приостановлен
+    struct event ev_refill;
+    size_t refill_added;
+};
+
+struct pipeevent_rate_group {
+    struct event_base *base;
+    struct pipeevent_rate_bucket bucket;
+    // тик пополнения группы
+    struct event ev_tick;
+    // участники группы
+    struct pipeevent *head;
+    size_t n_members;
+    // минимальная доля участника, байт
+    size_t min_share;
+    short suspended;
+};
+
+struct pipeevent_bcast {
+    struct infinitypipe *src;
+    size_t max_lag;
+    enum pipeevent_bcast_policy policy;
+    pipeevent_bcast_cb detachcb;
+    void *cb_ctx;
+    // подписчики
+    struct pipeevent *head;
+    size_t n_subs;
+    // tee пачкой через io_uring
+    struct pipeevent_uring *uring;
+};
+
+/* таймер чтения/записи pipeevent в колесе */
+struct pipeevent_timer {
+    // список слота колеса, в котором сейчас лежит таймер
+    struct pipeevent_timer **list;
+    struct pipeevent_timer *next;
+    struct pipeevent_timer *prev;
+    struct pipeevent *pev;
+    // тайм-аут в тиках, 0 - выключен
+    ev_uint64_t timeout;
+    // тик последней активности, сброс - просто запись тика
+    ev_uint64_t last;
+    // PEV_EVENT_READING или PEV_EVENT_WRITING
+    short what;
+};
+
+#define PEV_WHEEL_LEVELS 4
+#define PEV_WHEEL_BITS 6
+#define PEV_WHEEL_SLOTS (1 << PEV_WHEEL_BITS)
+
+/* иерархическое колесо таймеров, одно на event_base */
+struct pipeevent_wheel {
+    struct event_base *base;
+    struct event ev_tick;
+    size_t tick_added;
+    // сколько pipeevent используют колесо
+    size_t refcnt;
+    // сколько таймеров стоит в колесе
+    size_t active;
+    // обработано до этого тика
+    ev_uint64_t cur;
+    struct pipeevent_timer *slots[PEV_WHEEL_LEVELS][PEV_WHEEL_SLOTS];
+    // таймеры, которые разбираются прямо сейчас
+    struct pipeevent_timer *expired;
+    struct pipeevent_wheel *next;
+};
+
+/* место pipeevent в очереди планировщика, по одному на направление */
+struct pipeevent_sched_node {
+    struct pipeevent_sched_node *next;
+    struct pipeevent_sched_node *prev;
+    struct pipeevent *pev;
+    // остаток кванта
+    size_t left;
+    // проход, на котором встал в очередь
+    ev_uint64_t pass;
+    // EV_READ или EV_WRITE
+    short what;
+    short queued;
+};
+
+/* планировщик, один на event_base */
+struct pipeevent_sched {
+    struct event_base *base;
+    // проход очереди, один на итерацию цикла
+    struct event ev_run;
+    size_t run_added;
+    size_t refcnt;
+    ev_uint64_t pass;
+    struct pipeevent_sched_node *head[PEV_SCHED_CLASSES];
+    struct pipeevent_sched_node *tail[PEV_SCHED_CLASSES];
+    struct pipeevent_sched *next;
+};
+
+/* операция io_uring pipeevent: не больше одной на направление */
+struct pipeevent_uring_op {
+    // PEV_UR_READ/PEV_UR_WRITE, первым полем - по нему разбирается CQE
+    short kind;
+    short busy;
+    struct pipeevent *pev;
+    // куда читаем (input или output пира relay) / откуда пишем
+    struct infinitypipe *ip;
+    // сегмент принадлежит операции, пока она в ядре
+    struct infinityseg *seg;
+    size_t len;
+};
+
 struct pipeevent {
     struct event_base *base;
     evutil_socket_t fd;
@@ -19,6 +139,9 @@ struct pipeevent {
     struct event ev_deferred;
     size_t deferred_scheduled;
 
+    /* повтор чтения, отложенного бюджетом сегментов */
+    struct event ev_budget;
+
     pipeevent_data_cb  readcb;
     pipeevent_data_cb  writecb;
     pipeevent_event_cb eventcb;
@@ -29,4 +152,80 @@ struct pipeevent {
 
     unsigned pending_flags;
     size_t cb_running;
+
+    /* watermarks (pipeevent_setwatermark) */
+    size_t wm_read_low;
+    size_t wm_read_high;
+    size_t wm_write_low;
+    size_t wm_write_high;
+
+    /* причины, по которым чтение/запись временно остановлены (PEV_SUSPEND_*) */
+    short read_suspended;
+    short write_suspended;
+
+    /* rate limit и группа */
+    struct pipeevent_rate_limit *rate;
+    struct pipeevent_rate_group *rate_group;
+    struct pipeevent *rg_next;
+    struct pipeevent *rg_prev;
+
+    /* подписка на рассылку */
+    struct pipeevent_bcast *bcast;
+    struct pipeevent *bc_next;
+    struct pipeevent *bc_prev;
+    size_t bc_dropped;
+
+    /* тайм-ауты (pipeevent_set_timeouts) */
+    struct pipeevent_wheel *wheel;
+    struct pipeevent_timer tm_read;
+    struct pipeevent_timer tm_write;
+
+    /* планировщик event_base (pipeevent_set_sched), quantum 0 - выключен */
+    struct pipeevent_sched *sched;
+    struct pipeevent_sched_cfg sched_cfg;
+    struct pipeevent_sched_node sc_rd;
+    struct pipeevent_sched_node sc_wr;
+
+    /* воркер пула, который обслуживает pipeevent */
+    struct pipeevent_worker *worker;
+    struct pipeevent *wk_next;
+    struct pipeevent *wk_prev;
+
+    /* движок io_uring (pipeevent_set_uring) */
+    struct pipeevent_uring *uring;
+    struct pipeevent *ur_next;
+    struct pipeevent *ur_prev;
+    struct pipeevent_uring_op ur_rd;
+    struct pipeevent_uring_op ur_wr;
+    // фронт готовности пришёл, пока чтение было в ядре
+    short ur_again;
+    // pipeevent_free ждёт завершения операций в ядре
+    short ur_zombie;
+
+    /* файл, который доливается в output (pipeevent_add_file) */
+    int file_fd;
+    unsigned file_flags;
+    off_t file_off;
+    off_t file_left;
+
+    /* пороги сокета (pipeevent_set_lowat) и выставленные сейчас значения,
+       0 - у fd значение ядра */
+    size_t lowat_rcv;
+    size_t lowat_notsent;
+    int so_rcvlowat;
+    int so_notsent;
+
+    /* запись прочитанного и отправленного в файлы (pipeevent_tap_attach) */
+    struct pipeevent_tap *tap_rd;
+    struct pipeevent_tap *tap_wr;
+
+    /* relay: пир, куда уходит всё прочитанное */
+    struct pipeevent *relay;
+    size_t relay_hwm;
+    unsigned relay_flags;
+
+    /* счётчики (E4PIPE_WITH_COUNTERS), splice считают in и out */
+    uint64_t cnt_deferred;
+    uint64_t cnt_callbacks;
+    uint64_t cnt_cb_ns;
 };
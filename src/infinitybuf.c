@@ -3,10 +3,14 @@
 #include "e4pipe/infinitybuf.h"
 #include "infinitypipe-int.h"
 
+#include <sys/uio.h>
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
 
+// сколько кусков evbuffer обрабатываем за один проход
+#define IP_BRIDGE_IOV 16
+
 ev_ssize_t infinitypipe_write(struct infinitypipe *ip,
     struct evbuffer *out, size_t max_bytes)
 {
@@ -27,90 +31,44 @@ ev_ssize_t infinitypipe_write(struct infinitypipe *ip,
     if (max_bytes == 0 || ip->head == NULL)
         return 0;
 
-    size_t total = 0;
+    size_t want = max_bytes;
+    if (want > ip->total_len)
+        want = ip->total_len;
 
-    while (ip->head && total < max_bytes)
+    // резервируем место сразу под всё, что заберём из сегментов
+    struct evbuffer_iovec vec[IP_BRIDGE_IOV];
+    int n = evbuffer_reserve_space(out, (ev_ssize_t)want, vec, IP_BRIDGE_IOV);
+    if (n <= 0)
     {
-        struct infinityseg *s = ip->head;
-
-        // таких у нас быть не должно
-        assert(s->len == 0);
-
-        size_t avail = s->len;
-        size_t want = max_bytes - total;
-        if (want > avail)
-            want = avail;
-        if (want == 0)
-            break;
-
-        struct evbuffer_iovec vec[1];
-        int n = evbuffer_reserve_space(out, want, vec, 1);
-        if (n <= 0)
-        {
-            if (!total)
-            {
-                errno = ENOBUFS;
-                return -1;
-            }
-            break;
-        }
-
-        /* реально читаем не больше, чем нам отдали в iov */
-        size_t to_read = vec[0].iov_len;
-        if (to_read > want)
-            to_read = want;
-
-        ssize_t r = read(s->p[0], vec[0].iov_base, to_read);
-        if (r > 0)
-        {
-            vec[0].iov_len = (size_t)r;
-            evbuffer_commit_space(out, vec, 1);
-
-            s->len -= (size_t)r;
-            ip_dec_total_len(ip, (size_t)r);
-            total += (size_t)r;
-
-            if (s->len == 0)
-            {
-                ip->head = s->next;
-                if (!ip->head)
-                    ip->tail = NULL;
-                
-                infinityseg_free(s);
-            }
-            continue;
-        }
-
-        // ничего не прочитали — освободим зарезервированное место
-        vec[0].iov_len = 0;
-        evbuffer_commit_space(out, vec, 1);
-
-        if (r == 0)
-        {
-            // EOF по pipe — странно, но считаем, что данных больше нет
-            break;
-        }
+        errno = ENOBUFS;
+        return -1;
+    }
 
-        if (errno == EINTR)
-            continue;
+    struct iovec iov[IP_BRIDGE_IOV];
+    for (int i = 0; i < n; ++i)
+    {
+        iov[i].iov_base = vec[i].iov_base;
+        iov[i].iov_len = vec[i].iov_len;
+    }
 
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-            if (!total)
-                return -1;
-            break;
-        }
+    // readv на сегмент, один сегмент может лечь в несколько iovec
+    ssize_t rc = ip_readv(ip, iov, n, want);
 
-        /* ошибка */
-        if (!total)
-            return -1;
-        break;
+    size_t left = (rc > 0) ? (size_t)rc : 0;
+    int used = 0;
+    for (; used < n && left; ++used)
+    {
+        if (vec[used].iov_len > left)
+            vec[used].iov_len = left;
+        left -= vec[used].iov_len;
     }
+    // used == 0 просто отменяет резерв
+    evbuffer_commit_space(out, vec, used);
 
-    if (total)
-        ip_note_change(ip, 0, total);
+    if (rc > 0)
+        ip_note_change(ip, 0, (size_t)rc);
 
-    return (ssize_t)total;
+    return rc;
 #endif
 }
 
@@ -138,76 +96,45 @@ ev_ssize_t infinitypipe_read(struct infinitypipe *ip,
 
     size_t total = 0;
 
-    while ((total < max_bytes) && (avail > 0))
+    while (total < max_bytes && evbuffer_get_length(in) > 0)
     {
-        struct infinityseg *s = ip->tail;
-        size_t newly_allocated = 0;
-
-        // Нужен новый сегмент? Создаём, но НЕ прицепляем к списку пока не будет rc>0
-        if (!s || s->len >= s->cap)
-        {
-            s = infinityseg_new(ip->seg_capacity, ip->flags);
-            if (!s)
-            {
-                if (total)
-                    break;
-                return -1;
-            }
-            newly_allocated = 1;
-        }
+        // собираем несколько кусков evbuffer без копирования
+        struct evbuffer_iovec vec[IP_BRIDGE_IOV];
+        int n = evbuffer_peek(in, (ev_ssize_t)(max_bytes - total),
+            NULL, vec, IP_BRIDGE_IOV);
+        if (n <= 0)
+            break;
+        if (n > IP_BRIDGE_IOV)
+            n = IP_BRIDGE_IOV;
 
-        size_t room = s->cap - s->len;
-        size_t want = max_bytes - total;
-        if (want > room)
-            want = room;
-        if (want == 0)
+        struct iovec iov[IP_BRIDGE_IOV];
+        size_t want = 0;
+        for (int i = 0; i < n; ++i)
         {
-            if (newly_allocated)
-                infinityseg_free(s);
-            break;
+            size_t len = vec[i].iov_len;
+            if (len > max_bytes - total - want)
+                len = max_bytes - total - want;
+            iov[i].iov_base = vec[i].iov_base;
+            iov[i].iov_len = len;
+            want += len;
         }
 
-        int rc = evbuffer_write_atmost(in, s->p[1], (ev_ssize_t)want);
+        // writev на сегмент, куски могут лечь в несколько сегментов
+        ssize_t rc = infinitypipe_addv(ip, iov, n);
         if (rc > 0)
         {
-            ip_seg_add(ip, s);
-
-            s->len += (size_t)rc;
-            ip_inc_total_len(ip, (size_t)rc);
+            evbuffer_drain(in, (size_t)rc);
             total += (size_t)rc;
+            if ((size_t)rc < want)
+                break;
             continue;
         }
 
-        // ничего не записали => если сегмент новый, он должен быть убран
-        if (newly_allocated)
-        {
-            infinityseg_free(s);
-        }
-
-        if (rc == 0)
-        {
-            // EOF or no data
-            break;
-        }
-
-        if (errno == EINTR)
-            continue;
-
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-        {
-            if (!total)
-                return -1;
-            break;
-        }
-
         if (!total)
             return -1;
         break;
     }
 
-    if (total)
-        ip_note_change(ip, total, 0);
-
     return (ssize_t)total;
 #endif
-}
\ No newline at end of file
+}
@@ -2,11 +2,136 @@
 
 #include "e4pipe/infinitypipe_struct.h"
 
+#include <errno.h>
+
+// постоянный sink (/dev/null) для сброса данных
+int ip_sink_fd(void);
+
+// новый номер выдачи (infinityseg.gen): и для сегмента, граница
+// которого сдвинулась, - отметки на нём больше не действуют
+uint64_t ip_seg_gen_next(void);
+
+#ifdef E4PIPE_WITH_COUNTERS
+#include <stdatomic.h>
+
+// сумма счётчиков процесса, обновляется relaxed: порядок не важен
+struct ip_counters
+{
+    atomic_uint_fast64_t bytes_in;
+    atomic_uint_fast64_t bytes_out;
+    atomic_uint_fast64_t n_splice;
+    atomic_uint_fast64_t n_eagain;
+    atomic_uint_fast64_t n_partial;
+    atomic_uint_fast64_t segs_created;
+    atomic_uint_fast64_t segs_freed;
+    atomic_uint_fast64_t cap_held;
+};
+
+extern struct ip_counters ip_global;
+
+#define IP_COUNT_GLOBAL(field, n) \
+    atomic_fetch_add_explicit(&ip_global.field, (n), memory_order_relaxed)
+
+#define IP_COUNT(ip, field, n) \
+    do { \
+        (ip)->cnt.field += (n); \
+        IP_COUNT_GLOBAL(field, (n)); \
+    } while (0)
+#else
+#define IP_COUNT_GLOBAL(field, n) ((void)0)
+#define IP_COUNT(ip, field, n) ((void)0)
+#endif
+
+/* итог одного splice с fd, вызывать сразу после него (смотрит errno) */
+static inline void ip_count_splice(struct infinitypipe *ip, ssize_t rc,
+    size_t want, int out)
+{
+#ifdef E4PIPE_WITH_COUNTERS
+    IP_COUNT(ip, n_splice, 1);
+    if (rc > 0)
+    {
+        if (out)
+            IP_COUNT(ip, bytes_out, (size_t)rc);
+        else
+            IP_COUNT(ip, bytes_in, (size_t)rc);
+        if ((size_t)rc < want)
+            IP_COUNT(ip, n_partial, 1);
+    }
+    else if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        IP_COUNT(ip, n_eagain, 1);
+    }
+#else
+    (void)ip;
+    (void)rc;
+    (void)want;
+    (void)out;
+#endif
+}
+
+struct iovec;
+
+// сколько iovec собирать на один writev/vmsplice/readv
+#define IP_ADD_IOV_MAX 64
+
+// вычитать в iovec с головы буфера, readv на сегмент;
+// total_len уменьшается, ip_note_change остаётся вызывающему
+ssize_t ip_readv(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec, size_t max_bytes);
+
 static inline size_t ip_is_empty(const struct infinitypipe *ip)
 {
-    return ip->total_len == 0;
+    return ip->total_len == 0 && ip->spill_len == 0;
+}
+
+// байт в буфере вместе с вытесненными в файл и головой, которую ещё
+// отправляет io_uring: пока операция в ядре, они не отправлены
+static inline size_t ip_queued(const struct infinitypipe *ip)
+{
+    size_t n = ip->total_len + ip->spill_len;
+    if (ip->inflight)
+        n += ip->inflight->len;
+    return n;
+}
+
+// сколько всего может принять splice_in
+static inline size_t ip_capacity(const struct infinitypipe *ip)
+{
+    return ip->max_size + ip->spill_max;
+}
+
+/* файл вытеснения (infinityspill.c) */
+
+// данные идут в файл: буфер полон или в файле уже что-то есть (FIFO)
+static inline size_t ip_spill_wanted(const struct infinitypipe *ip)
+{
+    return ip->spill_len || (ip->spill_max && ip->total_len >= ip->max_size);
+}
+
+// сколько ещё примет файл вытеснения до spill_max
+static inline size_t ip_spill_room(const struct infinitypipe *ip)
+{
+    return (ip->spill_max > ip->spill_len) ? ip->spill_max - ip->spill_len : 0;
 }
 
+// splice_in через промежуточный сегмент в файл
+ssize_t ip_spill_in(struct infinitypipe *ip, int in_fd, loff_t *off,
+    size_t max_bytes);
+
+// перелить len байт из пайпа fd в конец файла, вернёт сколько перелито
+ssize_t ip_spill_put(struct infinitypipe *ip, int fd, size_t len);
+
+// дописать память в конец файла, не больше ip_spill_room;
+// места нет - EAGAIN
+ssize_t ip_spill_writev(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec);
+
+// долить сегменты из файла до max_size, вернёт сколько байт добавлено;
+// ip_note_change остаётся вызывающему
+size_t ip_spill_fill(struct infinitypipe *ip);
+
+void ip_spill_free(struct infinitypipe *ip);
+
 static inline void ip_inc_total_len(struct infinitypipe *ip, size_t val)
 {
     if (ip->stat.n_added == 0 && ip->stat.n_deleted == 0)
@@ -29,9 +154,14 @@ static inline void ip_dec_total_len(struct infinitypipe *ip, size_t val)
 
 static inline void ip_note_change(struct infinitypipe *ip, size_t added, size_t deleted)
 {
+    // голову вычитали - доливаем из файла вытеснения
+    if (deleted && ip->spill_len)
+        added += ip_spill_fill(ip);
+
     if (added == 0 && deleted == 0)
         return;
 
+    ip->drained += deleted;
     ip->stat.n_added += added;
     ip->stat.n_deleted += deleted;
 
@@ -46,6 +176,65 @@ static inline void ip_note_change(struct infinitypipe *ip, size_t added, size_t
     }
 }
 
+// все сегменты буфера берутся и отдаются через ip_seg_new*/ip_seg_release/
+// ip_seg_drop, иначе segs_created и segs_freed экземпляра расходятся
+static inline struct infinityseg *ip_seg_new_cap(struct infinitypipe *ip,
+    size_t cap)
+{
+    struct infinityseg *s = infinityseg_pool_get(ip->pool, cap, (int)ip->flags);
+#ifdef E4PIPE_WITH_COUNTERS
+    if (s)
+        ip->cnt.segs_created++;
+#endif
+    return s;
+}
+
+static inline struct infinityseg *ip_seg_new(struct infinitypipe *ip)
+{
+    return ip_seg_new_cap(ip, ip->seg_capacity);
+}
+
+static inline void ip_seg_release(struct infinitypipe *ip, struct infinityseg *s)
+{
+#ifdef E4PIPE_WITH_COUNTERS
+    ip->cnt.segs_freed++;
+#endif
+    infinityseg_pool_put(ip->pool, s);
+}
+
+// сегмент с данными, которые не нужны: в пул его не вернуть
+static inline void ip_seg_drop(struct infinitypipe *ip, struct infinityseg *s)
+{
+#ifdef E4PIPE_WITH_COUNTERS
+    ip->cnt.segs_freed++;
+#endif
+    infinityseg_free(s);
+}
+
+// примет ли пул сегмент после того, как он опустеет
+static inline size_t ip_pool_wants(const struct infinitypipe *ip,
+    const struct infinityseg *s)
+{
+    const struct infinityseg_pool *pool = ip->pool;
+    return pool && pool->count < pool->max_count && pool->flags == s->flags;
+}
+
+// в сегмент больше нельзя писать: полон по байтам/буферам или запечатан
+static inline size_t ip_seg_full(const struct infinityseg *s)
+{
+    return s->len >= s->cap || s->p[1] < 0;
+}
+
+/* полный сегмент не в хвосте больше никто не пишет: закрываем пишущий
+   конец и держим один fd вместо двух; с пулом не запечатываем, чтобы
+   опустевший пайп вернулся в пул, а не закрылся */
+static inline void ip_seg_seal(struct infinitypipe *ip, struct infinityseg *s)
+{
+    if (s->p[1] >= 0 && s->len >= s->cap && s != ip->tail &&
+        !(ip->pool && ip->pool->max_count))
+        infinityseg_seal(s);
+}
+
 static inline void ip_seg_add(struct infinitypipe *ip, struct infinityseg *s)
 {
     if (!ip->head)
@@ -54,9 +243,12 @@ static inline void ip_seg_add(struct infinitypipe *ip, struct infinityseg *s)
     }
     else
     {
-        ip->tail->next = s;
+        struct infinityseg *prev = ip->tail;
+        prev->next = s;
         ip->tail = s;
+        ip_seg_seal(ip, prev);
     }
+    ip->n_segs++;
 }
 
 static inline void ip_seg_free_head(struct infinitypipe *ip)
@@ -67,6 +259,7 @@ static inline void ip_seg_free_head(struct infinitypipe *ip)
     ip->head = s->next;
     if (!ip->head)
         ip->tail = NULL;
-    
-    infinityseg_free(s);
+    ip->n_segs--;
+
+    ip_seg_release(ip, s);
 }
\ No newline at end of file
@@ -7,6 +7,33 @@
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+
+// общий для процесса /dev/null, открывается один раз
+static _Atomic int sink_fd = -1;
+
+int ip_sink_fd(void)
+{
+    int fd = atomic_load_explicit(&sink_fd, memory_order_acquire);
+    if (fd >= 0)
+        return fd;
+
+    fd = open("/dev/null", O_WRONLY|O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    int expected = -1;
+    if (!atomic_compare_exchange_strong(&sink_fd, &expected, fd))
+    {
+        // другой поток успел первым
+        close(fd);
+        fd = expected;
+    }
+
+    return fd;
+}
 
 size_t infinitypipe_get_length(const struct infinitypipe *ip)
 {
@@ -16,6 +43,7 @@ size_t infinitypipe_get_length(const struct infinitypipe *ip)
 void infinitypipe_mark(struct infinitypipe *ip, struct infinitypipe_mark *m)
 {
     m->last_before = ip->tail;
+    m->gen = ip->tail ? ip->tail->gen : 0;
 }
 
 void infinitypipe_set_max_size(struct infinitypipe *ip, size_t max_size)
@@ -23,6 +51,23 @@ void infinitypipe_set_max_size(struct infinitypipe *ip, size_t max_size)
     ip->max_size = max_size;
 }
 
+size_t infinitypipe_get_seg_capacity(const struct infinitypipe *ip)
+{
+    return ip->seg_capacity;
+}
+
+size_t infinitypipe_get_max_splice(const struct infinitypipe *ip)
+{
+    return ip->max_splice;
+}
+
+void infinitypipe_set_pool(struct infinitypipe *ip, struct infinityseg_pool *pool)
+{
+    assert(ip);
+
+    ip->pool = pool;
+}
+
 void infinitypipe_setcb(struct infinitypipe *ip, infinitypipe_notify_fn fn, void *fn_arg)
 {
     assert(ip);
@@ -54,14 +99,49 @@ int infinitypipe_get_stat(struct infinitypipe *ip, struct infinitypipe_info *sta
 
 /* ---- public ---- */
 
+void infinitypipe_config_init(struct infinitypipe_config *cfg)
+{
+    assert(cfg);
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->seg_capacity = INFINITYSEG_DEFAULT_CAPACITY;
+    cfg->seg_min = INFINITYSEG_MIN_CAPACITY;
+    cfg->seg_max = INFINITYSEG_MAX_CAPACITY;
+    cfg->max_size = INFINITYPIPE_MAX_SIZE;
+    cfg->max_splice = INFINITYPIPE_MAX_SPLICE_AT_ONCE;
+}
+
 int infinitypipe_init(struct infinitypipe *ip, size_t seg_capacity, size_t flags)
+{
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = seg_capacity;
+    cfg.flags = flags;
+    return infinitypipe_init_config(ip, &cfg);
+}
+
+int infinitypipe_init_config(struct infinitypipe *ip,
+    const struct infinitypipe_config *cfg)
 {
     assert(ip);
+    assert(cfg);
 
     memset(ip, 0, sizeof(*ip));
-    ip->seg_capacity = seg_capacity ? seg_capacity : INFINITYSEG_DEFAULT_CAPACITY;
-    ip->flags = flags;
-    ip->max_size = INFINITYPIPE_MAX_SIZE;
+    ip->seg_capacity = cfg->seg_capacity ?
+        cfg->seg_capacity : INFINITYSEG_DEFAULT_CAPACITY;
+    ip->seg_min = cfg->seg_min ? cfg->seg_min : INFINITYSEG_MIN_CAPACITY;
+    ip->seg_max = cfg->seg_max ? cfg->seg_max : INFINITYSEG_MAX_CAPACITY;
+    if (ip->seg_max < ip->seg_min)
+        ip->seg_max = ip->seg_min;
+    ip->flags = cfg->flags;
+    ip->max_size = cfg->max_size ? cfg->max_size : INFINITYPIPE_MAX_SIZE;
+    ip->max_splice = cfg->max_splice ?
+        cfg->max_splice : INFINITYPIPE_MAX_SPLICE_AT_ONCE;
+    ip->mode = cfg->mode;
+    ip->pool = infinityseg_pool_thread();
+    ip->spill_fd = -1;
+    ip->spill_max = cfg->spill_max;
+    ip->spill_dir = cfg->spill_dir;
     return 0;
 }
 
@@ -74,22 +154,134 @@ void infinitypipe_free(struct infinitypipe *ip)
     while (s)
     {
         struct infinityseg *n = s->next;
-        infinityseg_free(s);
+        ip_seg_release(ip, s);
         s = n;
     }
+    ip_spill_free(ip);
     memset(ip, 0, sizeof(*ip));
+    ip->spill_fd = -1;
 }
 
-ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_bytes)
+#ifdef __linux__
+static size_t ip_round_capacity(const struct infinitypipe *ip, size_t want)
+{
+    size_t cap = ip->seg_min;
+    while (cap < want && cap < ip->seg_max)
+        cap <<= 1;
+    return (cap > ip->seg_max) ? ip->seg_max : cap;
+}
+
+/* ёмкость следующего сегмента по среднему размеру пачки и FIONREAD */
+static void ip_adapt_capacity(struct infinitypipe *ip, int in_fd)
+{
+    size_t want = ip->adapt_avg;
+
+    if (ip->mode & IP_MODE_FIONREAD)
+    {
+        int avail = 0;
+        if (ioctl(in_fd, FIONREAD, &avail) == 0 && (size_t)avail > want)
+            want = (size_t)avail;
+    }
+
+    if (want)
+        ip->seg_capacity = ip_round_capacity(ip, want);
+}
+
+/* скользящее среднее байт за вызов splice_in */
+static void ip_adapt_sample(struct infinitypipe *ip, size_t n)
+{
+    if (!ip->adapt_avg)
+        ip->adapt_avg = n;
+    else
+        ip->adapt_avg = ip->adapt_avg - ip->adapt_avg / 8 + n / 8;
+}
+
+/* слить соседние сегменты: голова следующего доливается в свободное
+   место предыдущего через splice(pipe->pipe), опустевший сегмент уходит */
+static size_t ip_compact(struct infinitypipe *ip)
+{
+    size_t freed = 0;
+    struct infinityseg *a = ip->head;
+
+    while (a && a->next)
+    {
+        struct infinityseg *b = a->next;
+        size_t want = ip_seg_full(a) ? 0 : a->cap - a->len;
+        if (want > b->len)
+            want = b->len;
+
+        ssize_t rc = 0;
+        while (want)
+        {
+            rc = splice(b->p[0], NULL, a->p[1], NULL, want,
+                SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+            if (rc >= 0 || errno != EINTR)
+                break;
+        }
+
+        if (rc > 0)
+        {
+            a->len += (size_t)rc;
+            b->len -= (size_t)rc;
+            // конец a сдвинулся: отметка на нём указала бы не ту границу
+            a->gen = ip_seg_gen_next();
+        }
+
+        if (b->len == 0)
+        {
+            a->next = b->next;
+            if (ip->tail == b)
+                ip->tail = a;
+            ip->n_segs--;
+            b->next = NULL;
+            ip_seg_release(ip, b);
+            ++freed;
+            continue;
+        }
+
+        // a заполнен по байтам или по буферам пайпа (EAGAIN), дальше доливаем в b
+        if (rc < 0 && errno == EAGAIN)
+        {
+            IP_COUNT_GLOBAL(cap_held, (uint_fast64_t)a->len - a->cap);
+            a->cap = a->len;
+        }
+        ip_seg_seal(ip, a);
+        a = b;
+    }
+
+    return freed;
+}
+
+/* IP_MODE_COMPACT: уплотнить, когда сегментов заметно больше, чем нужно
+   под total_len; после прохода порог удваивается, чтобы буфер из
+   несливаемых мелких записей не уплотнялся на каждой операции */
+static void ip_compact_check(struct infinitypipe *ip)
+{
+    if (!(ip->mode & IP_MODE_COMPACT))
+        return;
+
+    if (ip->n_segs < ip->compact_at / 4)
+        ip->compact_at = 0;
+
+    size_t ideal = ip->total_len / ip->seg_capacity + 1;
+    if (ip->n_segs <= ideal + INFINITYPIPE_COMPACT_SLACK ||
+        ip->n_segs <= ip->compact_at)
+        return;
+
+    int err = errno;
+    ip_compact(ip);
+    ip->compact_at = ip->n_segs * 2;
+    errno = err;
+}
+#endif
+
+#ifdef __linux__
+/* off == NULL - поток (сокет, пайп), иначе позиция файла, как у pread */
+static ssize_t ip_splice_in_segs(struct infinitypipe *ip, int in_fd,
+    loff_t *off, size_t max_bytes)
 {
-#ifndef __linux__
-    (void)ip;
-    (void)in_fd;
-    (void)max_bytes;
-    errno = ENOSYS;
-    return -1;
-#else
     size_t total = 0;
+    ip->seg_denied = 0;
 
     while (total < max_bytes)
     {
@@ -107,15 +299,20 @@ ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_by
         size_t newly_allocated = 0;
 
         /* Нужен новый сегмент? Создаём, но НЕ прицепляем к списку пока не будет rc>0 */
-        if (!s || s->len >= s->cap)
+        if (!s || ip_seg_full(s))
         {
-            s = infinityseg_new(ip->seg_capacity, ip->flags);
+            if (ip->mode & IP_MODE_ADAPTIVE)
+                ip_adapt_capacity(ip, in_fd);
+
+            s = ip_seg_new(ip);
             if (!s)
             {
                 if (errno == EMFILE || errno == ENFILE) {
                     // буфер забит по ресурсам
                     errno = EAGAIN;   
                 }
+                // fd готов, но читать некуда: ждать готовности бесполезно
+                ip->seg_denied = (errno == EAGAIN);
                 if (total)
                     break;
                 return -1;
@@ -130,12 +327,13 @@ ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_by
         if (want == 0)
         {
             if (newly_allocated)
-                infinityseg_free(s);
+                ip_seg_release(ip, s);
             break;
         }
 
-        ssize_t rc = splice(in_fd, NULL, s->p[1], 
+        ssize_t rc = splice(in_fd, off, s->p[1],
             NULL, want, SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        ip_count_splice(ip, rc, want, 0);
 
         if (rc > 0)
         {
@@ -155,7 +353,7 @@ ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_by
         /* ничего не записали => если сегмент новый, он должен быть убран */
         if (newly_allocated)
         {
-            infinityseg_free(s);
+            ip_seg_release(ip, s);
         }
 
         if (rc == 0)
@@ -169,6 +367,17 @@ ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_by
 
         if (errno == EAGAIN || errno == EWOULDBLOCK)
         {
+            // файл всегда готов, у сокета данные видны по FIONREAD:
+            // кончились буферы пайпа, а не данные (мелкие записи в tail),
+            // считаем его заполненным
+            int avail = 0;
+            if (!newly_allocated && (off ||
+                (ioctl(in_fd, FIONREAD, &avail) == 0 && avail > 0)))
+            {
+                IP_COUNT_GLOBAL(cap_held, (uint_fast64_t)s->len - s->cap);
+                s->cap = s->len;
+                continue;
+            }
             if (!total)
                 return -1;
             break;
@@ -179,23 +388,74 @@ ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_by
         break;
     }
 
+    if (total && (ip->mode & IP_MODE_ADAPTIVE))
+        ip_adapt_sample(ip, total);
+
     if (total)
         ip_note_change(ip, total, 0);
 
     return (ssize_t)total;
-#endif
 }
 
-ssize_t infinitypipe_splice_out(struct infinitypipe *ip, int out_fd, size_t max_bytes)
+/* с spill_max сверх max_size - в файл вытеснения, в порядке поступления */
+static ssize_t ip_splice_in(struct infinitypipe *ip, int in_fd,
+    loff_t *off, size_t max_bytes)
 {
-#ifndef __linux__
-    (void)ip;
-    (void)out_fd;
-    (void)max_bytes;
-    errno = ENOSYS;
+    if (!ip->spill_max)
+        return ip_splice_in_segs(ip, in_fd, off, max_bytes);
+
+    // сначала вытесненное возвращается в сегменты, новое - только за ним
+    if (ip->spill_len && ip->total_len < ip->max_size)
+    {
+        size_t n = ip_spill_fill(ip);
+        if (n)
+            ip_note_change(ip, n, 0);
+    }
+
+    size_t total = 0;
+    if (!ip_spill_wanted(ip))
+    {
+        ssize_t rc = ip_splice_in_segs(ip, in_fd, off, max_bytes);
+        if (rc < 0 && (errno != EAGAIN || ip->seg_denied ||
+            !ip_spill_wanted(ip)))
+            return rc;
+        if (rc == 0)
+            return 0;
+        if (rc > 0)
+        {
+            total = (size_t)rc;
+            // источник опустел раньше, чем буфер заполнился
+            if (total == max_bytes || !ip_spill_wanted(ip))
+                return rc;
+        }
+    }
+
+    ssize_t n = ip_spill_in(ip, in_fd, off, max_bytes - total);
+    if (n >= 0)
+        return (ssize_t)total + n;
+    if (total && errno == EAGAIN)
+        return (ssize_t)total;
     return -1;
-#else
+}
+
+static ssize_t ip_splice_out(struct infinitypipe *ip, int out_fd,
+    loff_t *off, size_t max_bytes)
+{
     size_t total = 0;
+    ip->seg_denied = 0;
+
+    // голова пуста, а данные ждут в файле (не было сегмента при доливе)
+    if (!ip->head && ip->spill_len)
+    {
+        size_t n = ip_spill_fill(ip);
+        if (n)
+            ip_note_change(ip, n, 0);
+        if (!ip->head)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
 
     while (ip->head && total < max_bytes)
     {
@@ -206,8 +466,9 @@ ssize_t infinitypipe_splice_out(struct infinitypipe *ip, int out_fd, size_t max_
         if (want == 0)
             break;
 
-        ssize_t rc = splice(s->p[0], NULL, out_fd, NULL, want,
+        ssize_t rc = splice(s->p[0], NULL, out_fd, off, want,
                             SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        ip_count_splice(ip, rc, want, 1);
         if (rc > 0)
         {
             s->len -= (size_t)rc;
@@ -215,13 +476,7 @@ ssize_t infinitypipe_splice_out(struct infinitypipe *ip, int out_fd, size_t max_
             total += (size_t)rc;
 
             if (s->len == 0)
-            {
-                ip->head = s->next;
-                if (!ip->head)
-                    ip->tail = NULL;
-
-                infinityseg_free(s);
-            }
+                ip_seg_free_head(ip);
             continue;
         }
 
@@ -249,28 +504,165 @@ ssize_t infinitypipe_splice_out(struct infinitypipe *ip, int out_fd, size_t max_
         ip_note_change(ip, 0, total);
 
     return (ssize_t)total;
+}
+#endif
+
+ssize_t infinitypipe_splice_in(struct infinitypipe *ip, int in_fd, size_t max_bytes)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)in_fd;
+    (void)max_bytes;
+    errno = ENOSYS;
+    return -1;
+#else
+    return ip_splice_in(ip, in_fd, NULL, max_bytes);
 #endif
 }
 
-ssize_t infinitypipe_discard(struct infinitypipe *ip, size_t max_bytes)
+ssize_t infinitypipe_splice_out(struct infinitypipe *ip, int out_fd, size_t max_bytes)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)out_fd;
+    (void)max_bytes;
+    errno = ENOSYS;
+    return -1;
+#else
+    return ip_splice_out(ip, out_fd, NULL, max_bytes);
+#endif
+}
+
+ssize_t infinitypipe_splice_in_file(struct infinitypipe *ip, int in_fd,
+    off_t *offset, size_t max_bytes)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)in_fd;
+    (void)offset;
+    (void)max_bytes;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!offset || *offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    loff_t off = *offset;
+    ssize_t rc = ip_splice_in(ip, in_fd, &off, max_bytes);
+    *offset = (off_t)off;
+    return rc;
+#endif
+}
+
+ssize_t infinitypipe_splice_out_file(struct infinitypipe *ip, int out_fd,
+    off_t *offset, size_t max_bytes)
 {
 #ifndef __linux__
     (void)ip;
+    (void)out_fd;
+    (void)offset;
     (void)max_bytes;
     errno = ENOSYS;
     return -1;
 #else
-    int dn = open("/dev/null", O_WRONLY | O_CLOEXEC);
-    if (dn < 0)
+    assert(ip);
+
+    if (!offset || *offset < 0)
+    {
+        errno = EINVAL;
         return -1;
-    ssize_t rc = infinitypipe_splice_out(ip, dn, max_bytes);
-    int e = errno;
-    close(dn);
-    errno = e;
+    }
+
+    loff_t off = *offset;
+    ssize_t rc = ip_splice_out(ip, out_fd, &off, max_bytes);
+    *offset = (off_t)off;
     return rc;
 #endif
 }
 
+ssize_t infinitypipe_discard(struct infinitypipe *ip, size_t max_bytes)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)max_bytes;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    size_t total = 0;
+
+    // 1) целиком покрытые сегменты: данные не двигаем, пайп закрываем,
+    // либо сливаем в sink, если пул готов его принять
+    while (ip->head && ip->head->len <= max_bytes - total)
+    {
+        struct infinityseg *s = ip->head;
+        size_t len = s->len;
+
+        if (ip_pool_wants(ip, s))
+        {
+            int sink = ip_sink_fd();
+            while (sink >= 0 && s->len > 0)
+            {
+                ssize_t rc = splice(s->p[0], NULL, sink, NULL, s->len,
+                    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+                if (rc > 0)
+                    s->len -= (size_t)rc;
+                else if (rc < 0 && errno == EINTR)
+                    continue;
+                else
+                    break;
+            }
+            // если не вышло, ip_seg_release просто закроет пайп
+        }
+
+        ip_dec_total_len(ip, len);
+        total += len;
+        ip_seg_free_head(ip);
+    }
+
+    // 2) частично покрытый головной сегмент - через постоянный sink
+    struct infinityseg *s = ip->head;
+    if (s && total < max_bytes)
+    {
+        int sink = ip_sink_fd();
+        if (sink < 0)
+            goto out;
+
+        size_t want = max_bytes - total;
+        while (want > 0)
+        {
+            ssize_t rc = splice(s->p[0], NULL, sink, NULL, want,
+                SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+            if (rc > 0)
+            {
+                s->len -= (size_t)rc;
+                ip_dec_total_len(ip, (size_t)rc);
+                total += (size_t)rc;
+                want -= (size_t)rc;
+                continue;
+            }
+            if (rc < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+    }
+
+out:
+    if (total)
+        ip_note_change(ip, 0, total);
+    else if (max_bytes && ip->head)
+        return -1;
+
+    return (ssize_t)total;
+#endif
+}
+
 ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, size_t max_bytes)
 {
 #ifndef __linux__
@@ -290,6 +682,43 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
     if (max_bytes == 0 || src->total_len == 0)
         return 0;
 
+    // за вытесненными данными dst можно писать только в тот же файл,
+    // и не больше spill_max
+    if (dst->spill_len)
+    {
+        if (max_bytes > ip_spill_room(dst))
+            max_bytes = ip_spill_room(dst);
+        if (!max_bytes)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        while (src->head && total < max_bytes)
+        {
+            struct infinityseg *ss = src->head;
+            size_t want = max_bytes - total;
+            if (want > ss->len)
+                want = ss->len;
+
+            ssize_t rc = ip_spill_put(dst, ss->p[0], want);
+            if (rc <= 0)
+                break;
+
+            ss->len -= (size_t)rc;
+            ip_dec_total_len(src, (size_t)rc);
+            total += (size_t)rc;
+            if (ss->len == 0)
+                ip_seg_free_head(src);
+            if ((size_t)rc < want)
+                break;
+        }
+
+        if (total)
+            ip_note_change(src, 0, total);
+        return (ssize_t)total;
+    }
+
     // fast path: dst пустой и забираем всё
     if (!dst->head && max_bytes >= src->total_len)
     {
@@ -298,12 +727,16 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
         // ip_stat_begin(dst, dst->total_len);
         dst->head = src->head;
         dst->tail = src->tail;
+        dst->n_segs = src->n_segs;
         ip_inc_total_len(dst, moved);
 
         // ip_stat_begin(src, src->total_len);
         src->head = src->tail = NULL;
+        src->n_segs = 0;
         ip_dec_total_len(src, moved);
 
+        ip_compact_check(dst);
+
         /* уведомим про изменения */
         ip_note_change(dst, moved, 0);
         ip_note_change(src, 0, moved);
@@ -324,15 +757,10 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
         src->head = ss->next;
         if (!src->head)
             src->tail = NULL;
+        src->n_segs--;
         ss->next = NULL;
 
-        if (!dst->head)
-            dst->head = dst->tail = ss;
-        else
-        {
-            dst->tail->next = ss;
-            dst->tail = ss;
-        }
+        ip_seg_add(dst, ss);
 
         ip_dec_total_len(src, ss->len);
         ip_inc_total_len(dst, ss->len);
@@ -344,9 +772,9 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
     {
         struct infinityseg *ss = src->head;
         struct infinityseg *ds = dst->tail;
-        if (!ds || ds->len >= ds->cap)
+        if (!ds || ip_seg_full(ds))
         {
-            ds = infinityseg_new(dst->seg_capacity, dst->flags);
+            ds = ip_seg_new(dst);
             if (!ds)
                 break;
             ip_seg_add(dst, ds);
@@ -374,12 +802,7 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
             total += (size_t)rc;
 
             if (ss->len == 0)
-            {
-                src->head = ss->next;
-                if (!src->head)
-                    src->tail = NULL;
-                infinityseg_free(ss);
-            }
+                ip_seg_free_head(src);
             continue;
         }
 
@@ -394,6 +817,7 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
 
     if (total)
     {
+        ip_compact_check(dst);
         ip_note_change(dst, total, 0);
         ip_note_change(src, 0, total);
     }
@@ -402,6 +826,639 @@ ssize_t infinitypipe_move(struct infinitypipe *dst, struct infinitypipe *src, si
 #endif
 }
 
+ssize_t infinitypipe_compact(struct infinitypipe *ip)
+{
+#ifndef __linux__
+    (void)ip;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    ip->compact_at = 0;
+    return (ssize_t)ip_compact(ip);
+#endif
+}
+
+#ifdef __linux__
+/* копирование (writev) или ссылка на страницы (vmsplice) */
+static ssize_t ip_add_iov(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec, unsigned vmsplice_flags, int by_ref)
+{
+    // за вытесненными данными - только в файл
+    if (ip->spill_len)
+        return ip_spill_writev(ip, vec, n_vec);
+
+    // в сегменты не больше max_size, как splice_in; сверх - в файл
+    // вытеснения, а без него EAGAIN
+    size_t room = (ip->total_len < ip->max_size) ?
+        ip->max_size - ip->total_len : 0;
+    if (!room)
+    {
+        if (ip->spill_max)
+            return ip_spill_writev(ip, vec, n_vec);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    size_t total = 0;
+    int i = 0;
+    size_t off = 0;
+
+    while (i < n_vec && total < room)
+    {
+        if (vec[i].iov_len == off)
+        {
+            ++i;
+            off = 0;
+            continue;
+        }
+
+        struct infinityseg *s = ip->tail;
+        size_t newly_allocated = 0;
+
+        if (!s || ip_seg_full(s))
+        {
+            s = ip_seg_new(ip);
+            if (!s)
+            {
+                if (total)
+                    break;
+                return -1;
+            }
+            newly_allocated = 1;
+        }
+
+        // собираем столько буферов, сколько влезет в сегмент и в max_size
+        struct iovec iov[IP_ADD_IOV_MAX];
+        int cnt = 0;
+        size_t fit = s->cap - s->len;
+        if (fit > room - total)
+            fit = room - total;
+        size_t want = 0;
+        for (int j = i; j < n_vec && cnt < IP_ADD_IOV_MAX && want < fit; ++j)
+        {
+            size_t skip = (j == i) ? off : 0;
+            size_t len = vec[j].iov_len - skip;
+            if (len == 0)
+                continue;
+            if (len > fit - want)
+                len = fit - want;
+            iov[cnt].iov_base = (char *)vec[j].iov_base + skip;
+            iov[cnt].iov_len = len;
+            want += len;
+            ++cnt;
+        }
+
+        ssize_t rc = by_ref ?
+            vmsplice(s->p[1], iov, (unsigned long)cnt,
+                vmsplice_flags|SPLICE_F_NONBLOCK) :
+            writev(s->p[1], iov, cnt);
+
+        if (rc > 0)
+        {
+            if (newly_allocated)
+                ip_seg_add(ip, s);
+
+            s->len += (size_t)rc;
+            ip_inc_total_len(ip, (size_t)rc);
+            total += (size_t)rc;
+
+            // продвигаемся по входным буферам
+            size_t left = (size_t)rc;
+            while (left)
+            {
+                size_t chunk = vec[i].iov_len - off;
+                if (chunk > left)
+                {
+                    off += left;
+                    break;
+                }
+                left -= chunk;
+                ++i;
+                off = 0;
+            }
+            continue;
+        }
+
+        if (newly_allocated)
+            ip_seg_release(ip, s);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        // страницы пайпа кончились раньше байтов (несливаемые буферы):
+        // считаем tail заполненным и берём новый сегмент
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            !newly_allocated)
+        {
+            IP_COUNT_GLOBAL(cap_held, (uint_fast64_t)s->len - s->cap);
+            s->cap = s->len;
+            continue;
+        }
+
+        if (!total)
+            return -1;
+        break;
+    }
+
+    if (total)
+        ip_note_change(ip, total, 0);
+
+    // сегменты заполнены до max_size: остаток - в файл вытеснения
+    if (total == room && ip->spill_max)
+    {
+        while (i < n_vec && vec[i].iov_len == off)
+        {
+            ++i;
+            off = 0;
+        }
+        if (i < n_vec)
+        {
+            struct iovec first;
+            first.iov_base = (char *)vec[i].iov_base + off;
+            first.iov_len = vec[i].iov_len - off;
+
+            ssize_t rc = ip_spill_writev(ip, &first, 1);
+            if (rc > 0)
+                total += (size_t)rc;
+            if (rc == (ssize_t)first.iov_len && i + 1 < n_vec)
+            {
+                rc = ip_spill_writev(ip, vec + i + 1, n_vec - i - 1);
+                if (rc > 0)
+                    total += (size_t)rc;
+            }
+        }
+    }
+
+    return (ssize_t)total;
+}
+#endif
+
+#ifdef __linux__
+ssize_t ip_readv(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec, size_t max_bytes)
+{
+    size_t total = 0;
+    int i = 0;
+    size_t off = 0;
+
+    while (ip->head && i < n_vec && total < max_bytes)
+    {
+        if (vec[i].iov_len == off)
+        {
+            ++i;
+            off = 0;
+            continue;
+        }
+
+        struct infinityseg *s = ip->head;
+        size_t avail = s->len;
+        if (avail > max_bytes - total)
+            avail = max_bytes - total;
+
+        // iovec вызывающего нарезаем по границе сегмента
+        struct iovec iov[IP_ADD_IOV_MAX];
+        int cnt = 0;
+        size_t want = 0;
+        for (int j = i; j < n_vec && cnt < IP_ADD_IOV_MAX && want < avail; ++j)
+        {
+            size_t skip = (j == i) ? off : 0;
+            size_t len = vec[j].iov_len - skip;
+            if (len == 0)
+                continue;
+            if (len > avail - want)
+                len = avail - want;
+            iov[cnt].iov_base = (char *)vec[j].iov_base + skip;
+            iov[cnt].iov_len = len;
+            want += len;
+            ++cnt;
+        }
+
+        ssize_t rc = readv(s->p[0], iov, cnt);
+        if (rc > 0)
+        {
+            s->len -= (size_t)rc;
+            total += (size_t)rc;
+
+            if (s->len == 0)
+                ip_seg_free_head(ip);
+
+            size_t left = (size_t)rc;
+            while (left)
+            {
+                size_t chunk = vec[i].iov_len - off;
+                if (chunk > left)
+                {
+                    off += left;
+                    break;
+                }
+                left -= chunk;
+                ++i;
+                off = 0;
+            }
+            continue;
+        }
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        if (!total)
+            return -1;
+        break;
+    }
+
+    // длина и статистика - один раз на вызов
+    if (total)
+        ip_dec_total_len(ip, total);
+
+    return (ssize_t)total;
+}
+#endif
+
+ssize_t infinitypipe_addv(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)vec;
+    (void)n_vec;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!vec || n_vec < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ip_add_iov(ip, vec, n_vec, 0, 0);
+#endif
+}
+
+ssize_t infinitypipe_add(struct infinitypipe *ip, const void *data, size_t len)
+{
+    if (!data && len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct iovec v;
+    v.iov_base = (void *)data;
+    v.iov_len = len;
+    return infinitypipe_addv(ip, &v, 1);
+}
+
+ssize_t infinitypipe_add_reference(struct infinitypipe *ip,
+    const void *data, size_t len, unsigned flags)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)data;
+    (void)len;
+    (void)flags;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!data && len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    unsigned vflags = 0;
+    if (flags & IP_ADD_GIFT)
+    {
+        // ядро принимает подарок только целыми страницами
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        if (((uintptr_t)data % page) || (len % page))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        vflags |= SPLICE_F_GIFT;
+    }
+
+    struct iovec v;
+    v.iov_base = (void *)data;
+    v.iov_len = len;
+    return ip_add_iov(ip, &v, 1, vflags, 1);
+#endif
+}
+
+#ifdef __linux__
+/* сегмент отметки всё ещё в списке буфера; адрес мог достаться новому
+   сегменту, поэтому сверяется и номер выдачи */
+static int ip_mark_linked(const struct infinitypipe *ip,
+    const struct infinitypipe_mark *m)
+{
+    for (const struct infinityseg *s = ip->head; s; s = s->next)
+    {
+        if (s == m->last_before)
+            return s->gen == m->gen;
+    }
+    return 0;
+}
+
+/* вставить копию data после prev (NULL - в голову): данные пишутся в
+   отдельную цепочку сегментов, которая вшивается в список за O(1);
+   при ошибке цепочка освобождается и буфер не меняется */
+static ssize_t ip_insert_after(struct infinitypipe *ip,
+    struct infinityseg *prev, const void *data, size_t len)
+{
+    struct infinityseg *head = NULL;
+    struct infinityseg *tail = NULL;
+    size_t n_segs = 0;
+    size_t off = 0;
+
+    while (off < len)
+    {
+        struct infinityseg *s = ip_seg_new(ip);
+        if (!s)
+            goto fail;
+
+        s->next = NULL;
+        if (!head)
+            head = s;
+        else
+            tail->next = s;
+        tail = s;
+        ++n_segs;
+
+        size_t want = len - off;
+        if (want > s->cap)
+            want = s->cap;
+
+        while (want)
+        {
+            ssize_t rc = write(s->p[1], (const char *)data + off, want);
+            if (rc > 0)
+            {
+                s->len += (size_t)rc;
+                off += (size_t)rc;
+                want -= (size_t)rc;
+                continue;
+            }
+            if (rc < 0 && errno == EINTR)
+                continue;
+            // страницы пайпа кончились раньше ёмкости - берём следующий
+            if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && s->len)
+                break;
+            goto fail;
+        }
+    }
+
+    if (!head)
+        return 0;
+
+    if (!prev)
+    {
+        tail->next = ip->head;
+        ip->head = head;
+    }
+    else
+    {
+        tail->next = prev->next;
+        prev->next = head;
+    }
+    if (!tail->next)
+        ip->tail = tail;
+
+    // prev и вставленные сегменты могли перестать быть хвостом
+    for (struct infinityseg *s = prev ? prev : head; s != tail->next;
+        s = s->next)
+        ip_seg_seal(ip, s);
+
+    ip->n_segs += n_segs;
+    ip_inc_total_len(ip, len);
+    ip_note_change(ip, len, 0);
+
+    return (ssize_t)len;
+
+fail:
+    while (head)
+    {
+        struct infinityseg *next = head->next;
+        ip_seg_release(ip, head);
+        head = next;
+    }
+    return -1;
+}
+#endif
+
+ssize_t infinitypipe_prepend(struct infinitypipe *ip,
+    const void *data, size_t len)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)data;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!data && len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // голова ушла в io_uring и вернётся перед вставкой
+    if (ip->inflight)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    return ip_insert_after(ip, NULL, data, len);
+#endif
+}
+
+ssize_t infinitypipe_insert_at_mark(struct infinitypipe *ip,
+    const struct infinitypipe_mark *m, const void *data, size_t len)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)m;
+    (void)data;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!m || (!data && len))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!m->last_before)
+    {
+        if (ip->inflight)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    else if (!ip_mark_linked(ip, m))
+    {
+        // сегмент отметки уже отправлен или освобождён
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ip_insert_after(ip, m->last_before, data, len);
+#endif
+}
+
+ssize_t infinitypipe_removev(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)vec;
+    (void)n_vec;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!vec || n_vec < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (!ip->head)
+        return 0;
+
+    ssize_t rc = ip_readv(ip, vec, n_vec, ip->total_len);
+    if (rc > 0)
+        ip_note_change(ip, 0, (size_t)rc);
+
+    return rc;
+#endif
+}
+
+ssize_t infinitypipe_remove(struct infinitypipe *ip, void *data, size_t len)
+{
+    if (!data && len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct iovec v;
+    v.iov_base = data;
+    v.iov_len = len;
+    return infinitypipe_removev(ip, &v, 1);
+}
+
+ssize_t infinitypipe_tee_append(struct infinitypipe *dst,
+    struct infinitypipe *src)
+{
+#ifndef __linux__
+    (void)dst;
+    (void)src;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(dst);
+    assert(src);
+
+    if (dst == src)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t total = 0;
+    size_t spilled = 0;
+    for (struct infinityseg *s = src->head; s; s = s->next)
+    {
+        if (!s->len)
+            continue;
+
+        // в файл вытеснения сегмент целиком или никак: tee не умеет
+        // начинать со смещения
+        if (dst->spill_len && s->len > ip_spill_room(dst))
+        {
+            errno = EAGAIN;
+            break;
+        }
+
+        // tee копирует с головы пайпа и дублирует буферы один к одному,
+        // поэтому сегмент целиком идёт в новый сегмент не меньшей ёмкости
+        struct infinityseg *ds = ip_seg_new_cap(dst, s->cap);
+        if (!ds)
+            break;
+
+        ssize_t rc;
+        do
+        {
+            rc = tee(s->p[0], ds->p[1], s->len, SPLICE_F_NONBLOCK);
+        } while (rc < 0 && errno == EINTR);
+
+        if (rc > 0)
+            ds->len = (size_t)rc;
+
+        if (rc < 0 || (size_t)rc != s->len)
+        {
+            // хвост сегмента без смещения уже не продублировать
+            ip_seg_release(dst, ds);
+            if (rc >= 0)
+                errno = EAGAIN;
+            break;
+        }
+
+        if (dst->spill_len)
+        {
+            // копия встаёт за вытесненными данными dst
+            size_t len = ds->len;
+            ssize_t n = ip_spill_put(dst, ds->p[0], len);
+            if (n > 0)
+                ds->len -= (size_t)n;
+            ip_seg_release(dst, ds);
+            if (n > 0)
+                spilled += (size_t)n;
+            if (n != (ssize_t)len)
+                break;
+            continue;
+        }
+
+        // буферы скопированы один к одному: полный по буферам источник
+        // даёт такую же полную копию, её можно запечатать
+        if (ip_seg_full(s) && ds->cap > ds->len)
+        {
+            IP_COUNT_GLOBAL(cap_held, (uint_fast64_t)ds->len - ds->cap);
+            ds->cap = ds->len;
+        }
+
+        ip_seg_add(dst, ds);
+        ip_inc_total_len(dst, ds->len);
+        total += ds->len;
+    }
+
+    if (total)
+    {
+        ip_compact_check(dst);
+        ip_note_change(dst, total, 0);
+    }
+    total += spilled;
+    if (!total && src->head)
+        return -1;
+
+    return (ssize_t)total;
+#endif
+}
+
 ssize_t infinitypipe_tee_pipe(struct infinitypipe *ip,
     const struct infinitypipe_mark *m, int pipe_fd, size_t max_bytes)
 {
@@ -415,13 +1472,12 @@ ssize_t infinitypipe_tee_pipe(struct infinitypipe *ip,
 #else
     assert(ip);
 
-    if (!m) {
+    if (!m || (m->last_before && !ip_mark_linked(ip, m))) {
         errno = EINVAL;
         return -1;
     }
 
-    struct infinityseg *s =
-        (!m || !m->last_before) ? ip->head : m->last_before->next;
+    struct infinityseg *s = m->last_before ? m->last_before->next : ip->head;
 
     size_t total = 0;
     for (; s && total < max_bytes; s = s->next)
@@ -471,8 +1527,8 @@ ssize_t infinitypipe_tee(struct infinitypipe *ip,
         return -1;
     }
 
-    if (seg->len >= seg->cap) {
-        errno = EAGAIN;  // сегмент полон
+    if (ip_seg_full(seg)) {
+        errno = EAGAIN;  // сегмент полон или запечатан
         return -1;
     }
 
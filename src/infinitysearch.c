@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/infinitypipe.h"
+#include "infinitypipe-int.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+// окно поиска, байт
+#define IP_SEARCH_WINDOW (16u * 1024u)
+
+#ifdef __linux__
+// scratch-пайп потока для tee, живёт до конца потока
+static _Thread_local struct infinityseg *scratch;
+
+static struct infinityseg *ip_scratch(size_t cap)
+{
+    if (scratch && scratch->cap >= cap)
+        return scratch;
+
+    // tee дублирует буферы пайпа один к одному, поэтому scratch
+    // должен быть не меньше сегмента-источника
+    struct infinityseg *s = infinityseg_new(cap, O_NONBLOCK|O_CLOEXEC);
+    if (!s)
+        return NULL;
+
+    if (scratch)
+        infinityseg_free(scratch);
+    scratch = s;
+    return s;
+}
+
+static void ip_scratch_drain(struct infinityseg *s)
+{
+    int sink = ip_sink_fd();
+    while (s->len > 0)
+    {
+        ssize_t rc = (sink >= 0) ?
+            splice(s->p[0], NULL, sink, NULL, s->len, SPLICE_F_NONBLOCK) :
+            -1;
+        if (rc > 0)
+        {
+            s->len -= (size_t)rc;
+            continue;
+        }
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        // не смогли слить - пересоздадим при следующем вызове
+        infinityseg_free(s);
+        scratch = NULL;
+        return;
+    }
+}
+
+/* скопировать n байт сегмента начиная с seg_off */
+static ssize_t ip_peek_seg(struct infinityseg *s, size_t seg_off,
+    void *buf, size_t n)
+{
+    struct infinityseg *sc = ip_scratch(s->cap);
+    if (!sc)
+        return -1;
+
+    // tee всегда начинает с головы пайпа
+    size_t need = seg_off + n;
+    ssize_t rc;
+    do
+    {
+        rc = tee(s->p[0], sc->p[1], need, SPLICE_F_NONBLOCK);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc <= 0)
+        return -1;
+
+    sc->len = (size_t)rc;
+    if (sc->len <= seg_off)
+    {
+        ip_scratch_drain(sc);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    // пропускаем seg_off байт без копирования
+    if (seg_off)
+    {
+        int sink = ip_sink_fd();
+        size_t left = seg_off;
+        while (left > 0)
+        {
+            ssize_t k = (sink >= 0) ?
+                splice(sc->p[0], NULL, sink, NULL, left, SPLICE_F_NONBLOCK) :
+                -1;
+            if (k > 0)
+            {
+                left -= (size_t)k;
+                sc->len -= (size_t)k;
+                continue;
+            }
+            if (k < 0 && errno == EINTR)
+                continue;
+            ip_scratch_drain(sc);
+            return -1;
+        }
+    }
+
+    size_t got = 0;
+    while (got < n && sc->len > 0)
+    {
+        ssize_t k = read(sc->p[0], (char *)buf + got, sc->len < n - got ?
+            sc->len : n - got);
+        if (k > 0)
+        {
+            got += (size_t)k;
+            sc->len -= (size_t)k;
+            continue;
+        }
+        if (k < 0 && errno == EINTR)
+            continue;
+        break;
+    }
+
+    if (sc->len)
+        ip_scratch_drain(sc);
+
+    return got ? (ssize_t)got : -1;
+}
+#endif
+
+ssize_t infinitypipe_peek(struct infinitypipe *ip, size_t offset,
+    void *buf, size_t len)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)offset;
+    (void)buf;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!buf && len)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t copied = 0;
+    size_t pos = 0;
+    for (struct infinityseg *s = ip->head; s && copied < len; s = s->next)
+    {
+        if (pos + s->len <= offset + copied)
+        {
+            pos += s->len;
+            continue;
+        }
+
+        size_t seg_off = offset + copied - pos;
+        size_t n = s->len - seg_off;
+        if (n > len - copied)
+            n = len - copied;
+
+        ssize_t rc = ip_peek_seg(s, seg_off, (char *)buf + copied, n);
+        if (rc < 0)
+        {
+            if (copied)
+                break;
+            return -1;
+        }
+
+        copied += (size_t)rc;
+        if ((size_t)rc < n)
+            break;
+
+        pos += s->len;
+    }
+
+    return (ssize_t)copied;
+#endif
+}
+
+ssize_t infinitypipe_copyout(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec)
+{
+#ifndef __linux__
+    (void)ip;
+    (void)vec;
+    (void)n_vec;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(ip);
+
+    if (!vec || n_vec < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t room = 0;
+    for (int j = 0; j < n_vec; ++j)
+        room += vec[j].iov_len;
+
+    // как removev: один tee на сегмент в scratch, оттуда readv сразу
+    // в iovec вызывающего
+    size_t total = 0;
+    int i = 0;
+    size_t off = 0;
+    for (struct infinityseg *s = ip->head; s && total < room; s = s->next)
+    {
+        size_t want = s->len;
+        if (want > room - total)
+            want = room - total;
+
+        struct infinityseg *sc = ip_scratch(s->cap);
+        if (!sc)
+            return total ? (ssize_t)total : -1;
+
+        ssize_t rc;
+        do
+        {
+            rc = tee(s->p[0], sc->p[1], want, SPLICE_F_NONBLOCK);
+        } while (rc < 0 && errno == EINTR);
+        if (rc <= 0)
+            return total ? (ssize_t)total : -1;
+        sc->len = (size_t)rc;
+
+        size_t got = 0;
+        while (sc->len)
+        {
+            // iovec вызывающего нарезаем по тому, что лежит в scratch
+            struct iovec iov[IP_ADD_IOV_MAX];
+            int cnt = 0;
+            size_t n = 0;
+            for (int j = i; j < n_vec && cnt < IP_ADD_IOV_MAX && n < sc->len;
+                ++j)
+            {
+                size_t skip = (j == i) ? off : 0;
+                size_t len = vec[j].iov_len - skip;
+                if (len == 0)
+                    continue;
+                if (len > sc->len - n)
+                    len = sc->len - n;
+                iov[cnt].iov_base = (char *)vec[j].iov_base + skip;
+                iov[cnt].iov_len = len;
+                n += len;
+                ++cnt;
+            }
+
+            rc = readv(sc->p[0], iov, cnt);
+            if (rc < 0 && errno == EINTR)
+                continue;
+            if (rc <= 0)
+                break;
+
+            sc->len -= (size_t)rc;
+            got += (size_t)rc;
+
+            size_t left = (size_t)rc;
+            while (left)
+            {
+                size_t chunk = vec[i].iov_len - off;
+                if (chunk > left)
+                {
+                    off += left;
+                    break;
+                }
+                left -= chunk;
+                ++i;
+                off = 0;
+            }
+        }
+
+        if (sc->len)
+            ip_scratch_drain(sc);
+
+        total += got;
+        // сегмент скопирован не целиком: дальше не его байты
+        if (got < s->len)
+            break;
+    }
+
+    return (ssize_t)total;
+#endif
+}
+
+ssize_t infinitypipe_search(struct infinitypipe *ip,
+    const void *what, size_t len, size_t start)
+{
+    assert(ip);
+
+    if (!what || !len || len > IP_SEARCH_WINDOW)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char win[IP_SEARCH_WINDOW];
+    size_t pos = start;
+    while (pos + len <= ip->total_len)
+    {
+        ssize_t got = infinitypipe_peek(ip, pos, win, sizeof(win));
+        if (got < (ssize_t)len)
+            return -1;
+
+        // memchr/memmem из libc векторизованы (SSE2/AVX2/NEON)
+        const char *p = (len == 1) ?
+            (const char *)memchr(win, *(const char *)what, (size_t)got) :
+            (const char *)memmem(win, (size_t)got, what, len);
+        if (p)
+            return (ssize_t)(pos + (size_t)(p - win));
+
+        // перекрытие окон, чтобы не потерять совпадение на границе
+        pos += (size_t)got - (len - 1);
+    }
+
+    return -1;
+}
+
+char *infinitypipe_readln(struct infinitypipe *ip, size_t *n_read_out,
+    enum infinitypipe_eol_style eol_style)
+{
+    assert(ip);
+
+    ssize_t pos;
+    size_t eol_len = 1;
+
+    switch (eol_style)
+    {
+    case IP_EOL_LF:
+        pos = infinitypipe_search(ip, "\n", 1, 0);
+        break;
+    case IP_EOL_CRLF:
+        pos = infinitypipe_search(ip, "\n", 1, 0);
+        if (pos > 0)
+        {
+            char c;
+            if (infinitypipe_peek(ip, (size_t)pos - 1, &c, 1) == 1 && c == '\r')
+            {
+                --pos;
+                eol_len = 2;
+            }
+        }
+        break;
+    case IP_EOL_CRLF_STRICT:
+        pos = infinitypipe_search(ip, "\r\n", 2, 0);
+        eol_len = 2;
+        break;
+    case IP_EOL_NUL:
+        pos = infinitypipe_search(ip, "", 1, 0);
+        break;
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if (pos < 0)
+        return NULL;
+
+    char *line = (char *)malloc((size_t)pos + 1);
+    if (!line)
+        return NULL;
+
+    if (pos && infinitypipe_peek(ip, 0, line, (size_t)pos) != pos)
+    {
+        free(line);
+        return NULL;
+    }
+    line[pos] = '\0';
+
+    infinitypipe_discard(ip, (size_t)pos + eol_len);
+
+    if (n_read_out)
+        *n_read_out = (size_t)pos;
+
+    return line;
+}
@@ -1,13 +1,18 @@
 #define _GNU_SOURCE
 
 #include "e4pipe/infinityseg.h"
+#include "infinitypipe-int.h"
 
 #define _FILE_OFFSET_BITS 64
 #include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
 
 #ifdef __linux__
 #ifndef SPLICE_F_MOVE
@@ -47,41 +52,193 @@ size_t try_set_pipe_sz(int fd, size_t want)
 }
 #endif
 
+// бюджет процесса, общий для всех потоков
+static atomic_size_t budget_max_fds;
+static atomic_size_t budget_max_bytes;
+static atomic_size_t budget_fds;
+static atomic_size_t budget_bytes;
+static atomic_size_t budget_denied;
+static atomic_size_t budget_short;
+// номера выдачи сегментов (infinityseg.gen)
+static atomic_uint_fast64_t seg_gen;
+static pthread_once_t budget_once = PTHREAD_ONCE_INIT;
+
+uint64_t ip_seg_gen_next(void)
+{
+    return atomic_fetch_add_explicit(&seg_gen, 1, memory_order_relaxed) + 1;
+}
+
+static void seg_budget_init(void)
+{
+    size_t max_fds = 0;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        max_fds = (size_t)rl.rlim_cur / 4 * 3;
+
+    size_t max_bytes = 0;
+#ifdef __linux__
+    // мягкий предел на пайпы пользователя не касается привилегированных,
+    // 0 в файле - предела нет
+    FILE *f = geteuid() ? fopen("/proc/sys/fs/pipe-user-pages-soft", "re") :
+        NULL;
+    if (f)
+    {
+        unsigned long pages = 0;
+        if (fscanf(f, "%lu", &pages) == 1 && pages)
+            max_bytes = (size_t)pages / 4 * 3 * (size_t)sysconf(_SC_PAGESIZE);
+        fclose(f);
+    }
+#endif
+
+    atomic_store_explicit(&budget_max_fds, max_fds, memory_order_relaxed);
+    atomic_store_explicit(&budget_max_bytes, max_bytes, memory_order_relaxed);
+}
+
+static void seg_budget_put(size_t fds, size_t bytes)
+{
+    atomic_fetch_sub_explicit(&budget_fds, fds, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&budget_bytes, bytes, memory_order_relaxed);
+}
+
+/* занять место под сегмент, -1 и EAGAIN - бюджет исчерпан */
+static int seg_budget_take(size_t fds, size_t bytes)
+{
+    pthread_once(&budget_once, seg_budget_init);
+
+    size_t max_fds =
+        atomic_load_explicit(&budget_max_fds, memory_order_relaxed);
+    size_t max_bytes =
+        atomic_load_explicit(&budget_max_bytes, memory_order_relaxed);
+
+    size_t used_fds = fds +
+        atomic_fetch_add_explicit(&budget_fds, fds, memory_order_relaxed);
+    size_t used_bytes = bytes +
+        atomic_fetch_add_explicit(&budget_bytes, bytes, memory_order_relaxed);
+
+    if ((max_fds && used_fds > max_fds) ||
+        (max_bytes && used_bytes > max_bytes))
+    {
+        seg_budget_put(fds, bytes);
+        atomic_fetch_add_explicit(&budget_denied, 1, memory_order_relaxed);
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* учесть реальный размер пайпа вместо запрошенного */
+static void seg_budget_settle(struct infinityseg *s, size_t reserved)
+{
+    if (s->pipe_sz > reserved)
+        atomic_fetch_add_explicit(&budget_bytes, s->pipe_sz - reserved,
+            memory_order_relaxed);
+    else
+        atomic_fetch_sub_explicit(&budget_bytes, reserved - s->pipe_sz,
+            memory_order_relaxed);
+}
+
+void infinityseg_budget_get(struct infinityseg_budget *b)
+{
+    assert(b);
+
+    pthread_once(&budget_once, seg_budget_init);
+
+    b->max_fds = atomic_load_explicit(&budget_max_fds, memory_order_relaxed);
+    b->max_bytes =
+        atomic_load_explicit(&budget_max_bytes, memory_order_relaxed);
+    b->fds = atomic_load_explicit(&budget_fds, memory_order_relaxed);
+    b->bytes = atomic_load_explicit(&budget_bytes, memory_order_relaxed);
+    b->n_denied = atomic_load_explicit(&budget_denied, memory_order_relaxed);
+    b->n_short = atomic_load_explicit(&budget_short, memory_order_relaxed);
+}
+
+void infinityseg_budget_set(size_t max_fds, size_t max_bytes)
+{
+    // после init, иначе он перетрёт заданные пределы
+    pthread_once(&budget_once, seg_budget_init);
+
+    atomic_store_explicit(&budget_max_fds, max_fds, memory_order_relaxed);
+    atomic_store_explicit(&budget_max_bytes, max_bytes, memory_order_relaxed);
+}
+
 struct infinityseg *infinityseg_new(size_t cap_hint, int flags)
 {
+    if (!cap_hint)
+        cap_hint = INFINITYSEG_DEFAULT_CAPACITY;
+
+    if (seg_budget_take(2, cap_hint) != 0)
+        return NULL;
+
     struct infinityseg *s = (struct infinityseg *)calloc(1, sizeof(*s));
     if (!s)
+    {
+        seg_budget_put(2, cap_hint);
         return NULL;
+    }
 
     if (x_pipe2(s->p, flags) != 0)
     {
         int e = errno;
         free(s);
+        seg_budget_put(2, cap_hint);
         // сохраним код ошибки
         errno = e;
         return NULL;
     }
 
 #ifdef __linux__
-    s->cap = try_set_pipe_sz(s->p[0],
-        cap_hint ? cap_hint : INFINITYSEG_DEFAULT_CAPACITY);
+    s->cap = try_set_pipe_sz(s->p[0], cap_hint);
 #else
-    (void)cap_hint;
     s->cap = INFINITYSEG_DEFAULT_CAPACITY;
 #endif
+    s->pipe_sz = s->cap;
+    seg_budget_settle(s, cap_hint);
+
+    // выше pipe-user-pages-soft ядро молча даёт пайп в одну страницу
+    if (s->cap < cap_hint)
+        atomic_fetch_add_explicit(&budget_short, 1, memory_order_relaxed);
+
     s->len = 0;
+    s->flags = flags;
     s->next = NULL;
+    s->gen = ip_seg_gen_next();
+
+    IP_COUNT_GLOBAL(segs_created, 1);
+    IP_COUNT_GLOBAL(cap_held, s->cap);
     return s;
 }
 
 void infinityseg_free(struct infinityseg *s)
 {
     assert(s);
+
+    seg_budget_put((s->p[1] < 0) ? 1 : 2, s->pipe_sz);
+
+#ifdef E4PIPE_WITH_COUNTERS
+    IP_COUNT_GLOBAL(segs_freed, 1);
+    atomic_fetch_sub_explicit(&ip_global.cap_held, s->cap,
+        memory_order_relaxed);
+#endif
+
     close(s->p[0]);
-    close(s->p[1]);
+    if (s->p[1] >= 0)
+        close(s->p[1]);
     free(s);
 }
 
+void infinityseg_seal(struct infinityseg *s)
+{
+    assert(s);
+
+    if (s->p[1] < 0)
+        return;
+
+    close(s->p[1]);
+    s->p[1] = -1;
+    seg_budget_put(1, 0);
+}
+
 ssize_t infinityseg_read(struct infinityseg *s, void *buf, size_t size)
 {
     assert(s);
@@ -124,7 +281,7 @@ ssize_t infinityseg_write(struct infinityseg *s, const void *buf, size_t size)
         return 0;
 
     // Проверяем, есть ли место в пайпе
-    size_t room = s->cap - s->len;
+    size_t room = (s->p[1] < 0) ? 0 : s->cap - s->len;
     if (room == 0)
     {
         errno = EAGAIN;
@@ -146,4 +303,114 @@ ssize_t infinityseg_write(struct infinityseg *s, const void *buf, size_t size)
     }
 
     return rc;
-}
\ No newline at end of file
+}
+
+static _Thread_local struct infinityseg_pool thread_pool;
+
+struct infinityseg_pool *infinityseg_pool_thread(void)
+{
+    return &thread_pool;
+}
+
+void infinityseg_pool_init(struct infinityseg_pool *pool,
+    size_t cap, int flags, size_t max_count)
+{
+    assert(pool);
+
+    infinityseg_pool_clear(pool);
+    pool->cap = cap ? cap : INFINITYSEG_DEFAULT_CAPACITY;
+    pool->flags = flags;
+    pool->max_count = max_count;
+}
+
+void infinityseg_pool_clear(struct infinityseg_pool *pool)
+{
+    assert(pool);
+
+    struct infinityseg *s = pool->head;
+    while (s)
+    {
+        struct infinityseg *n = s->next;
+        infinityseg_free(s);
+        s = n;
+    }
+    pool->head = NULL;
+    pool->count = 0;
+}
+
+ssize_t infinityseg_pool_prewarm(struct infinityseg_pool *pool, size_t count)
+{
+    assert(pool);
+
+    if (count > pool->max_count)
+        count = pool->max_count;
+
+    while (pool->count < count)
+    {
+        struct infinityseg *s = infinityseg_new(pool->cap, pool->flags);
+        if (!s)
+            return -1;
+
+        s->next = pool->head;
+        pool->head = s;
+        pool->count++;
+    }
+
+    return (ssize_t)pool->count;
+}
+
+struct infinityseg *infinityseg_pool_get(struct infinityseg_pool *pool,
+    size_t cap_hint, int flags)
+{
+    if (!pool || !pool->head || pool->flags != flags)
+        return infinityseg_new(cap_hint, flags);
+
+    struct infinityseg *s = pool->head;
+    pool->head = s->next;
+    pool->count--;
+    s->next = NULL;
+    s->gen = ip_seg_gen_next();
+
+    if (!cap_hint)
+        cap_hint = INFINITYSEG_DEFAULT_CAPACITY;
+
+    // ядро округляет размер пайпа до степени двойки страниц,
+    // поэтому меняем размер только при заметном расхождении
+#ifdef __linux__
+    // рост пайпа тоже идёт из бюджета; не влез - берём какой есть
+    size_t grow = (cap_hint > s->pipe_sz) ? cap_hint - s->pipe_sz : 0;
+    if ((s->cap < cap_hint && seg_budget_take(0, grow) == 0) ||
+        s->cap / 2 >= cap_hint)
+    {
+#ifdef E4PIPE_WITH_COUNTERS
+        size_t was = s->cap;
+#endif
+        size_t reserved = s->pipe_sz + grow;
+        s->cap = try_set_pipe_sz(s->p[0], cap_hint);
+        s->pipe_sz = s->cap;
+        seg_budget_settle(s, reserved);
+        if (s->cap < cap_hint)
+            atomic_fetch_add_explicit(&budget_short, 1, memory_order_relaxed);
+        IP_COUNT_GLOBAL(cap_held, (uint_fast64_t)s->cap - was);
+    }
+#endif
+
+    return s;
+}
+
+void infinityseg_pool_put(struct infinityseg_pool *pool, struct infinityseg *s)
+{
+    assert(s);
+
+    // в пайпе остались данные или он запечатан - его нельзя переиспользовать
+    if (!pool || s->len != 0 || s->p[1] < 0 || pool->count >= pool->max_count ||
+        pool->flags != s->flags)
+    {
+        infinityseg_free(s);
+        return;
+    }
+
+    s->next = pool->head;
+    pool->head = s;
+    pool->count++;
+}
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/infinitypipe.h"
+#include "infinitypipe-int.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+// выравнивание освобождаемых дыр: не меньше самого крупного фолио кэша
+#define IP_SPILL_HOLE ((off_t)2 << 20)
+
+size_t infinitypipe_get_spill_length(const struct infinitypipe *ip)
+{
+    assert(ip);
+    return ip->spill_len;
+}
+
+void ip_spill_free(struct infinitypipe *ip)
+{
+    if (ip->spill_fd >= 0)
+        close(ip->spill_fd);
+
+    ip->spill_fd = -1;
+    ip->spill_len = 0;
+    ip->spill_rd = ip->spill_wr = 0;
+}
+
+#ifdef __linux__
+/* файл создаётся при первом вытеснении и живёт до infinitypipe_free */
+static int ip_spill_open(struct infinitypipe *ip)
+{
+    if (ip->spill_fd >= 0)
+        return 0;
+
+    int fd = ip->spill_dir ?
+        open(ip->spill_dir, O_TMPFILE|O_RDWR|O_CLOEXEC, 0600) :
+        memfd_create("e4pipe-spill", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    ip->spill_fd = fd;
+    return 0;
+}
+
+/* место под len байт в конце файла: ENOSPC лучше узнать до того,
+   как данные уйдут из источника */
+static int ip_spill_reserve(struct infinitypipe *ip, size_t len)
+{
+    if (fallocate(ip->spill_fd, 0, ip->spill_wr, (off_t)len) == 0)
+        return 0;
+
+    // файловая система не умеет - узнаем при записи
+    return (errno == EOPNOTSUPP) ? 0 : -1;
+}
+
+ssize_t ip_spill_put(struct infinitypipe *ip, int fd, size_t len)
+{
+    loff_t off = ip->spill_wr;
+    size_t total = 0;
+
+    while (total < len)
+    {
+        ssize_t rc = splice(fd, NULL, ip->spill_fd, &off, len - total,
+            SPLICE_F_MOVE);
+        if (rc > 0)
+        {
+            total += (size_t)rc;
+            continue;
+        }
+        if (rc < 0 && errno == EINTR)
+            continue;
+        break;
+    }
+
+    ip->spill_wr = (off_t)off;
+    ip->spill_len += total;
+
+    return (total || !len) ? (ssize_t)total : -1;
+}
+
+ssize_t ip_spill_writev(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec)
+{
+    size_t room = ip_spill_room(ip);
+    if (!room)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (ip_spill_open(ip) != 0)
+        return -1;
+
+    size_t total = 0;
+    for (int i = 0; i < n_vec && total < room; ++i)
+    {
+        const char *p = (const char *)vec[i].iov_base;
+        size_t left = vec[i].iov_len;
+        if (left > room - total)
+            left = room - total;
+        while (left)
+        {
+            ssize_t rc = pwrite(ip->spill_fd, p, left, ip->spill_wr);
+            if (rc > 0)
+            {
+                p += rc;
+                left -= (size_t)rc;
+                ip->spill_wr += rc;
+                ip->spill_len += (size_t)rc;
+                total += (size_t)rc;
+                continue;
+            }
+            if (rc < 0 && errno == EINTR)
+                continue;
+            return total ? (ssize_t)total : -1;
+        }
+    }
+
+    return (ssize_t)total;
+}
+
+ssize_t ip_spill_in(struct infinitypipe *ip, int in_fd, loff_t *off,
+    size_t max_bytes)
+{
+    size_t room = ip_spill_room(ip);
+    if (max_bytes > room)
+        max_bytes = room;
+    if (!max_bytes)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    if (ip_spill_open(ip) != 0)
+        return -1;
+
+    // источник -> промежуточный пайп -> файл, user space не участвует
+    struct infinityseg *s = ip_seg_new(ip);
+    if (!s)
+    {
+        if (errno == EMFILE || errno == ENFILE)
+            errno = EAGAIN;
+        ip->seg_denied = (errno == EAGAIN);
+        return -1;
+    }
+
+    size_t total = 0;
+    int err = 0;
+    while (total < max_bytes)
+    {
+        size_t want = max_bytes - total;
+        if (want > s->cap)
+            want = s->cap;
+
+        if (ip_spill_reserve(ip, want) != 0)
+        {
+            // места под вытеснение нет - как полный буфер
+            err = (errno == ENOSPC) ? EAGAIN : errno;
+            break;
+        }
+
+        ssize_t rc = splice(in_fd, off, s->p[1], NULL, want,
+            SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        ip_count_splice(ip, rc, want, 0);
+        if (rc > 0)
+        {
+            s->len = (size_t)rc;
+            ssize_t n = ip_spill_put(ip, s->p[0], s->len);
+            if (n > 0)
+                s->len -= (size_t)n;
+            if (s->len)
+            {
+                // байты уже ушли из источника, а в файл не легли:
+                // поток испорчен, это ошибка, а не EAGAIN
+                err = (n < 0 && errno) ? errno : EIO;
+                total = 0;
+                break;
+            }
+            total += (size_t)rc;
+            continue;
+        }
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+        err = (rc == 0) ? 0 : errno;
+        break;
+    }
+
+    // с остатком в пайпе сегмент не вернётся в пул, а закроется
+    ip_seg_release(ip, s);
+
+    if (total)
+        return (ssize_t)total;
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+size_t ip_spill_fill(struct infinitypipe *ip)
+{
+    int err = errno;
+    off_t from = ip->spill_rd;
+    size_t added = 0;
+
+    while (ip->spill_len && ip->total_len < ip->max_size)
+    {
+        struct infinityseg *s = ip->tail;
+        size_t newly_allocated = 0;
+
+        if (!s || ip_seg_full(s))
+        {
+            s = ip_seg_new(ip);
+            if (!s)
+            {
+                ip->seg_denied = (errno == EAGAIN);
+                break;
+            }
+            newly_allocated = 1;
+        }
+
+        size_t want = s->cap - s->len;
+        if (want > ip->spill_len)
+            want = ip->spill_len;
+        if (want > ip->max_size - ip->total_len)
+            want = ip->max_size - ip->total_len;
+
+        loff_t off = ip->spill_rd;
+        ssize_t rc = splice(ip->spill_fd, &off, s->p[1], NULL, want,
+            SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (rc > 0)
+        {
+            if (newly_allocated)
+                ip_seg_add(ip, s);
+
+            ip->spill_rd = (off_t)off;
+            ip->spill_len -= (size_t)rc;
+            s->len += (size_t)rc;
+            ip_inc_total_len(ip, (size_t)rc);
+            added += (size_t)rc;
+            continue;
+        }
+
+        if (newly_allocated)
+            ip_seg_release(ip, s);
+
+        if (rc < 0 && errno == EINTR)
+            continue;
+
+        // в tail кончились буферы пайпа, а не место
+        if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+            !newly_allocated)
+        {
+            IP_COUNT_GLOBAL(cap_held, (uint_fast64_t)s->len - s->cap);
+            s->cap = s->len;
+            continue;
+        }
+        break;
+    }
+
+    if (!ip->spill_len)
+    {
+        // файл опустел - отдаём всё и пишем с начала
+        if (ftruncate(ip->spill_fd, 0) == 0)
+            ip->spill_rd = ip->spill_wr = 0;
+    }
+    else if (added)
+    {
+        // прочитанное больше не нужно: освобождаем целыми фолио,
+        // частичный фолио ядро обнулит на месте, а на него ещё
+        // ссылаются пайпы и сокеты
+        off_t a = from - from % IP_SPILL_HOLE;
+        off_t b = ip->spill_rd - ip->spill_rd % IP_SPILL_HOLE;
+        if (b > a)
+            fallocate(ip->spill_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                a, b - a);
+    }
+
+    errno = err;
+    return added;
+}
+#else
+ssize_t ip_spill_in(struct infinitypipe *ip, int in_fd, loff_t *off,
+    size_t max_bytes)
+{
+    (void)ip;
+    (void)in_fd;
+    (void)off;
+    (void)max_bytes;
+    errno = ENOSYS;
+    return -1;
+}
+
+ssize_t ip_spill_put(struct infinitypipe *ip, int fd, size_t len)
+{
+    (void)ip;
+    (void)fd;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+}
+
+ssize_t ip_spill_writev(struct infinitypipe *ip,
+    const struct iovec *vec, int n_vec)
+{
+    (void)ip;
+    (void)vec;
+    (void)n_vec;
+    errno = ENOSYS;
+    return -1;
+}
+
+size_t ip_spill_fill(struct infinitypipe *ip)
+{
+    (void)ip;
+    return 0;
+}
+#endif
@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/infinitypipe.h"
+#include "infinitypipe-int.h"
+
+#include <string.h>
+#include <assert.h>
+
+#ifdef E4PIPE_WITH_COUNTERS
+struct ip_counters ip_global;
+#endif
+
+int infinitypipe_get_counters(const struct infinitypipe *ip,
+    struct infinitypipe_counters *c)
+{
+    assert(ip);
+    assert(c);
+
+#ifndef E4PIPE_WITH_COUNTERS
+    memset(c, 0, sizeof(*c));
+    errno = ENOSYS;
+    return -1;
+#else
+    *c = ip->cnt;
+
+    // живые сегменты считаем по списку: их двигают move, tee и bcast
+    c->segs_live = 0;
+    c->cap_held = 0;
+    for (const struct infinityseg *s = ip->head; s; s = s->next)
+    {
+        c->segs_live++;
+        c->cap_held += s->cap;
+    }
+    return 0;
+#endif
+}
+
+int infinitypipe_get_global_counters(struct infinitypipe_counters *c)
+{
+    assert(c);
+
+    memset(c, 0, sizeof(*c));
+#ifndef E4PIPE_WITH_COUNTERS
+    errno = ENOSYS;
+    return -1;
+#else
+#define IP_LOAD(field) \
+    atomic_load_explicit(&ip_global.field, memory_order_relaxed)
+
+    c->bytes_in = IP_LOAD(bytes_in);
+    c->bytes_out = IP_LOAD(bytes_out);
+    c->n_splice = IP_LOAD(n_splice);
+    c->n_eagain = IP_LOAD(n_eagain);
+    c->n_partial = IP_LOAD(n_partial);
+    c->segs_created = IP_LOAD(segs_created);
+    c->segs_freed = IP_LOAD(segs_freed);
+    c->cap_held = IP_LOAD(cap_held);
+    // relaxed-счётчики читаются не атомарно вместе, разность может уйти в минус
+    c->segs_live = (c->segs_created > c->segs_freed) ?
+        c->segs_created - c->segs_freed : 0;
+#undef IP_LOAD
+    return 0;
+#endif
+}
@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+#include "infinitypipe-int.h"
+
+#include <assert.h>
+
+struct pipeevent_bcast *pipeevent_bcast_new(struct infinitypipe *src,
+    size_t max_lag, enum pipeevent_bcast_policy policy)
+{
+    if (!src)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct pipeevent_bcast *b =
+        (struct pipeevent_bcast *)calloc(1, sizeof(*b));
+    if (!b)
+        return NULL;
+
+    b->src = src;
+    b->max_lag = max_lag ? max_lag : src->max_size;
+    b->policy = policy;
+    return b;
+}
+
+void pipeevent_bcast_free(struct pipeevent_bcast *b)
+{
+    if (!b)
+        return;
+
+    while (b->head)
+        pipeevent_bcast_unsubscribe(b->head);
+
+    free(b);
+}
+
+void pipeevent_bcast_setcb(struct pipeevent_bcast *b,
+    pipeevent_bcast_cb detachcb, void *ctx)
+{
+    assert(b);
+
+    b->detachcb = detachcb;
+    b->cb_ctx = ctx;
+}
+
+int pipeevent_bcast_subscribe(struct pipeevent_bcast *b, struct pipeevent *pev)
+{
+    assert(b);
+    assert(pev);
+
+    if (pev->bcast)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    // источник не может быть собственным подписчиком
+    if (&pev->out == b->src)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pev->bcast = b;
+    pev->bc_dropped = 0;
+    pev->bc_prev = NULL;
+    pev->bc_next = b->head;
+    if (b->head)
+        b->head->bc_prev = pev;
+    b->head = pev;
+    b->n_subs++;
+
+    return 0;
+}
+
+int pipeevent_bcast_unsubscribe(struct pipeevent *pev)
+{
+    assert(pev);
+
+    struct pipeevent_bcast *b = pev->bcast;
+    if (!b)
+        return 0;
+
+    if (pev->bc_prev)
+        pev->bc_prev->bc_next = pev->bc_next;
+    else
+        b->head = pev->bc_next;
+    if (pev->bc_next)
+        pev->bc_next->bc_prev = pev->bc_prev;
+
+    pev->bc_next = pev->bc_prev = NULL;
+    pev->bcast = NULL;
+    b->n_subs--;
+
+    return 0;
+}
+
+int pipeevent_bcast_set_uring(struct pipeevent_bcast *b,
+    struct pipeevent_uring *r)
+{
+    assert(b);
+
+#if !defined(__linux__) || !defined(E4PIPE_WITH_IO_URING)
+    if (r)
+    {
+        errno = ENOSYS;
+        return -1;
+    }
+#endif
+
+    b->uring = r;
+    return 0;
+}
+
+int pipeevent_bcast_get_lag(struct pipeevent *pev,
+    size_t *queued, size_t *dropped)
+{
+    assert(pev);
+
+    if (!pev->bcast)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (queued)
+        *queued = ip_queued(&pev->out);
+    if (dropped)
+        *dropped = pev->bc_dropped;
+
+    return 0;
+}
+
+/* подписчик отстал или tee не прошёл: из порции len в его output
+   встало added байт */
+static void pipev_bcast_lagging(struct pipeevent_bcast *b,
+    struct pipeevent *pev, size_t len, size_t added)
+{
+    // порцию можно пропустить только целиком: начало уже в output,
+    // без конца подписчик получил бы разрыв посреди порции
+    if (b->policy == PEV_BCAST_DROP && !added)
+    {
+        pev->bc_dropped += len;
+        return;
+    }
+
+    pipeevent_bcast_unsubscribe(pev);
+    if (b->detachcb)
+        b->detachcb(b, pev, b->cb_ctx);
+}
+
+/* все tee рассылки одним io_uring_enter; -1 - движок недоступен */
+static int pipev_bcast_dispatch_uring(struct pipeevent_bcast *b, size_t len)
+{
+    struct infinitypipe *src = b->src;
+
+    size_t n_segs = 0;
+    for (struct infinityseg *s = src->head; s; s = s->next)
+        n_segs += (s->len != 0);
+
+    struct pipev_tee *t = (struct pipev_tee *)calloc(b->n_subs * n_segs + 1,
+        sizeof(*t));
+    if (!t)
+        return -1;
+
+    // каждому подписчику - свой непрерывный кусок t
+    size_t n = 0;
+    for (struct pipeevent *pev = b->head; pev; pev = pev->bc_next)
+    {
+        // за вытесненными данными копия идёт в файл, не в кольцо
+        if (ip_queued(&pev->out) + len > b->max_lag || pev->out.spill_len)
+            continue;
+
+        for (struct infinityseg *s = src->head; s; s = s->next)
+        {
+            if (!s->len)
+                continue;
+
+            struct infinityseg *ds = ip_seg_new_cap(&pev->out, s->cap);
+            if (!ds)
+                break;
+
+            t[n].fd_in = s->p[0];
+            t[n].fd_out = ds->p[1];
+            t[n].len = (unsigned)s->len;
+            t[n].pev = pev;
+            t[n].seg = ds;
+            ++n;
+        }
+    }
+
+    int done = n ? pipev_uring_tee_batch(b->uring, t, n) : 0;
+    if (done < 0)
+    {
+        for (size_t i = 0; i < n; ++i)
+            ip_seg_drop(&t[i].pev->out, t[i].seg);
+        free(t);
+        return -1;
+    }
+
+    // не вставшие в кольцо - обычным tee
+    for (size_t i = (size_t)done; i < n; ++i)
+    {
+        ssize_t rc;
+        do
+        {
+            rc = tee(t[i].fd_in, t[i].fd_out, t[i].len, SPLICE_F_NONBLOCK);
+        } while (rc < 0 && errno == EINTR);
+        t[i].res = (rc < 0) ? -errno : (int)rc;
+    }
+
+    // результаты по порядку: после первого неполного tee хвост
+    // подписчика уже не добавить без дыры
+    size_t i = 0;
+    struct pipeevent *pev = b->head;
+    while (pev)
+    {
+        struct pipeevent *next = pev->bc_next;
+        size_t added = 0;
+        int broken = 0;
+
+        if (pev->out.spill_len && ip_queued(&pev->out) + len <= b->max_lag)
+        {
+            ssize_t rc = infinitypipe_tee_append(&pev->out, src);
+            if (rc > 0)
+                added = (size_t)rc;
+            if (added < len)
+                pipev_bcast_lagging(b, pev, len, added);
+            pev = next;
+            continue;
+        }
+
+        for (; i < n && t[i].pev == pev; ++i)
+        {
+            struct infinityseg *ds = t[i].seg;
+            if (!broken && t[i].res == (int)t[i].len)
+            {
+                ds->len = t[i].len;
+                ip_seg_add(&pev->out, ds);
+                ip_inc_total_len(&pev->out, ds->len);
+                added += ds->len;
+                continue;
+            }
+
+            broken = 1;
+            // то, что tee успел положить, уходит вместе с сегментом
+            if (t[i].res > 0)
+                ip_seg_drop(&pev->out, ds);
+            else
+                ip_seg_release(&pev->out, ds);
+        }
+
+        if (added)
+            ip_note_change(&pev->out, added, 0);
+        if (added < len)
+            pipev_bcast_lagging(b, pev, len, added);
+
+        pev = next;
+    }
+
+    free(t);
+    return 0;
+}
+
+ssize_t pipeevent_bcast_dispatch(struct pipeevent_bcast *b)
+{
+    assert(b);
+
+    struct infinitypipe *src = b->src;
+    size_t len = src->total_len;
+    if (!len)
+        return 0;
+
+    if (b->uring && pipev_bcast_dispatch_uring(b, len) == 0)
+    {
+        infinitypipe_discard(src, len);
+        return (ssize_t)len;
+    }
+
+    // detachcb может освободить подписчика, поэтому next берём заранее
+    struct pipeevent *pev = b->head;
+    while (pev)
+    {
+        struct pipeevent *next = pev->bc_next;
+
+        if (ip_queued(&pev->out) + len > b->max_lag)
+        {
+            pipev_bcast_lagging(b, pev, len, 0);
+        }
+        else
+        {
+            // каждый подписчик получает свои ссылки на те же страницы
+            ssize_t rc = infinitypipe_tee_append(&pev->out, src);
+            size_t done = (rc > 0) ? (size_t)rc : 0;
+            if (done < len)
+                pipev_bcast_lagging(b, pev, len, done);
+        }
+
+        pev = next;
+    }
+
+    // все получили свою копию, источник больше не нужен
+    infinitypipe_discard(src, len);
+
+    return (ssize_t)len;
+}
@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+#include "infinitypipe-int.h"
+
+#include <assert.h>
+#include <sys/stat.h>
+
+void pipev_file_done(struct pipeevent *pev)
+{
+    if (pev->file_flags & PEV_FILE_CLOSE)
+        close(pev->file_fd);
+
+    pev->file_fd = -1;
+    pev->file_flags = 0;
+    pev->file_left = 0;
+}
+
+/* долить output из файла до PIPEEVENT_FILE_CHUNK. 0 - порция взята
+   (или output полон и ждёт отправки, или сегмента нет по бюджету
+   и стоит таймер), -1 - ошибка в errno */
+int pipev_file_fill(struct pipeevent *pev)
+{
+    struct infinitypipe *out = &pev->out;
+    size_t queued = ip_queued(out);
+    if (!pev->file_left || queued >= PIPEEVENT_FILE_CHUNK)
+        return 0;
+
+    size_t want = PIPEEVENT_FILE_CHUNK - queued;
+    if ((off_t)want > pev->file_left)
+        want = (size_t)pev->file_left;
+
+    // output меньше порции: берём сколько влезет, остальное после отправки
+    size_t cap = ip_capacity(out);
+    size_t room = (queued < cap) ? cap - queued : 0;
+    if (want > room)
+        want = room;
+    if (!want)
+        return 0;
+
+    ssize_t rc = infinitypipe_splice_in_file(out, pev->file_fd,
+        &pev->file_off, want);
+    if (rc > 0)
+    {
+        pev->file_left -= rc;
+        if (!pev->file_left)
+        {
+            pipev_file_done(pev);
+            return 0;
+        }
+
+        // readahead следующей порции, пока сокет отдаёт эту
+        posix_fadvise(pev->file_fd, pev->file_off, PIPEEVENT_FILE_CHUNK,
+            POSIX_FADV_WILLNEED);
+        return 0;
+    }
+
+    // output полон (или сегмента нет по бюджету): долив продолжит
+    // следующая отправка
+    if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+        // output пуст - некому продолжить, повторим по таймеру бюджета
+        if (!ip_queued(out))
+        {
+            struct timeval tv = { 0, PIPEEVENT_BUDGET_RETRY_MS * 1000 };
+            evtimer_add(&pev->ev_budget, &tv);
+        }
+        return 0;
+    }
+
+    // файл оказался короче заявленного
+    if (rc == 0)
+        errno = ENODATA;
+
+    return -1;
+}
+
+int pipeevent_add_file(struct pipeevent *pev, int fd, off_t offset,
+    off_t length, unsigned flags)
+{
+#ifndef __linux__
+    (void)pev;
+    (void)fd;
+    (void)offset;
+    (void)length;
+    (void)flags;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(pev);
+
+    if (fd < 0 || offset < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // output relay заполняет пир, второй файл встал бы в очередь за первым
+    if (pev->relay || pev->file_left)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (length < 0)
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0)
+            return -1;
+        if (st.st_size < offset)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        length = st.st_size - offset;
+    }
+
+    if (!length)
+    {
+        if (flags & PEV_FILE_CLOSE)
+            close(fd);
+        return 0;
+    }
+
+    posix_fadvise(fd, offset, length, POSIX_FADV_SEQUENTIAL);
+
+    pev->file_fd = fd;
+    pev->file_off = offset;
+    pev->file_left = length;
+    pev->file_flags = flags;
+
+    // первая порция здесь, дальше output доливается по мере отправки
+    if (pipev_file_fill(pev) != 0)
+    {
+        // fd остаётся вызывающему
+        pev->file_flags = 0;
+        pipev_file_done(pev);
+        return -1;
+    }
+
+    return 0;
+#endif
+}
@@ -3,6 +3,8 @@
 #include "pipeevent-int.h"
 #include "infinitypipe-int.h"
 
+#include <sys/socket.h>
+
 static inline void pipev_arm_write_event(struct pipeevent *pev)
 {
     if (!(pev->enabled & EV_WRITE)) 
@@ -12,6 +14,7 @@ static inline void pipev_arm_write_event(struct pipeevent *pev)
     {
         event_add(&pev->ev_write, NULL);
         pev->ev_write_added = 1;
+        pipev_timer_update(pev);
     }
 }
 
@@ -21,29 +24,263 @@ static inline void pipev_disarm_write_event(struct pipeevent *pev)
     {
         event_del(&pev->ev_write);
         pev->ev_write_added = 0;
+        pipev_timer_update(pev);
+    }
+}
+
+void pipev_suspend_read(struct pipeevent *pev, short what)
+{
+    if (!pev->read_suspended && (pev->enabled & EV_READ))
+        event_del(&pev->ev_read);
+
+    pev->read_suspended |= what;
+    pipev_timer_update(pev);
+}
+
+void pipev_unsuspend_read(struct pipeevent *pev, short what)
+{
+    if (!(pev->read_suspended & what))
+        return;
+
+    pev->read_suspended &= ~what;
+    if (!pev->read_suspended && (pev->enabled & EV_READ))
+    {
+        event_add(&pev->ev_read, NULL);
+        // edge-triggered: фронт мог прийти, пока чтение стояло
+        if (pev->uring)
+            event_active(&pev->ev_read, EV_READ, 1);
+    }
+    pipev_timer_update(pev);
+}
+
+void pipev_suspend_write(struct pipeevent *pev, short what)
+{
+    if (pev->ev_write_added)
+    {
+        event_del(&pev->ev_write);
+        pev->ev_write_added = 0;
+    }
+
+    pev->write_suspended |= what;
+    pipev_timer_update(pev);
+}
+
+void pipev_unsuspend_write(struct pipeevent *pev, short what)
+{
+    if (!(pev->write_suspended & what))
+        return;
+
+    pev->write_suspended &= ~what;
+    if (!pev->write_suspended)
+        pipev_flush_output(pev);
+}
+
+/* сегмент не выдан по бюджету: fd остаётся готовым, поэтому чтение
+   ждёт таймера, а не следующего события */
+static void pipev_budget_wait(struct pipeevent *pev)
+{
+    pipev_suspend_read(pev, PEV_SUSPEND_BUDGET);
+
+    struct timeval tv = { 0, PIPEEVENT_BUDGET_RETRY_MS * 1000 };
+    evtimer_add(&pev->ev_budget, &tv);
+}
+
+void pipev_on_budget(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd;
+    (void)what;
+    struct pipeevent *pev = (struct pipeevent *)arg;
+
+    // не хватит и сейчас - splice_in снова отложит чтение
+    pipev_unsuspend_read(pev, PEV_SUSPEND_BUDGET);
+
+    // и долив output из файла или из вытеснения
+    if (pev->file_left || pev->out.spill_len)
+        pipev_flush_output(pev);
+
+    // и запись в файлы tap
+    if (pev->tap_rd || pev->tap_wr)
+        pipev_tap_retry(pev);
+}
+
+/* источник relay дочитал до EOF, а output пира опустел */
+static void pipev_relay_finish(struct pipeevent *dst)
+{
+    struct pipeevent *src = dst->relay;
+
+    if (!(src->relay_flags & PEV_RELAY_EOF) ||
+        (src->relay_flags & PEV_RELAY_DONE) || !ip_is_empty(&dst->out) ||
+        dst->ur_wr.busy)
+        return;
+
+    src->relay_flags |= PEV_RELAY_DONE;
+    // half-close: пир узнает о конце потока, обратное направление живёт
+    shutdown(dst->fd, SHUT_WR);
+
+    // последним действием: callback может освободить оба pipeevent
+    if (src->eventcb)
+        src->eventcb(src, PEV_EVENT_EOF|PEV_EVENT_READING, src->cb_ctx);
+}
+
+/* output пира ушёл в сокет: можно продолжить чтение источника */
+static void pipev_relay_drained(struct pipeevent *dst)
+{
+    struct pipeevent *src = dst->relay;
+
+    if ((src->read_suspended & PEV_SUSPEND_RELAY) &&
+        ip_queued(&dst->out) <= src->relay_hwm / 2)
+        pipev_unsuspend_read(src, PEV_SUSPEND_RELAY);
+}
+
+/* edge-triggered чтение (io_uring) без операции: если прочитали
+   ровно сколько просили, в сокете могло остаться - фронта уже не будет */
+static inline void pipev_read_rearm(struct pipeevent *pev, ssize_t n,
+    size_t want)
+{
+    if (pev->uring && n > 0 && (size_t)n == want)
+        event_active(&pev->ev_read, EV_READ, 1);
+}
+
+/* результат чтения источника relay в output пира */
+static void pipev_relay_read_done(struct pipeevent *pev, ssize_t n)
+{
+    struct pipeevent *peer = pev->relay;
+    struct infinitypipe *out = &peer->out;
+
+    if (n > 0)
+    {
+        pipev_rate_read_done(pev, (size_t)n);
+        pipev_timer_touch(pev, &pev->tm_read);
+        pipev_flush_output(peer);
+
+        if (ip_queued(out) >= pev->relay_hwm)
+            pipev_suspend_read(pev, PEV_SUSPEND_RELAY);
+        else
+            pipev_lowat_read(pev, pev->relay_hwm, ip_queued(out));
+        return;
     }
+
+    if (n == 0)
+    {
+        pev->relay_flags |= PEV_RELAY_EOF;
+        pipeevent_disable(pev, EV_READ);
+        pipev_relay_finish(peer);
+        return;
+    }
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK)
+    {
+        if (out->seg_denied)
+        {
+            pipev_budget_wait(pev);
+            return;
+        }
+
+        // упёрлись в max_size (и файл вытеснения) пира - ждём, пока он
+        // отдаст данные
+        if (ip_queued(out) >= ip_capacity(out))
+            pipev_suspend_read(pev, PEV_SUSPEND_RELAY);
+        return;
+    }
+
+    pipeevent_disable(pev, EV_READ|EV_WRITE);
+    if (pev->eventcb)
+        pev->eventcb(pev, PEV_EVENT_ERROR|PEV_EVENT_READING, pev->cb_ctx);
+}
+
+static void pipev_relay_readable(struct pipeevent *pev)
+{
+    struct pipeevent *peer = pev->relay;
+    struct infinitypipe *out = &peer->out;
+
+    size_t queued = ip_queued(out);
+    if (queued >= pev->relay_hwm)
+    {
+        pipev_suspend_read(pev, PEV_SUSPEND_RELAY);
+        return;
+    }
+
+    // пишем сразу в output пира, минуя свой input
+    size_t want = pev->relay_hwm - queued;
+    if (want > out->max_splice)
+        want = out->max_splice;
+
+    want = pipev_rate_read_max(pev, want);
+    want = pipev_sched_read_max(pev, want);
+    if (!want)
+        return;
+
+    if (pev->uring && pipev_uring_read(pev, out, want) == 0)
+        return;
+
+    ssize_t n = pipev_tap_splice_in(pev, out, want);
+    pipev_read_rearm(pev, n, want);
+    pipev_sched_read_done(pev, n, want);
+    pipev_relay_read_done(pev, n);
 }
 
 void pipev_flush_output(struct pipeevent *pev)
 {
-    if (!(pev->enabled & EV_WRITE)) 
+    if (!(pev->enabled & EV_WRITE) || pev->write_suspended) 
         return;
 
+    // пока output копится, очередь сокета держим короткой
+    pipev_lowat_write(pev);
+
     for (;;) {
+        if (pev->file_left && pipev_file_fill(pev) != 0) {
+            pipev_file_done(pev);
+            if (pev->eventcb)
+                pev->eventcb(pev, PEV_EVENT_ERROR|PEV_EVENT_WRITING,
+                    pev->cb_ctx);
+            return;
+        }
+
         if (ip_is_empty(&pev->out)) {
+            pipev_lowat_write(pev);
             pipev_disarm_write_event(pev);
+            if (pev->relay) {
+                pipev_relay_drained(pev);
+                pipev_relay_finish(pev);
+            }
             return;
         }
 
-        ssize_t rc = infinitypipe_splice_out(&pev->out, 
-            pev->fd, INFINITYPIPE_MAX_SPLICE_AT_ONCE);
+        size_t want = pipev_rate_write_max(pev, pev->out.max_splice);
+        want = pipev_sched_write_max(pev, want);
+        if (!want)
+            return;
+
+        // завершение операции продолжит flush
+        if (pev->uring && pipev_uring_write(pev, want) == 0)
+            return;
+
+        ssize_t rc = pipev_tap_splice_out(pev, want);
+        pipev_sched_write_done(pev, rc, want);
         if (rc > 0) {
+            pipev_rate_write_done(pev, (size_t)rc);
+            pipev_timer_touch(pev, &pev->tm_write);
+            if (pev->write_suspended)
+                return;
             // out changed; infinitypipe already scheduled deferred tick
             continue;
         }
 
+        // tap ждёт, пока staging уйдёт в файлы
+        if (rc < 0 && (pev->write_suspended & PEV_SUSPEND_TAP))
+            return;
+
         if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // вытесненное не вернуть в сегменты по бюджету - ждём таймер,
+            // готовность сокета тут ничего не даст
+            if (pev->out.seg_denied) {
+                struct timeval tv = { 0, PIPEEVENT_BUDGET_RETRY_MS * 1000 };
+                evtimer_add(&pev->ev_budget, &tv);
+                return;
+            }
             pipev_arm_write_event(pev);
+            if (pev->relay)
+                pipev_relay_drained(pev);
             return;
         }
 
@@ -67,34 +304,73 @@ void pipev_run_pending(struct pipeevent *pev)
         unsigned p = pev->pending_flags;
         pev->pending_flags = 0;
 
-        if ((p & PEV_PENDING_READ) && pev->readcb) {
+        if ((p & PEV_PENDING_READ) && pev->readcb &&
+            pev->in.total_len >= pev->wm_read_low) {
+            uint64_t t = pipev_cb_start();
             pev->readcb(pev, pev->cb_ctx);
+            pipev_cb_done(pev, t);
         }
 
         if (p & PEV_PENDING_WRITE) 
         {            
             pipev_flush_output(pev);
 
-            if (pev->writecb && ip_is_empty(&pev->out))
+            // writecb как только output опустился до нижней отметки,
+            // чтобы данные успели дописать до простоя сокета;
+            // пока отправляется файл, output доливается сам
+            if (pev->writecb && !pev->file_left &&
+                ip_queued(&pev->out) <= pev->wm_write_low)
+            {
+                uint64_t t = pipev_cb_start();
                 pev->writecb(pev, pev->cb_ctx);
+                pipev_cb_done(pev, t);
+            }
         }
     }
 
     pev->cb_running = 0;
 }
 
-void pipev_on_deferred(evutil_socket_t fd, short what, void *arg)
+/* сколько можно держать во input (вместе с файлом вытеснения)
+   до остановки чтения */
+static inline size_t pipev_read_limit(const struct pipeevent *pev)
 {
-    (void)fd; (void)what;
-    struct pipeevent *pev = (struct pipeevent*)arg;
-    pev->deferred_scheduled = 0;
+    size_t high = ip_capacity(&pev->in);
+    if (pev->wm_read_high && pev->wm_read_high < high)
+        high = pev->wm_read_high;
+    return high;
+}
 
-    // pull buffered deltas into pipeevent pending flags
+void pipev_check_read_wm(struct pipeevent *pev)
+{
+    size_t high = pipev_read_limit(pev);
+
+    size_t queued = ip_queued(&pev->in);
+    if (queued >= high)
+    {
+        pipev_suspend_read(pev, PEV_SUSPEND_WM);
+        return;
+    }
+
+    pipev_unsuspend_read(pev, PEV_SUSPEND_WM);
+    // у relay чтение идёт в output пира, порог считает pipev_relay_read_done
+    if (!pev->relay)
+        pipev_lowat_read(pev, high, queued);
+}
+
+size_t pipev_collect_pending(struct pipeevent *pev)
+{
     struct infinitypipe_info st;
     size_t any = 0;
+
     if (infinitypipe_get_stat(&pev->in, &st)) {
-        pev->pending_flags |= PEV_PENDING_READ;
-        any = 1;
+        // readcb только на новые данные, вычитка лишь двигает отметки
+        if (st.n_added) {
+            pev->pending_flags |= PEV_PENDING_READ;
+            any = 1;
+        }
+        if (st.n_deleted)
+            pipev_check_read_wm(pev);
     }
 
     if (infinitypipe_get_stat(&pev->out, &st)) {
@@ -102,19 +378,37 @@ void pipev_on_deferred(evutil_socket_t fd, short what, void *arg)
         any = 1;
     }
 
-    if (any) {
+    return any;
+}
+
+void pipev_on_deferred(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd; (void)what;
+    struct pipeevent *pev = (struct pipeevent*)arg;
+    pev->deferred_scheduled = 0;
+    PEV_COUNT(pev, deferred, 1);
+
+    // pull buffered deltas into pipeevent pending flags
+    if (pipev_collect_pending(pev)) {
         //fprintf(stdout, ".");
         pipev_run_pending(pev);
     }
 }
-void pipev_on_readable(evutil_socket_t fd, short what, void *arg)
-{
-    (void)what;
-    struct pipeevent *pev = (struct pipeevent *)arg;
 
-    ssize_t n = infinitypipe_splice_in(&pev->in, (int)fd, INFINITYPIPE_MAX_SPLICE_AT_ONCE);
+/* результат чтения в input */
+static void pipev_read_done(struct pipeevent *pev, ssize_t n)
+{
     if (n > 0)
     {
+        pipev_rate_read_done(pev, (size_t)n);
+        pipev_timer_touch(pev, &pev->tm_read);
+
+        // выше верхней отметки - ждём, пока input вычитают
+        if (ip_queued(&pev->in) >= pipev_read_limit(pev))
+            pipev_suspend_read(pev, PEV_SUSPEND_WM);
+        else
+            pipev_lowat_read(pev, pipev_read_limit(pev), ip_queued(&pev->in));
+
         // infinitypipe already scheduled deferred via notify
         return;
     }
@@ -131,7 +425,16 @@ void pipev_on_readable(evutil_socket_t fd, short what, void *arg)
 
     if (errno == EAGAIN || errno == EWOULDBLOCK) 
     {
-        pipeevent_disable(pev, EV_READ);
+        if (pev->in.seg_denied)
+        {
+            pipev_budget_wait(pev);
+            return;
+        }
+
+        // буфер заполнен: чтение продолжится, когда input вычитают,
+        // иначе это ложное пробуждение
+        if (ip_queued(&pev->in) >= ip_capacity(&pev->in))
+            pipev_suspend_read(pev, PEV_SUSPEND_WM);
         return;
     }
 
@@ -140,6 +443,53 @@ void pipev_on_readable(evutil_socket_t fd, short what, void *arg)
         pev->eventcb(pev, PEV_EVENT_ERROR, pev->cb_ctx);
 }
 
+void pipev_on_readable(evutil_socket_t fd, short what, void *arg)
+{
+    (void)what;
+    struct pipeevent *pev = (struct pipeevent *)arg;
+
+    // с io_uring чтение edge-triggered: фронт во время операции
+    // запоминаем и читаем снова после её завершения
+    if (pev->ur_rd.busy)
+    {
+        pev->ur_again = 1;
+        return;
+    }
+
+    if (pev->relay)
+    {
+        pipev_relay_readable(pev);
+        return;
+    }
+
+    size_t high = pipev_read_limit(pev);
+    size_t queued = ip_queued(&pev->in);
+    if (queued >= high)
+    {
+        pipev_suspend_read(pev, PEV_SUSPEND_WM);
+        return;
+    }
+
+    size_t want = high - queued;
+    if (want > pev->in.max_splice)
+        want = pev->in.max_splice;
+
+    want = pipev_rate_read_max(pev, want);
+    want = pipev_sched_read_max(pev, want);
+    if (!want)
+        return;
+
+    if (pev->uring && pipev_uring_read(pev, &pev->in, want) == 0)
+        return;
+
+    (void)fd;
+    ssize_t n = pipev_tap_splice_in(pev, &pev->in, want);
+    pipev_read_rearm(pev, n, want);
+    // квант кончился - остаток чтения ждёт прохода планировщика
+    pipev_sched_read_done(pev, n, want);
+    pipev_read_done(pev, n);
+}
+
 void pipev_ip_notify(void *arg)
 {
     struct pipeevent *pev = (struct pipeevent*)arg;
@@ -159,19 +509,7 @@ void pipev_ip_notify(void *arg)
 
         // иначе fast-path: проверяем статистику 
         // и запускаем коллбеки напрямую
-        struct infinitypipe_info st;
-        size_t any = 0;
-
-        if (infinitypipe_get_stat(&pev->in, &st)) {
-            pev->pending_flags |= PEV_PENDING_READ;
-            any = 1;
-        }
-        if (infinitypipe_get_stat(&pev->out, &st)) {
-            pev->pending_flags |= PEV_PENDING_WRITE;
-            any = 1;
-        }
-
-        if (any) {
+        if (pipev_collect_pending(pev)) {
             // Запускаем user-коллбеки напрямую.
             // Внутри pipev_run_pending() должен выставляться cb_running=1 на время
             // выполнения коллбеков и сбрасываться в 0 по завершению.
@@ -189,4 +527,231 @@ void pipev_on_writable(evutil_socket_t fd, short what, void *arg)
     (void)what;
     struct pipeevent *pev = (struct pipeevent *)arg;
     pipev_flush_output(pev);
-}
\ No newline at end of file
+}
+int pipev_uring_read(struct pipeevent *pev, struct infinitypipe *ip,
+    size_t want)
+{
+    struct pipeevent_uring_op *op = &pev->ur_rd;
+
+    // сверх max_size читаем синхронно в файл вытеснения: сегмент из
+    // кольца встал бы в список раньше вытесненных данных; tap копирует
+    // прочитанное до того, как оно попадёт в буфер
+    if (ip_spill_wanted(ip) || pev->tap_rd)
+        return -1;
+
+    // в хвост с местом дописывает обычный splice (ip_splice_in_segs):
+    // иначе мелкие чтения строят цепочку полупустых сегментов, по пайпу
+    // на завершение. Операция - только когда хвоста нет или он полон
+    if (ip->tail && !ip_seg_full(ip->tail))
+        return -1;
+
+    // читаем в свежий сегмент: пока операция в ядре, он только её
+    struct infinityseg *s = ip_seg_new(ip);
+    if (!s)
+        return -1;
+
+    if (want > s->cap)
+        want = s->cap;
+
+    op->kind = PEV_UR_READ;
+    op->pev = pev;
+    op->ip = ip;
+    op->seg = s;
+    op->len = want;
+
+    if (pipev_uring_splice(pev->uring, op, pev->fd, s->p[1], want) != 0)
+    {
+        ip_seg_release(ip, s);
+        op->seg = NULL;
+        return -1;
+    }
+
+    op->busy = 1;
+    pev->ur_again = 0;
+    return 0;
+}
+
+int pipev_uring_write(struct pipeevent *pev, size_t want)
+{
+    struct pipeevent_uring_op *op = &pev->ur_wr;
+    if (op->busy)
+        return 0;
+
+    // tap копирует голову output перед каждой отправкой
+    if (pev->tap_wr)
+        return -1;
+
+    // голова пуста, данные в файле вытеснения - долив на обычном пути
+    struct infinityseg *s = pev->out.head;
+    if (!s)
+        return -1;
+    if (want > s->len)
+        want = s->len;
+
+    op->kind = PEV_UR_WRITE;
+    op->pev = pev;
+    op->ip = &pev->out;
+    op->seg = s;
+    op->len = want;
+
+    if (pipev_uring_splice(pev->uring, op, s->p[0], pev->fd, want) != 0)
+    {
+        op->seg = NULL;
+        return -1;
+    }
+
+    // голова уходит из списка вместе со своими байтами: до завершения
+    // буфер без неё целостен, prepend/insert перед ней - EBUSY
+    pev->out.head = s->next;
+    if (!pev->out.head)
+        pev->out.tail = NULL;
+    pev->out.n_segs--;
+    s->next = NULL;
+    ip_dec_total_len(&pev->out, s->len);
+    pev->out.inflight = s;
+
+    op->busy = 1;
+    pipev_suspend_write(pev, PEV_SUSPEND_URING);
+    return 0;
+}
+
+static void pipev_uring_read_complete(struct pipeevent *pev,
+    struct pipeevent_uring_op *op, int res)
+{
+    struct infinitypipe *ip = op->ip;
+    struct infinityseg *s = op->seg;
+    op->seg = NULL;
+
+    if (res < 0)
+        errno = -res;
+    ip_count_splice(ip, res, op->len, 0);
+
+    ssize_t n = res;
+    if (res > 0)
+    {
+        s->len = (size_t)res;
+        ip_seg_add(ip, s);
+        ip_inc_total_len(ip, (size_t)res);
+        ip_note_change(ip, (size_t)res, 0);
+    }
+    else
+    {
+        ip_seg_release(ip, s);
+        if (res < 0)
+        {
+            errno = -res;
+            n = -1;
+        }
+    }
+
+    // edge-triggered: читаем до EAGAIN, иначе потеряем хвост или EOF,
+    // пришедший тем же фронтом
+    int again = pev->ur_again || res > 0;
+    pev->ur_again = 0;
+    pipev_sched_read_done(pev, n, op->len);
+
+    if (pev->relay && ip == &pev->relay->out)
+        pipev_relay_read_done(pev, n);
+    else if (ip == &pev->in)
+        pipev_read_done(pev, n);
+    else if (n > 0)
+        pipev_rate_read_done(pev, (size_t)n);
+
+    if (again && n != 0 && (pev->enabled & EV_READ) && !pev->read_suspended)
+        event_active(&pev->ev_read, EV_READ, 1);
+}
+
+static void pipev_uring_write_complete(struct pipeevent *pev,
+    struct pipeevent_uring_op *op, int res)
+{
+    struct infinitypipe *out = &pev->out;
+    struct infinityseg *s = op->seg;
+    op->seg = NULL;
+
+    if (res < 0)
+        errno = -res;
+    ip_count_splice(out, res, op->len, 1);
+
+    out->inflight = NULL;
+    if (res > 0)
+        s->len -= (size_t)res;
+
+    // остаток сегмента возвращается в голову
+    if (s->len)
+    {
+        s->next = out->head;
+        out->head = s;
+        if (!out->tail)
+            out->tail = s;
+        out->n_segs++;
+        ip_inc_total_len(out, s->len);
+    }
+    else
+    {
+        ip_seg_release(out, s);
+    }
+
+    pev->write_suspended &= ~PEV_SUSPEND_URING;
+    pipev_sched_write_done(pev, res, op->len);
+
+    if (res > 0)
+    {
+        pipev_rate_write_done(pev, (size_t)res);
+        pipev_timer_touch(pev, &pev->tm_write);
+        ip_note_change(out, 0, (size_t)res);
+        pipev_flush_output(pev);
+        return;
+    }
+
+    if (res == -EAGAIN || res == -EWOULDBLOCK)
+    {
+        pipev_arm_write_event(pev);
+        if (pev->relay)
+            pipev_relay_drained(pev);
+        return;
+    }
+
+    if (pev->eventcb)
+        pev->eventcb(pev, PEV_EVENT_ERROR, pev->cb_ctx);
+}
+
+void pipev_uring_complete(struct pipeevent_uring_op *op, int res)
+{
+    struct pipeevent *pev = op->pev;
+    op->busy = 0;
+
+    if (pev->ur_zombie)
+    {
+        // pipeevent уже освобождён пользователем
+        if (pev->out.inflight == op->seg)
+            pev->out.inflight = NULL;
+        infinityseg_free(op->seg);
+        op->seg = NULL;
+        if (!pev->ur_rd.busy && !pev->ur_wr.busy)
+            pipev_free_final(pev);
+        return;
+    }
+
+    if (op->kind == PEV_UR_READ)
+        pipev_uring_read_complete(pev, op, res);
+    else
+        pipev_uring_write_complete(pev, op, res);
+}
+
+int pipev_uring_detach(struct pipeevent *pev)
+{
+    if (!pev->uring)
+        return 0;
+
+    pipev_uring_unlink(pev);
+
+    if (!pev->ur_rd.busy && !pev->ur_wr.busy)
+        return 0;
+
+    // fd и сегменты операций нужны ядру до завершения
+    pev->ur_zombie = 1;
+    pev->readcb = NULL;
+    pev->writecb = NULL;
+    pev->eventcb = NULL;
+    return 1;
+}
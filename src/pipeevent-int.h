@@ -12,14 +12,240 @@
 #define PEV_PENDING_READ  EV_READ
 #define PEV_PENDING_WRITE EV_WRITE
 
+/* причины приостановки чтения */
+#define PEV_SUSPEND_RELAY 0x01
+#define PEV_SUSPEND_WM    0x02
+#define PEV_SUSPEND_BW    0x04
+#define PEV_SUSPEND_BW_GROUP 0x08
+#define PEV_SUSPEND_URING 0x10
+#define PEV_SUSPEND_BUDGET 0x20
+#define PEV_SUSPEND_TAP   0x40
+#define PEV_SUSPEND_SCHED 0x80
+
+/* kind операций io_uring, первое поле user_data */
+#define PEV_UR_READ  1
+#define PEV_UR_WRITE 2
+#define PEV_UR_TEE   3
+
+/* tee одного сегмента рассылки */
+struct pipev_tee {
+    short kind;
+    short pending;
+    int fd_in;
+    int fd_out;
+    unsigned len;
+    // результат как у tee(2): байты или -errno
+    int res;
+    struct pipeevent *pev;
+    struct infinityseg *seg;
+};
+
+#ifdef E4PIPE_WITH_COUNTERS
+#include <stdatomic.h>
+#include <time.h>
+
+/* сумма счётчиков pipeevent процесса, splice считает infinitypipe */
+struct pipev_counters {
+    atomic_uint_fast64_t deferred;
+    atomic_uint_fast64_t callbacks;
+    atomic_uint_fast64_t cb_ns;
+};
+
+extern struct pipev_counters pipev_global;
+
+#define PEV_COUNT(pev, field, n) \
+    do { \
+        (pev)->cnt_##field += (n); \
+        atomic_fetch_add_explicit(&pipev_global.field, (n), \
+            memory_order_relaxed); \
+    } while (0)
+#else
+#define PEV_COUNT(pev, field, n) ((void)0)
+#endif
+
+/* время в readcb/writecb: метка до вызова */
+static inline uint64_t pipev_cb_start(void)
+{
+#ifdef E4PIPE_WITH_COUNTERS
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* и учёт после; pev должен пережить callback, как и в pipev_run_pending */
+static inline void pipev_cb_done(struct pipeevent *pev, uint64_t start)
+{
+#ifdef E4PIPE_WITH_COUNTERS
+    PEV_COUNT(pev, callbacks, 1);
+    PEV_COUNT(pev, cb_ns, pipev_cb_start() - start);
+#else
+    (void)pev;
+    (void)start;
+#endif
+}
+
+/* relay_flags */
+#define PEV_RELAY_EOF  0x01
+#define PEV_RELAY_DONE 0x02
+
+void pipev_suspend_read(struct pipeevent *pev, short what);
+
+void pipev_unsuspend_read(struct pipeevent *pev, short what);
+
+void pipev_suspend_write(struct pipeevent *pev, short what);
+
+void pipev_unsuspend_write(struct pipeevent *pev, short what);
+
+/* rate limit: сколько можно прочитать/записать сейчас */
+size_t pipev_rate_read_max(struct pipeevent *pev, size_t want);
+
+size_t pipev_rate_write_max(struct pipeevent *pev, size_t want);
+
+/* списать переданные байты, при исчерпании - приостановить */
+void pipev_rate_read_done(struct pipeevent *pev, size_t n);
+
+void pipev_rate_write_done(struct pipeevent *pev, size_t n);
+
+void pipev_rate_free(struct pipeevent *pev);
+
+/* тайм-ауты: пересчитать, какие таймеры должны стоять в колесе */
+void pipev_timer_update(struct pipeevent *pev);
+
+/* текущий тик колеса по монотонным часам */
+static inline ev_uint64_t pipev_wheel_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ev_uint64_t ms = (ev_uint64_t)ts.tv_sec * 1000u +
+        (ev_uint64_t)ts.tv_nsec / 1000000u;
+    return ms / PIPEEVENT_WHEEL_TICK_MS;
+}
+
+/* отметить активность направления: только запись тика, без перестановки.
+   Тик берётся по часам, а не из колеса: оно может отставать до
+   следующего срабатывания, и тайм-аут считался бы от прошлого */
+static inline void pipev_timer_touch(struct pipeevent *pev,
+    struct pipeevent_timer *tm)
+{
+    (void)pev;
+    if (tm->list)
+        tm->last = pipev_wheel_now();
+}
+
+/* снять таймеры с колеса, тайм-ауты сохраняются */
+void pipev_timer_free(struct pipeevent *pev);
+
+/* поставить сохранённые тайм-ауты в колесо текущего pev->base */
+void pipev_timer_attach(struct pipeevent *pev);
+
+/* планировщик: сколько можно прочитать/записать за это обслуживание */
+size_t pipev_sched_read_max(struct pipeevent *pev, size_t want);
+
+size_t pipev_sched_write_max(struct pipeevent *pev, size_t want);
+
+/* списать сделанное: квант исчерпан - в очередь, меньше want - fd
+   опустел (или переполнен), квант начинается заново */
+void pipev_sched_read_done(struct pipeevent *pev, ssize_t n, size_t want);
+
+void pipev_sched_write_done(struct pipeevent *pev, ssize_t n, size_t want);
+
+void pipev_sched_free(struct pipeevent *pev);
+
+/* перенос: очередь принадлежит старому event_base */
+void pipev_sched_detach(struct pipeevent *pev);
+
+void pipev_sched_attach(struct pipeevent *pev);
+
+/* привязать события pev к pev->base */
+void pipev_assign_events(struct pipeevent *pev);
+
+/* перенос между event_base: снять события в старом потоке,
+   вернёт, какие infinitypipe брали сегменты из пула потока ... */
+unsigned pipev_detach_base(struct pipeevent *pev);
+
+/* ... и поставить их в новом */
+void pipev_attach_base(struct pipeevent *pev, struct event_base *base,
+    unsigned pools);
+
+void pipev_rate_detach(struct pipeevent *pev);
+
+void pipev_rate_attach(struct pipeevent *pev);
+
+/* убрать pev из списка воркера (pipeevent_free) */
+void pipev_worker_leave(struct pipeevent *pev);
+
+/* io_uring: поставить splice в кольцо движка pev->uring;
+   0 - операция ушла, -1 - делать синхронно */
+int pipev_uring_read(struct pipeevent *pev, struct infinitypipe *ip,
+    size_t want);
+
+int pipev_uring_write(struct pipeevent *pev, size_t want);
+
+/* завершение операции pipeevent, res как у splice(2) или -errno */
+void pipev_uring_complete(struct pipeevent_uring_op *op, int res);
+
+/* pipeevent_free: 1 - операции ещё в ядре, освобождение отложено */
+int pipev_uring_detach(struct pipeevent *pev);
+
+/* окончательное освобождение pipeevent */
+void pipev_free_final(struct pipeevent *pev);
+
+/* движок: splice в кольцо, -1 - нет места или движка нет */
+int pipev_uring_splice(struct pipeevent_uring *r, void *user,
+    int fd_in, int fd_out, size_t len);
+
+/* движок: отправить tee пачкой и дождаться всех, -1 - движок недоступен */
+int pipev_uring_tee_batch(struct pipeevent_uring *r,
+    struct pipev_tee *t, size_t n);
+
+/* движок: убрать pipeevent из списка пользователей */
+void pipev_uring_unlink(struct pipeevent *pev);
+
+/* файл pipeevent_add_file: долить output, -1 - ошибка чтения в errno */
+int pipev_file_fill(struct pipeevent *pev);
+
+/* закончить с файлом, закрыть при PEV_FILE_CLOSE */
+void pipev_file_done(struct pipeevent *pev);
+
+/* tap: чтение fd в ip с копией прочитанного в staging, как splice_in */
+ssize_t pipev_tap_splice_in(struct pipeevent *pev, struct infinitypipe *ip,
+    size_t want);
+
+/* и отправка output с копией отправленного, как splice_out */
+ssize_t pipev_tap_splice_out(struct pipeevent *pev, size_t want);
+
+/* по таймеру ev_budget: staging мог освободиться */
+void pipev_tap_retry(struct pipeevent *pev);
+
+/* pipeevent_free: остановить запись, недоставленное отбрасывается */
+void pipev_tap_free(struct pipeevent *pev);
+
+/* SO_RCVLOWAT по месту, которое осталось до limit */
+void pipev_lowat_read(struct pipeevent *pev, size_t limit, size_t queued);
+
+/* TCP_NOTSENT_LOWAT по очереди output */
+void pipev_lowat_write(struct pipeevent *pev);
+
 void pipev_ip_notify(void *arg);
 
+/* забрать изменения input/output в pending_flags */
+size_t pipev_collect_pending(struct pipeevent *pev);
+
+/* остановить/продолжить чтение по верхней отметке input */
+void pipev_check_read_wm(struct pipeevent *pev);
+
 void pipev_run_pending(struct pipeevent *pev);
 
 void pipev_flush_output(struct pipeevent *pev);
 
 void pipev_on_deferred(evutil_socket_t fd, short what, void *arg);
 
+/* таймер повтора чтения после отказа бюджета */
+void pipev_on_budget(evutil_socket_t fd, short what, void *arg);
+
 void pipev_on_readable(evutil_socket_t fd, short what, void *arg);
 
 void pipev_on_writable(evutil_socket_t fd, short what, void *arg);
\ No newline at end of file
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+#include "infinitypipe-int.h"
+
+#include <limits.h>
+#include <assert.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+static int pipev_lowat_clamp(size_t v)
+{
+    return (v > INT_MAX) ? INT_MAX : (int)v;
+}
+
+void pipev_lowat_read(struct pipeevent *pev, size_t limit, size_t queued)
+{
+    if (!pev->lowat_rcv)
+        return;
+
+    // больше, чем поместится, ждать нельзя: fd не проснётся
+    size_t room = (limit > queued) ? limit - queued : 0;
+    size_t want = (pev->lowat_rcv < room) ? pev->lowat_rcv : room;
+    int v = want ? pipev_lowat_clamp(want) : 1;
+
+    if (v == pev->so_rcvlowat)
+        return;
+
+    if (setsockopt(pev->fd, SOL_SOCKET, SO_RCVLOWAT, &v, sizeof(v)) == 0)
+        pev->so_rcvlowat = v;
+}
+
+void pipev_lowat_write(struct pipeevent *pev)
+{
+#ifdef TCP_NOTSENT_LOWAT
+    if (!pev->lowat_notsent)
+        return;
+
+    // порог держится, пока output не опустеет: между этим не дёргаем
+    // setsockopt на каждом сбросе
+    int v = pev->so_notsent;
+    if (!ip_queued(&pev->out))
+        v = 0;
+    else if (ip_queued(&pev->out) > pev->lowat_notsent)
+        v = pipev_lowat_clamp(pev->lowat_notsent);
+
+    if (v == pev->so_notsent)
+        return;
+
+    // 0 - снова sysctl net.ipv4.tcp_notsent_lowat
+    if (setsockopt(pev->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &v,
+        sizeof(v)) == 0)
+        pev->so_notsent = v;
+#else
+    (void)pev;
+#endif
+}
+
+int pipeevent_set_lowat(struct pipeevent *pev, size_t rcvlowat,
+    size_t notsent_lowat)
+{
+    assert(pev);
+
+    if (notsent_lowat)
+    {
+#ifdef TCP_NOTSENT_LOWAT
+        // сокет должен быть TCP, проверим до того, как что-то менять
+        int cur = 0;
+        socklen_t len = sizeof(cur);
+        if (getsockopt(pev->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &cur,
+            &len) != 0)
+        {
+            if (errno == EOPNOTSUPP)
+                errno = ENOPROTOOPT;
+            return -1;
+        }
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+
+    // порог не выставлен - снимать нечего: set_lowat(pev, 0, 0) не
+    // трогает fd, и на пайпах и файлах не будет ENOTSOCK
+    int v = rcvlowat ? pipev_lowat_clamp(rcvlowat) : 1;
+    if (rcvlowat ? v != pev->so_rcvlowat : pev->so_rcvlowat != 0)
+    {
+        if (setsockopt(pev->fd, SOL_SOCKET, SO_RCVLOWAT, &v, sizeof(v)) != 0)
+            return -1;
+        pev->so_rcvlowat = rcvlowat ? v : 0;
+    }
+    pev->lowat_rcv = rcvlowat;
+    // сразу по месту, которое осталось до верхней отметки
+    if (pev->relay)
+        pipev_lowat_read(pev, pev->relay_hwm, ip_queued(&pev->relay->out));
+    else
+        pipev_check_read_wm(pev);
+
+    // снять порог записи или выставить заново по текущему output
+    if (pev->so_notsent > 0)
+    {
+#ifdef TCP_NOTSENT_LOWAT
+        int zero = 0;
+        setsockopt(pev->fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &zero,
+            sizeof(zero));
+#endif
+    }
+    pev->so_notsent = 0;
+    pev->lowat_notsent = notsent_lowat;
+    pipev_lowat_write(pev);
+    return 0;
+}
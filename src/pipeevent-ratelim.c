@@ -0,0 +1,519 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+#include "infinitypipe-int.h"
+
+#include <assert.h>
+
+// минимальная доля участника группы, как в libevent
+#define PEV_RATE_MIN_SHARE 64
+
+static ev_uint64_t pipev_rate_tick_usec(const struct pipeevent_rate_cfg *cfg)
+{
+    return (ev_uint64_t)cfg->tick.tv_sec * 1000000u +
+        (ev_uint64_t)cfg->tick.tv_usec;
+}
+
+static ev_uint64_t pipev_rate_now_usec(struct event_base *base)
+{
+    struct timeval now;
+    event_base_gettimeofday_cached(base, &now);
+    return (ev_uint64_t)now.tv_sec * 1000000u + (ev_uint64_t)now.tv_usec;
+}
+
+static ev_uint64_t pipev_rate_tick(struct event_base *base,
+    const struct pipeevent_rate_cfg *cfg)
+{
+    return pipev_rate_now_usec(base) / pipev_rate_tick_usec(cfg);
+}
+
+/* сколько осталось до начала следующего тика */
+static void pipev_rate_next_tick(struct event_base *base,
+    const struct pipeevent_rate_cfg *cfg, struct timeval *tv)
+{
+    ev_uint64_t tick = pipev_rate_tick_usec(cfg);
+    ev_uint64_t left = tick - pipev_rate_now_usec(base) % tick;
+    tv->tv_sec = (time_t)(left / 1000000u);
+    tv->tv_usec = (suseconds_t)(left % 1000000u);
+}
+
+static void pipev_rate_cfg_copy(struct pipeevent_rate_cfg *dst,
+    const struct pipeevent_rate_cfg *src)
+{
+    *dst = *src;
+
+    if (!dst->tick.tv_sec && !dst->tick.tv_usec)
+        dst->tick.tv_sec = 1;
+    if (dst->read_burst < dst->read_rate)
+        dst->read_burst = dst->read_rate;
+    if (dst->write_burst < dst->write_rate)
+        dst->write_burst = dst->write_rate;
+}
+
+static void pipev_bucket_init(struct pipeevent_rate_bucket *b,
+    struct event_base *base, const struct pipeevent_rate_cfg *cfg)
+{
+    pipev_rate_cfg_copy(&b->cfg, cfg);
+    b->read_limit = (ev_ssize_t)b->cfg.read_rate;
+    b->write_limit = (ev_ssize_t)b->cfg.write_rate;
+    b->last_tick = pipev_rate_tick(base, &b->cfg);
+}
+
+static ev_ssize_t pipev_bucket_add(ev_ssize_t limit, size_t rate,
+    size_t burst, ev_uint64_t ticks)
+{
+    // без переполнения: за много тиков ведро просто полное
+    if (ticks > (burst / rate) + 1)
+        return (ev_ssize_t)burst;
+
+    limit += (ev_ssize_t)(rate * ticks);
+    if (limit > (ev_ssize_t)burst)
+        limit = (ev_ssize_t)burst;
+
+    return limit;
+}
+
+static void pipev_bucket_refill(struct pipeevent_rate_bucket *b,
+    struct event_base *base)
+{
+    ev_uint64_t tick = pipev_rate_tick(base, &b->cfg);
+    if (tick <= b->last_tick)
+        return;
+
+    ev_uint64_t n = tick - b->last_tick;
+    b->last_tick = tick;
+
+    if (b->cfg.read_rate)
+        b->read_limit = pipev_bucket_add(b->read_limit,
+            b->cfg.read_rate, b->cfg.read_burst, n);
+    if (b->cfg.write_rate)
+        b->write_limit = pipev_bucket_add(b->write_limit,
+            b->cfg.write_rate, b->cfg.write_burst, n);
+}
+
+/* ---- индивидуальный лимит ---- */
+
+static void pipev_rate_arm_refill(struct pipeevent *pev)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (rl->refill_added)
+        return;
+
+    struct timeval tv;
+    pipev_rate_next_tick(pev->base, &rl->bucket.cfg, &tv);
+    event_add(&rl->ev_refill, &tv);
+    rl->refill_added = 1;
+}
+
+/* снять приостановку с направлений, которым лимит больше не мешает:
+   нулевая скорость - без ограничения */
+static void pipev_rate_resume(struct pipeevent *pev)
+{
+    const struct pipeevent_rate_bucket *b = &pev->rate->bucket;
+    int rd = !b->cfg.read_rate || (b->read_limit > 0);
+    int wr = !b->cfg.write_rate || (b->write_limit > 0);
+
+    if (rd)
+        pipev_unsuspend_read(pev, PEV_SUSPEND_BW);
+
+    if ((pev->read_suspended & PEV_SUSPEND_BW) ||
+        ((pev->write_suspended & PEV_SUSPEND_BW) && !wr))
+        pipev_rate_arm_refill(pev);
+
+    // может вызвать eventcb, поэтому последним
+    if (wr)
+        pipev_unsuspend_write(pev, PEV_SUSPEND_BW);
+}
+
+static void pipev_rate_on_refill(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd; (void)what;
+    struct pipeevent *pev = (struct pipeevent *)arg;
+    struct pipeevent_rate_limit *rl = pev->rate;
+
+    rl->refill_added = 0;
+    pipev_bucket_refill(&rl->bucket, pev->base);
+    pipev_rate_resume(pev);
+}
+
+int pipeevent_set_rate_limit(struct pipeevent *pev,
+    const struct pipeevent_rate_cfg *cfg)
+{
+    assert(pev);
+
+    if (!cfg)
+    {
+        if (pev->rate)
+        {
+            event_del(&pev->rate->ev_refill);
+            free(pev->rate);
+            pev->rate = NULL;
+        }
+        pipev_unsuspend_read(pev, PEV_SUSPEND_BW);
+        pipev_unsuspend_write(pev, PEV_SUSPEND_BW);
+        return 0;
+    }
+
+    if (!pev->rate)
+    {
+        struct pipeevent_rate_limit *rl =
+            (struct pipeevent_rate_limit *)calloc(1, sizeof(*rl));
+        if (!rl)
+            return -1;
+
+        evtimer_assign(&rl->ev_refill, pev->base, pipev_rate_on_refill, pev);
+        pev->rate = rl;
+    }
+
+    pipev_bucket_init(&pev->rate->bucket, pev->base, cfg);
+    // направление, приостановленное старым лимитом, иначе не проснётся
+    pipev_rate_resume(pev);
+    return 0;
+}
+
+/* ---- группа ---- */
+
+static void pipev_group_suspend(struct pipeevent_rate_group *g, short what)
+{
+    if (g->suspended & what)
+        return;
+
+    g->suspended |= what;
+    for (struct pipeevent *m = g->head; m; m = m->rg_next)
+    {
+        if (what & EV_READ)
+            pipev_suspend_read(m, PEV_SUSPEND_BW_GROUP);
+        if (what & EV_WRITE)
+            pipev_suspend_write(m, PEV_SUSPEND_BW_GROUP);
+    }
+}
+
+static void pipev_group_unsuspend(struct pipeevent_rate_group *g, short what)
+{
+    if (!(g->suspended & what))
+        return;
+
+    g->suspended &= ~what;
+
+    // участник может покинуть группу из eventcb, поэтому next берём заранее
+    struct pipeevent *m = g->head;
+    while (m)
+    {
+        struct pipeevent *next = m->rg_next;
+        if (what & EV_READ)
+            pipev_unsuspend_read(m, PEV_SUSPEND_BW_GROUP);
+        if (what & EV_WRITE)
+            pipev_unsuspend_write(m, PEV_SUSPEND_BW_GROUP);
+        m = next;
+    }
+}
+
+static void pipev_group_on_tick(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd; (void)what;
+    struct pipeevent_rate_group *g = (struct pipeevent_rate_group *)arg;
+
+    pipev_bucket_refill(&g->bucket, g->base);
+
+    if (g->bucket.read_limit > 0)
+        pipev_group_unsuspend(g, EV_READ);
+    if (g->bucket.write_limit > 0)
+        pipev_group_unsuspend(g, EV_WRITE);
+}
+
+struct pipeevent_rate_group *pipeevent_rate_group_new(struct event_base *base,
+    const struct pipeevent_rate_cfg *cfg)
+{
+    assert(base);
+
+    if (!cfg)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct pipeevent_rate_group *g =
+        (struct pipeevent_rate_group *)calloc(1, sizeof(*g));
+    if (!g)
+        return NULL;
+
+    g->base = base;
+    g->min_share = PEV_RATE_MIN_SHARE;
+    pipev_bucket_init(&g->bucket, base, cfg);
+
+    event_assign(&g->ev_tick, base, -1, EV_PERSIST, pipev_group_on_tick, g);
+    if (event_add(&g->ev_tick, &g->bucket.cfg.tick) != 0)
+    {
+        free(g);
+        return NULL;
+    }
+
+    return g;
+}
+
+int pipeevent_rate_group_set_cfg(struct pipeevent_rate_group *g,
+    const struct pipeevent_rate_cfg *cfg)
+{
+    assert(g);
+
+    if (!cfg)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pipev_bucket_init(&g->bucket, g->base, cfg);
+    event_add(&g->ev_tick, &g->bucket.cfg.tick);
+
+    pipev_group_unsuspend(g, EV_READ|EV_WRITE);
+    return 0;
+}
+
+int pipeevent_rate_group_set_min_share(struct pipeevent_rate_group *g,
+    size_t share)
+{
+    assert(g);
+
+    g->min_share = share;
+    return 0;
+}
+
+void pipeevent_rate_group_free(struct pipeevent_rate_group *g)
+{
+    if (!g)
+        return;
+
+    while (g->head)
+        pipeevent_remove_from_rate_group(g->head);
+
+    event_del(&g->ev_tick);
+    free(g);
+}
+
+int pipeevent_add_to_rate_group(struct pipeevent *pev,
+    struct pipeevent_rate_group *g)
+{
+    assert(pev);
+    assert(g);
+
+    if (pev->rate_group == g)
+        return 0;
+
+    // тик группы и события участников в одном потоке: список и ведро
+    // общие без блокировок
+    if (pev->base != g->base)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (pev->rate_group)
+        pipeevent_remove_from_rate_group(pev);
+
+    pev->rate_group = g;
+    pev->rg_prev = NULL;
+    pev->rg_next = g->head;
+    if (g->head)
+        g->head->rg_prev = pev;
+    g->head = pev;
+    g->n_members++;
+
+    if (g->suspended & EV_READ)
+        pipev_suspend_read(pev, PEV_SUSPEND_BW_GROUP);
+    if (g->suspended & EV_WRITE)
+        pipev_suspend_write(pev, PEV_SUSPEND_BW_GROUP);
+
+    return 0;
+}
+
+int pipeevent_remove_from_rate_group(struct pipeevent *pev)
+{
+    assert(pev);
+
+    struct pipeevent_rate_group *g = pev->rate_group;
+    if (!g)
+        return 0;
+
+    if (pev->rg_prev)
+        pev->rg_prev->rg_next = pev->rg_next;
+    else
+        g->head = pev->rg_next;
+    if (pev->rg_next)
+        pev->rg_next->rg_prev = pev->rg_prev;
+
+    pev->rg_next = pev->rg_prev = NULL;
+    pev->rate_group = NULL;
+    g->n_members--;
+
+    pipev_unsuspend_read(pev, PEV_SUSPEND_BW_GROUP);
+    pipev_unsuspend_write(pev, PEV_SUSPEND_BW_GROUP);
+    return 0;
+}
+
+/* ---- учёт в путях чтения/записи ---- */
+
+static size_t pipev_group_share(const struct pipeevent_rate_group *g,
+    ev_ssize_t limit)
+{
+    size_t share = (size_t)limit / (g->n_members ? g->n_members : 1);
+    return (share < g->min_share) ? g->min_share : share;
+}
+
+size_t pipev_rate_read_max(struct pipeevent *pev, size_t want)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (rl && rl->bucket.cfg.read_rate)
+    {
+        pipev_bucket_refill(&rl->bucket, pev->base);
+        if (rl->bucket.read_limit <= 0)
+        {
+            pipev_suspend_read(pev, PEV_SUSPEND_BW);
+            pipev_rate_arm_refill(pev);
+            return 0;
+        }
+        if (want > (size_t)rl->bucket.read_limit)
+            want = (size_t)rl->bucket.read_limit;
+    }
+
+    struct pipeevent_rate_group *g = pev->rate_group;
+    if (g && g->bucket.cfg.read_rate)
+    {
+        pipev_bucket_refill(&g->bucket, g->base);
+        if (g->bucket.read_limit <= 0)
+        {
+            pipev_group_suspend(g, EV_READ);
+            // тик группы будит участников по очереди: первый может
+            // выбрать ведро, пока остальные ещё не сняты с паузы
+            pipev_suspend_read(pev, PEV_SUSPEND_BW_GROUP);
+            return 0;
+        }
+        size_t share = pipev_group_share(g, g->bucket.read_limit);
+        if (want > share)
+            want = share;
+    }
+
+    return want;
+}
+
+size_t pipev_rate_write_max(struct pipeevent *pev, size_t want)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (rl && rl->bucket.cfg.write_rate)
+    {
+        pipev_bucket_refill(&rl->bucket, pev->base);
+        if (rl->bucket.write_limit <= 0)
+        {
+            pipev_suspend_write(pev, PEV_SUSPEND_BW);
+            pipev_rate_arm_refill(pev);
+            return 0;
+        }
+        if (want > (size_t)rl->bucket.write_limit)
+            want = (size_t)rl->bucket.write_limit;
+    }
+
+    struct pipeevent_rate_group *g = pev->rate_group;
+    if (g && g->bucket.cfg.write_rate)
+    {
+        pipev_bucket_refill(&g->bucket, g->base);
+        if (g->bucket.write_limit <= 0)
+        {
+            pipev_group_suspend(g, EV_WRITE);
+            // тик группы будит участников по очереди: первый может
+            // выбрать ведро, пока остальные ещё не сняты с паузы
+            pipev_suspend_write(pev, PEV_SUSPEND_BW_GROUP);
+            return 0;
+        }
+        size_t share = pipev_group_share(g, g->bucket.write_limit);
+        if (want > share)
+            want = share;
+    }
+
+    return want;
+}
+
+void pipev_rate_read_done(struct pipeevent *pev, size_t n)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (rl && rl->bucket.cfg.read_rate)
+    {
+        rl->bucket.read_limit -= (ev_ssize_t)n;
+        if (rl->bucket.read_limit <= 0)
+        {
+            pipev_suspend_read(pev, PEV_SUSPEND_BW);
+            pipev_rate_arm_refill(pev);
+        }
+    }
+
+    struct pipeevent_rate_group *g = pev->rate_group;
+    if (g && g->bucket.cfg.read_rate)
+    {
+        g->bucket.read_limit -= (ev_ssize_t)n;
+        if (g->bucket.read_limit <= 0)
+        {
+            pipev_group_suspend(g, EV_READ);
+            pipev_suspend_read(pev, PEV_SUSPEND_BW_GROUP);
+        }
+    }
+}
+
+void pipev_rate_write_done(struct pipeevent *pev, size_t n)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (rl && rl->bucket.cfg.write_rate)
+    {
+        rl->bucket.write_limit -= (ev_ssize_t)n;
+        if (rl->bucket.write_limit <= 0)
+        {
+            pipev_suspend_write(pev, PEV_SUSPEND_BW);
+            pipev_rate_arm_refill(pev);
+        }
+    }
+
+    struct pipeevent_rate_group *g = pev->rate_group;
+    if (g && g->bucket.cfg.write_rate)
+    {
+        g->bucket.write_limit -= (ev_ssize_t)n;
+        if (g->bucket.write_limit <= 0)
+        {
+            pipev_group_suspend(g, EV_WRITE);
+            pipev_suspend_write(pev, PEV_SUSPEND_BW_GROUP);
+        }
+    }
+}
+
+void pipev_rate_free(struct pipeevent *pev)
+{
+    pipeevent_remove_from_rate_group(pev);
+
+    if (pev->rate)
+    {
+        event_del(&pev->rate->ev_refill);
+        free(pev->rate);
+        pev->rate = NULL;
+    }
+}
+
+void pipev_rate_detach(struct pipeevent *pev)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (!rl)
+        return;
+
+    // refill_added остаётся: таймер перезапустится на новом event_base
+    if (rl->refill_added)
+        event_del(&rl->ev_refill);
+}
+
+void pipev_rate_attach(struct pipeevent *pev)
+{
+    struct pipeevent_rate_limit *rl = pev->rate;
+    if (!rl)
+        return;
+
+    evtimer_assign(&rl->ev_refill, pev->base, pipev_rate_on_refill, pev);
+    if (rl->refill_added)
+    {
+        rl->refill_added = 0;
+        pipev_rate_arm_refill(pev);
+    }
+}
@@ -0,0 +1,318 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+
+#include <assert.h>
+
+// планировщики event_base этого потока, base обслуживается одним потоком
+static _Thread_local struct pipeevent_sched *scheds;
+
+// доля класса за обслуживание в квантах
+static const unsigned pipev_sched_weight[PEV_SCHED_CLASSES] = { 4, 2, 1 };
+
+static void pipev_sched_on_run(evutil_socket_t fd, short what, void *arg);
+
+static struct pipeevent_sched *pipev_sched_get(struct event_base *base)
+{
+    for (struct pipeevent_sched *sc = scheds; sc; sc = sc->next)
+    {
+        if (sc->base == base)
+        {
+            ++sc->refcnt;
+            return sc;
+        }
+    }
+
+    struct pipeevent_sched *sc =
+        (struct pipeevent_sched *)calloc(1, sizeof(*sc));
+    if (!sc)
+        return NULL;
+
+    sc->base = base;
+    sc->refcnt = 1;
+    evtimer_assign(&sc->ev_run, base, pipev_sched_on_run, sc);
+
+    sc->next = scheds;
+    scheds = sc;
+    return sc;
+}
+
+static void pipev_sched_unref(struct pipeevent_sched *sc)
+{
+    if (--sc->refcnt)
+        return;
+
+    if (sc->run_added)
+        evtimer_del(&sc->ev_run);
+
+    for (struct pipeevent_sched **ps = &scheds; *ps; ps = &(*ps)->next)
+    {
+        if (*ps == sc)
+        {
+            *ps = sc->next;
+            break;
+        }
+    }
+
+    free(sc);
+}
+
+/* новый квант направления: доля класса, но не больше max_calls splice */
+static void pipev_sched_refill(struct pipeevent_sched_node *n)
+{
+    struct pipeevent *pev = n->pev;
+    const struct pipeevent_sched_cfg *cfg = &pev->sched_cfg;
+
+    // чтение relay идёт в output пира
+    const struct infinitypipe *ip = &pev->out;
+    if (n->what == EV_READ)
+        ip = pev->relay ? &pev->relay->out : &pev->in;
+
+    size_t q = cfg->quantum * pipev_sched_weight[cfg->cls];
+    size_t calls = (size_t)cfg->max_calls * ip->seg_capacity;
+    n->left = (calls && calls < q) ? calls : q;
+}
+
+static void pipev_sched_push(struct pipeevent_sched *sc,
+    struct pipeevent_sched_node *n)
+{
+    int c = n->pev->sched_cfg.cls;
+
+    n->queued = 1;
+    n->pass = sc->pass;
+    n->next = NULL;
+    n->prev = sc->tail[c];
+    if (sc->tail[c])
+        sc->tail[c]->next = n;
+    else
+        sc->head[c] = n;
+    sc->tail[c] = n;
+
+    // проход после опроса fd: сначала обслуживаются остальные готовые
+    if (!sc->run_added)
+    {
+        struct timeval now = {0, 0};
+        evtimer_add(&sc->ev_run, &now);
+        sc->run_added = 1;
+    }
+}
+
+static void pipev_sched_unlink(struct pipeevent_sched *sc,
+    struct pipeevent_sched_node *n)
+{
+    if (!n->queued)
+        return;
+
+    int c = n->pev->sched_cfg.cls;
+    if (n->prev)
+        n->prev->next = n->next;
+    else
+        sc->head[c] = n->next;
+    if (n->next)
+        n->next->prev = n->prev;
+    else
+        sc->tail[c] = n->prev;
+
+    n->next = n->prev = NULL;
+    n->queued = 0;
+}
+
+/* квант исчерпан: направление ждёт прохода очереди */
+static void pipev_sched_yield(struct pipeevent_sched_node *n)
+{
+    struct pipeevent *pev = n->pev;
+
+    // flush, вложенный через notify output, уже поставил направление
+    if (n->queued)
+        return;
+
+    if (n->what == EV_READ)
+        pipev_suspend_read(pev, PEV_SUSPEND_SCHED);
+    else
+        pipev_suspend_write(pev, PEV_SUSPEND_SCHED);
+
+    pipev_sched_push(pev->sched, n);
+}
+
+static void pipev_sched_done(struct pipeevent_sched_node *n, ssize_t done,
+    size_t want)
+{
+    // сделали меньше, чем просили: fd ушёл в простой, очередь не нужна
+    if (done <= 0 || (size_t)done < want)
+    {
+        pipev_sched_refill(n);
+        return;
+    }
+
+    n->left -= ((size_t)done < n->left) ? (size_t)done : n->left;
+    if (!n->left)
+        pipev_sched_yield(n);
+}
+
+/* обслужить направление из очереди, может освободить pev */
+static void pipev_sched_dispatch(struct pipeevent_sched_node *n)
+{
+    struct pipeevent *pev = n->pev;
+    pipev_sched_refill(n);
+
+    if (n->what == EV_WRITE)
+    {
+        pipev_unsuspend_write(pev, PEV_SUSPEND_SCHED);
+        return;
+    }
+
+    pipev_unsuspend_read(pev, PEV_SUSPEND_SCHED);
+    // fd level-triggered и наверняка ещё готов: читаем сейчас, в порядке
+    // класса; io_uring уже разбудил чтение в pipev_unsuspend_read
+    if (!pev->uring && (pev->enabled & EV_READ) && !pev->read_suspended)
+        pipev_on_readable(pev->fd, EV_READ, pev);
+}
+
+static void pipev_sched_on_run(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd; (void)what;
+    struct pipeevent_sched *sc = (struct pipeevent_sched *)arg;
+    sc->run_added = 0;
+
+    // callbacks могут освободить участников, а с ними и планировщик
+    ++sc->refcnt;
+
+    // вставшие в очередь во время прохода ждут следующего
+    ev_uint64_t pass = ++sc->pass;
+    for (int c = 0; c < PEV_SCHED_CLASSES; ++c)
+    {
+        struct pipeevent_sched_node *n;
+        while ((n = sc->head[c]) && n->pass < pass)
+        {
+            pipev_sched_unlink(sc, n);
+            pipev_sched_dispatch(n);
+        }
+    }
+
+    pipev_sched_unref(sc);
+}
+
+void pipeevent_sched_cfg_init(struct pipeevent_sched_cfg *cfg)
+{
+    assert(cfg);
+
+    cfg->cls = PEV_SCHED_NORMAL;
+    cfg->quantum = PIPEEVENT_SCHED_QUANTUM;
+    cfg->max_calls = PIPEEVENT_SCHED_CALLS;
+}
+
+int pipeevent_set_sched(struct pipeevent *pev,
+    const struct pipeevent_sched_cfg *cfg)
+{
+    assert(pev);
+
+    if (cfg && (unsigned)cfg->cls >= PEV_SCHED_CLASSES)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // своя ссылка и при смене настроек: pipev_sched_free ниже может
+    // отпустить последнюю ссылку pev на тот же планировщик
+    struct pipeevent_sched *sc = NULL;
+    if (cfg)
+    {
+        sc = pipev_sched_get(pev->base);
+        if (!sc)
+            return -1;
+    }
+
+    // из очереди по старому классу; кванты начинаются заново
+    pipev_sched_free(pev);
+
+    if (!cfg)
+    {
+        pev->sched_cfg.quantum = 0;
+    }
+    else
+    {
+        pev->sched = sc;
+        pev->sched_cfg = *cfg;
+        if (!pev->sched_cfg.quantum)
+            pev->sched_cfg.quantum = PIPEEVENT_SCHED_QUANTUM;
+        if (!pev->sched_cfg.max_calls)
+            pev->sched_cfg.max_calls = PIPEEVENT_SCHED_CALLS;
+
+        pev->sc_rd.pev = pev->sc_wr.pev = pev;
+        pev->sc_rd.what = EV_READ;
+        pev->sc_wr.what = EV_WRITE;
+        pipev_sched_refill(&pev->sc_rd);
+        pipev_sched_refill(&pev->sc_wr);
+    }
+
+    pipev_unsuspend_read(pev, PEV_SUSPEND_SCHED);
+    // может вызвать eventcb, поэтому последним
+    pipev_unsuspend_write(pev, PEV_SUSPEND_SCHED);
+    return 0;
+}
+
+size_t pipev_sched_read_max(struct pipeevent *pev, size_t want)
+{
+    if (!pev->sched || want <= pev->sc_rd.left)
+        return want;
+    return pev->sc_rd.left;
+}
+
+size_t pipev_sched_write_max(struct pipeevent *pev, size_t want)
+{
+    if (!pev->sched || want <= pev->sc_wr.left)
+        return want;
+    return pev->sc_wr.left;
+}
+
+void pipev_sched_read_done(struct pipeevent *pev, ssize_t n, size_t want)
+{
+    if (pev->sched)
+        pipev_sched_done(&pev->sc_rd, n, want);
+}
+
+void pipev_sched_write_done(struct pipeevent *pev, ssize_t n, size_t want)
+{
+    if (pev->sched)
+        pipev_sched_done(&pev->sc_wr, n, want);
+}
+
+void pipev_sched_free(struct pipeevent *pev)
+{
+    struct pipeevent_sched *sc = pev->sched;
+    if (!sc)
+        return;
+
+    pipev_sched_unlink(sc, &pev->sc_rd);
+    pipev_sched_unlink(sc, &pev->sc_wr);
+    pev->sched = NULL;
+    pipev_sched_unref(sc);
+}
+
+void pipev_sched_detach(struct pipeevent *pev)
+{
+    if (!pev->sched)
+        return;
+
+    pipev_sched_free(pev);
+
+    // события уже сняты: на новом event_base чтение встанет само, а
+    // запись продолжится по готовности fd
+    pev->read_suspended &= ~PEV_SUSPEND_SCHED;
+    if (pev->write_suspended & PEV_SUSPEND_SCHED)
+    {
+        pev->write_suspended &= ~PEV_SUSPEND_SCHED;
+        if (!pev->write_suspended)
+            pev->ev_write_added = 1;
+    }
+
+    pipev_sched_refill(&pev->sc_rd);
+    pipev_sched_refill(&pev->sc_wr);
+}
+
+void pipev_sched_attach(struct pipeevent *pev)
+{
+    // планировщика нового event_base может не выйти - тогда без кванта
+    if (pev->sched_cfg.quantum)
+        pev->sched = pipev_sched_get(pev->base);
+}
@@ -0,0 +1,98 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+
+#include <inttypes.h>
+#include <assert.h>
+
+#ifdef E4PIPE_WITH_COUNTERS
+struct pipev_counters pipev_global;
+
+static void pipev_io_add(struct infinitypipe_counters *dst,
+    const struct infinitypipe_counters *src)
+{
+    dst->bytes_in += src->bytes_in;
+    dst->bytes_out += src->bytes_out;
+    dst->n_splice += src->n_splice;
+    dst->n_eagain += src->n_eagain;
+    dst->n_partial += src->n_partial;
+    dst->segs_created += src->segs_created;
+    dst->segs_freed += src->segs_freed;
+    dst->segs_live += src->segs_live;
+    dst->cap_held += src->cap_held;
+}
+#endif
+
+int pipeevent_get_counters(struct pipeevent *pev,
+    struct pipeevent_counters *c)
+{
+    assert(pev);
+    assert(c);
+
+    memset(c, 0, sizeof(*c));
+#ifndef E4PIPE_WITH_COUNTERS
+    errno = ENOSYS;
+    return -1;
+#else
+    struct infinitypipe_counters io;
+    infinitypipe_get_counters(&pev->in, &io);
+    pipev_io_add(&c->io, &io);
+    infinitypipe_get_counters(&pev->out, &io);
+    pipev_io_add(&c->io, &io);
+
+    c->n_deferred = pev->cnt_deferred;
+    c->n_callbacks = pev->cnt_callbacks;
+    c->cb_ns = pev->cnt_cb_ns;
+    return 0;
+#endif
+}
+
+int pipeevent_get_global_counters(struct pipeevent_counters *c)
+{
+    assert(c);
+
+    memset(c, 0, sizeof(*c));
+#ifndef E4PIPE_WITH_COUNTERS
+    errno = ENOSYS;
+    return -1;
+#else
+    infinitypipe_get_global_counters(&c->io);
+
+    c->n_deferred = atomic_load_explicit(&pipev_global.deferred,
+        memory_order_relaxed);
+    c->n_callbacks = atomic_load_explicit(&pipev_global.callbacks,
+        memory_order_relaxed);
+    c->cb_ns = atomic_load_explicit(&pipev_global.cb_ns,
+        memory_order_relaxed);
+    return 0;
+#endif
+}
+
+int pipeevent_counters_dump(FILE *out)
+{
+    assert(out);
+
+    struct pipeevent_counters c;
+    if (pipeevent_get_global_counters(&c) != 0)
+        return -1;
+
+    int rc = fprintf(out,
+        "bytes_in %" PRIu64 "\n"
+        "bytes_out %" PRIu64 "\n"
+        "splice %" PRIu64 "\n"
+        "splice_eagain %" PRIu64 "\n"
+        "splice_partial %" PRIu64 "\n"
+        "segs_created %" PRIu64 "\n"
+        "segs_freed %" PRIu64 "\n"
+        "segs_live %" PRIu64 "\n"
+        "cap_held %" PRIu64 "\n"
+        "deferred %" PRIu64 "\n"
+        "callbacks %" PRIu64 "\n"
+        "callback_ns %" PRIu64 "\n",
+        c.io.bytes_in, c.io.bytes_out, c.io.n_splice, c.io.n_eagain,
+        c.io.n_partial, c.io.segs_created, c.io.segs_freed,
+        c.io.segs_live, c.io.cap_held,
+        c.n_deferred, c.n_callbacks, c.cb_ns);
+
+    return (rc < 0) ? -1 : 0;
+}
@@ -0,0 +1,590 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+#include "infinitypipe-int.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <limits.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/ioctl.h>
+
+struct pipeevent_tap {
+    struct pipeevent_tap_cfg cfg;
+    // staging: stage[1] - tee из цикла, stage[0] - поток записи
+    int stage[2];
+    size_t stage_sz;
+    // EV_READ: прочитанное из fd, пока оно не ушло в staging и в буфер;
+    // tee копирует с головы пайпа, поэтому новые байты читаются сюда,
+    // а не в хвост буфера, где перед ними лежат старые
+    struct infinityseg *land;
+    // EV_READ: байт в голове land, которые уже в staging или пропущены,
+    // их можно отдавать дальше
+    size_t ready;
+    // EV_WRITE: то же для головы output, но в счёте out.drained: его
+    // двигают и отправка (в том числе из flush, вложенного через notify),
+    // и вычитка мимо tap (remove, drain, move); голова другая - перед
+    // ней вставили новое (prepend)
+    const struct infinityseg *head;
+    uint64_t copied_to;
+    uint64_t captured;
+    uint64_t dropped;
+    // поток записи в файлы
+    pthread_t thread;
+    int started;
+    atomic_uint_fast64_t written;
+    atomic_uint files;
+    atomic_int error;
+};
+
+void pipeevent_tap_cfg_init(struct pipeevent_tap_cfg *cfg)
+{
+    assert(cfg);
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->max_lag = PIPEEVENT_TAP_LAG;
+    cfg->policy = PEV_TAP_DROP;
+}
+
+static struct pipeevent_tap **pipev_tap_slot(struct pipeevent *pev,
+    short what)
+{
+    if (what == EV_READ)
+        return &pev->tap_rd;
+    if (what == EV_WRITE)
+        return &pev->tap_wr;
+    return NULL;
+}
+
+static void pipev_tap_release(struct pipeevent_tap *t)
+{
+    if (t->stage[0] >= 0)
+        close(t->stage[0]);
+
+    free((char *)t->cfg.path);
+    free(t);
+}
+
+static void pipev_tap_destroy(struct pipeevent *pev, struct pipeevent_tap *t)
+{
+    // land берётся из пула input и в его счётчиках
+    if (t->land)
+        ip_seg_drop(&pev->in, t->land);
+    t->land = NULL;
+
+    // EOF в staging: поток допишет остаток, освободит tap и выйдет,
+    // медленный диск не держит цикл событий; после close t уже его
+    if (t->started)
+    {
+        pthread_t thread = t->thread;
+        close(t->stage[1]);
+        pthread_detach(thread);
+        return;
+    }
+
+    if (t->stage[1] >= 0)
+        close(t->stage[1]);
+
+    pipev_tap_release(t);
+}
+
+void pipev_tap_free(struct pipeevent *pev)
+{
+    if (pev->tap_rd)
+        pipev_tap_destroy(pev, pev->tap_rd);
+    if (pev->tap_wr)
+        pipev_tap_destroy(pev, pev->tap_wr);
+
+    pev->tap_rd = pev->tap_wr = NULL;
+}
+
+#ifdef __linux__
+static int64_t pipev_tap_now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int pipev_tap_open(const struct pipeevent_tap *t, unsigned seq)
+{
+    char name[PATH_MAX];
+    int n = snprintf(name, sizeof(name), "%s.%06u", t->cfg.path, seq);
+    if (n < 0 || (size_t)n >= sizeof(name))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return open(name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+}
+
+/* поток записи: staging -> файл через splice, файл меняется по размеру
+   и по времени; медленный диск задерживает только этот поток */
+static void *pipev_tap_writer(void *arg)
+{
+    struct pipeevent_tap *t = (struct pipeevent_tap *)arg;
+    int fd = -1;
+    unsigned seq = 0;
+    size_t in_file = 0;
+    int64_t rotate_at = 0;
+    int err = 0;
+
+    for (;;)
+    {
+        int timeout = -1;
+        if (fd >= 0 && t->cfg.rotate_sec)
+        {
+            int64_t left = rotate_at - pipev_tap_now_ms();
+            if (left <= 0)
+            {
+                close(fd);
+                fd = -1;
+                continue;
+            }
+            timeout = (left > INT_MAX) ? INT_MAX : (int)left;
+        }
+
+        struct pollfd pfd = { t->stage[0], POLLIN, 0 };
+        int rc = poll(&pfd, 1, timeout);
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            err = errno;
+            break;
+        }
+        // истёк срок файла
+        if (rc == 0)
+            continue;
+        // staging закрыт и пуст
+        if (!(pfd.revents & POLLIN))
+            break;
+
+        if (fd < 0)
+        {
+            fd = pipev_tap_open(t, seq++);
+            if (fd < 0)
+            {
+                err = errno;
+                break;
+            }
+            atomic_fetch_add_explicit(&t->files, 1, memory_order_relaxed);
+            in_file = 0;
+            rotate_at = pipev_tap_now_ms() + (int64_t)t->cfg.rotate_sec * 1000;
+        }
+
+        size_t want = t->stage_sz;
+        if (t->cfg.rotate_bytes && want > t->cfg.rotate_bytes - in_file)
+            want = t->cfg.rotate_bytes - in_file;
+
+        ssize_t n = splice(t->stage[0], NULL, fd, NULL, want,
+            SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (n > 0)
+        {
+            in_file += (size_t)n;
+            atomic_fetch_add_explicit(&t->written, (uint_fast64_t)n,
+                memory_order_relaxed);
+            if (t->cfg.rotate_bytes && in_file >= t->cfg.rotate_bytes)
+            {
+                close(fd);
+                fd = -1;
+            }
+            continue;
+        }
+        if (n == 0)
+            break;
+        if (errno == EINTR || errno == EAGAIN)
+            continue;
+        err = errno;
+        break;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    if (err)
+        atomic_store_explicit(&t->error, err, memory_order_relaxed);
+
+    // после ошибки цикл может ещё писать в staging: ждём его EOF
+    while (err)
+    {
+        char buf[4096];
+        struct pollfd pfd = { t->stage[0], POLLIN, 0 };
+        if (poll(&pfd, 1, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (!(pfd.revents & POLLIN))
+            break;
+        ssize_t n = read(t->stage[0], buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+            break;
+    }
+
+    // tap снят с pipeevent: staging закрыт со стороны цикла
+    pipev_tap_release(t);
+    return NULL;
+}
+
+/* повторить по таймеру бюджета, пока staging не освободится */
+static void pipev_tap_wait(struct pipeevent *pev)
+{
+    struct timeval tv = { 0, PIPEEVENT_TAP_RETRY_MS * 1000 };
+    evtimer_add(&pev->ev_budget, &tv);
+}
+
+/* копия головы s в staging; вернёт, сколько байт головы можно отдавать
+   дальше, 0 - ждать записи в файлы (PEV_TAP_BACKPRESSURE) */
+static size_t pipev_tap_capture(struct pipeevent *pev,
+    struct pipeevent_tap *t, struct infinityseg *s, short what)
+{
+    if (!atomic_load_explicit(&t->error, memory_order_relaxed))
+    {
+        ssize_t rc;
+        do
+        {
+            rc = tee(s->p[0], t->stage[1], s->len, SPLICE_F_NONBLOCK);
+        } while (rc < 0 && errno == EINTR);
+
+        if (rc > 0)
+        {
+            t->captured += (uint64_t)rc;
+            return (size_t)rc;
+        }
+
+        if (rc < 0 && errno != EAGAIN)
+        {
+            atomic_store_explicit(&t->error, errno, memory_order_relaxed);
+        }
+        else if (t->cfg.policy == PEV_TAP_BACKPRESSURE)
+        {
+            if (what == EV_READ)
+                pipev_suspend_read(pev, PEV_SUSPEND_TAP);
+            else
+                pipev_suspend_write(pev, PEV_SUSPEND_TAP);
+            pipev_tap_wait(pev);
+            return 0;
+        }
+    }
+
+    t->dropped += s->len;
+    return s->len;
+}
+
+/* перелить в ip то, что из land уже скопировано */
+static ssize_t pipev_tap_deliver(struct pipeevent *pev,
+    struct pipeevent_tap *t, struct infinitypipe *ip)
+{
+    struct infinityseg *s = t->land;
+    size_t total = 0;
+
+    while (s->len)
+    {
+        if (!t->ready)
+        {
+            t->ready = pipev_tap_capture(pev, t, s, EV_READ);
+            if (!t->ready)
+                break;
+        }
+
+        // pipe -> pipe, в хвост буфера или в его файл вытеснения
+        ssize_t n = infinitypipe_splice_in(ip, s->p[0], t->ready);
+        if (n <= 0)
+            break;
+
+        s->len -= (size_t)n;
+        t->ready -= (size_t)n;
+        total += (size_t)n;
+    }
+
+    // буфер не взял прочитанное (бюджет, буферы пайпа), а fd может
+    // больше не стать готовым - доставим по таймеру
+    if (s->len && !(pev->read_suspended & PEV_SUSPEND_TAP))
+        pipev_tap_wait(pev);
+
+    if (total)
+        return (ssize_t)total;
+
+    errno = EAGAIN;
+    return -1;
+}
+
+ssize_t pipev_tap_splice_in(struct pipeevent *pev, struct infinitypipe *ip,
+    size_t want)
+{
+    struct pipeevent_tap *t = pev->tap_rd;
+    if (!t)
+        return infinitypipe_splice_in(ip, pev->fd, want);
+
+    // сначала прочитанное раньше, иначе нарушится порядок байт
+    struct infinityseg *s = t->land;
+    if (s->len)
+        return pipev_tap_deliver(pev, t, ip);
+
+    if (want > s->cap)
+        want = s->cap;
+
+    ssize_t rc;
+    do
+    {
+        rc = splice(pev->fd, NULL, s->p[1], NULL, want,
+            SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc <= 0)
+        return rc;
+
+    s->len = (size_t)rc;
+    return pipev_tap_deliver(pev, t, ip);
+}
+
+ssize_t pipev_tap_splice_out(struct pipeevent *pev, size_t want)
+{
+    struct pipeevent_tap *t = pev->tap_wr;
+    struct infinitypipe *out = &pev->out;
+    if (!t)
+        return infinitypipe_splice_out(out, pev->fd, want);
+
+    size_t ready = 0;
+    if (t->copied_to > out->drained && out->head == t->head)
+        ready = (size_t)(t->copied_to - out->drained);
+
+    // tee видит только голову сегмента: отправляем не больше того,
+    // что уже скопировано, тогда голова всегда - первый новый байт
+    if (!ready)
+    {
+        out->seg_denied = 0;
+        if (!out->head && out->spill_len)
+        {
+            size_t n = ip_spill_fill(out);
+            if (n)
+                ip_note_change(out, n, 0);
+        }
+        if (!out->head)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+
+        ready = pipev_tap_capture(pev, t, out->head, EV_WRITE);
+        if (!ready)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        t->head = out->head;
+        t->copied_to = out->drained + ready;
+    }
+
+    if (want > ready)
+        want = ready;
+
+    return infinitypipe_splice_out(out, pev->fd, want);
+}
+
+void pipev_tap_retry(struct pipeevent *pev)
+{
+    if (pev->tap_wr)
+        pipev_unsuspend_write(pev, PEV_SUSPEND_TAP);
+
+    struct pipeevent_tap *t = pev->tap_rd;
+    if (!t)
+        return;
+
+    pipev_unsuspend_read(pev, PEV_SUSPEND_TAP);
+
+    // прочитанное ждёт в land: доставит обычный путь чтения
+    if (t->land->len && (pev->enabled & EV_READ) && !pev->read_suspended)
+        event_active(&pev->ev_read, EV_READ, 1);
+}
+#else
+ssize_t pipev_tap_splice_in(struct pipeevent *pev, struct infinitypipe *ip,
+    size_t want)
+{
+    return infinitypipe_splice_in(ip, pev->fd, want);
+}
+
+ssize_t pipev_tap_splice_out(struct pipeevent *pev, size_t want)
+{
+    return infinitypipe_splice_out(&pev->out, pev->fd, want);
+}
+
+void pipev_tap_retry(struct pipeevent *pev)
+{
+    (void)pev;
+}
+#endif
+
+int pipeevent_tap_attach(struct pipeevent *pev, short what,
+    const struct pipeevent_tap_cfg *cfg)
+{
+#ifndef __linux__
+    (void)pev;
+    (void)what;
+    (void)cfg;
+    errno = ENOSYS;
+    return -1;
+#else
+    assert(pev);
+    assert(cfg);
+
+    struct pipeevent_tap **slot = pipev_tap_slot(pev, what);
+    if (!slot || !cfg->path)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // операция в ядре io_uring пишет мимо tap
+    if (*slot || (what == EV_READ ? pev->ur_rd.busy : pev->ur_wr.busy))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    struct pipeevent_tap *t =
+        (struct pipeevent_tap *)calloc(1, sizeof(*t));
+    if (!t)
+        return -1;
+
+    int err;
+    t->cfg = *cfg;
+    t->stage[0] = t->stage[1] = -1;
+    t->cfg.path = strdup(cfg->path);
+    if (!t->cfg.path || pipe2(t->stage, O_NONBLOCK|O_CLOEXEC) != 0)
+        goto fail;
+
+    size_t lag = cfg->max_lag ? cfg->max_lag : PIPEEVENT_TAP_LAG;
+    if (lag > INT_MAX)
+        lag = INT_MAX;
+    // выше pipe-max-size ядро откажет - останется ёмкость по умолчанию
+    fcntl(t->stage[1], F_SETPIPE_SZ, (int)lag);
+    int sz = fcntl(t->stage[1], F_GETPIPE_SZ);
+    t->stage_sz = (sz > 0) ? (size_t)sz : lag;
+
+    if (what == EV_READ)
+    {
+        t->land = ip_seg_new(&pev->in);
+        if (!t->land)
+            goto fail;
+    }
+
+    err = pthread_create(&t->thread, NULL, pipev_tap_writer, t);
+    if (err)
+    {
+        errno = err;
+        goto fail;
+    }
+    t->started = 1;
+
+    *slot = t;
+    return 0;
+
+fail:
+    err = errno;
+    pipev_tap_destroy(pev, t);
+    errno = err;
+    return -1;
+#endif
+}
+
+int pipeevent_tap_detach(struct pipeevent *pev, short what)
+{
+    assert(pev);
+
+    struct pipeevent_tap **slot = pipev_tap_slot(pev, what);
+    if (!slot)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct pipeevent_tap *t = *slot;
+    if (!t)
+        return 0;
+
+    // прочитанное, но не отданное, уходит в буфер без записи в файл
+    struct infinityseg *s = t->land;
+    if (s && s->len)
+    {
+        struct infinitypipe *ip = pev->relay ? &pev->relay->out : &pev->in;
+        size_t moved = 0;
+        if (ip->spill_len)
+        {
+            // за вытесненными данными - только в файл, иначе остаток
+            // обгонит их
+            ssize_t n = ip_spill_put(ip, s->p[0], s->len);
+            if (n > 0)
+            {
+                s->len -= (size_t)n;
+                moved = (size_t)n;
+            }
+        }
+        else
+        {
+            moved = s->len;
+            ip_seg_add(ip, s);
+            ip_inc_total_len(ip, moved);
+            t->land = NULL;
+        }
+
+        if (moved)
+            ip_note_change(ip, moved, 0);
+
+        // файл не взял остаток: tap остаётся, land доставит чтение
+        if (t->land && s->len)
+        {
+            if (!errno)
+                errno = EIO;
+            return -1;
+        }
+    }
+
+    *slot = NULL;
+    pipev_tap_destroy(pev, t);
+
+    if (what == EV_READ)
+        pipev_unsuspend_read(pev, PEV_SUSPEND_TAP);
+    else
+        pipev_unsuspend_write(pev, PEV_SUSPEND_TAP);
+    return 0;
+}
+
+int pipeevent_tap_get_stat(struct pipeevent *pev, short what,
+    struct pipeevent_tap_stat *st)
+{
+    assert(pev);
+    assert(st);
+
+    memset(st, 0, sizeof(*st));
+
+    struct pipeevent_tap **slot = pipev_tap_slot(pev, what);
+    if (!slot)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const struct pipeevent_tap *t = *slot;
+    if (!t)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    st->captured = t->captured;
+    st->dropped = t->dropped;
+    st->written = atomic_load_explicit(&t->written, memory_order_relaxed);
+    st->files = atomic_load_explicit(&t->files, memory_order_relaxed);
+    st->error = atomic_load_explicit(&t->error, memory_order_relaxed);
+
+    int n = 0;
+    if (ioctl(t->stage[0], FIONREAD, &n) == 0 && n > 0)
+        st->lag = (size_t)n;
+    return 0;
+}
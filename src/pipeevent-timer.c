@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+
+#include <time.h>
+#include <assert.h>
+
+// колёса event_base этого потока, base обслуживается одним потоком
+static _Thread_local struct pipeevent_wheel *wheels;
+
+static ev_uint64_t pipev_wheel_ticks(const struct timeval *tv)
+{
+    ev_uint64_t ms = (ev_uint64_t)tv->tv_sec * 1000u +
+        (ev_uint64_t)tv->tv_usec / 1000u;
+    // округляем вверх: тайм-аут не должен сработать раньше срока
+    ev_uint64_t t = (ms + PIPEEVENT_WHEEL_TICK_MS - 1) / PIPEEVENT_WHEEL_TICK_MS;
+    return t ? t : 1;
+}
+
+static void pipev_timer_unlink(struct pipeevent_timer *tm)
+{
+    if (!tm->list)
+        return;
+
+    if (tm->prev)
+        tm->prev->next = tm->next;
+    else
+        *tm->list = tm->next;
+    if (tm->next)
+        tm->next->prev = tm->prev;
+
+    tm->next = tm->prev = NULL;
+    tm->list = NULL;
+}
+
+static void pipev_timer_push(struct pipeevent_timer **list,
+    struct pipeevent_timer *tm)
+{
+    tm->list = list;
+    tm->prev = NULL;
+    tm->next = *list;
+    if (*list)
+        (*list)->prev = tm;
+    *list = tm;
+}
+
+/* срок таймера: last - тик, внутри которого была активность, поэтому
+   полный тайм-аут гарантирован только с тика last + timeout + 1 */
+static inline ev_uint64_t pipev_timer_expiry(const struct pipeevent_timer *tm)
+{
+    return tm->last + tm->timeout + 1;
+}
+
+/* положить таймер в слот по сроку */
+static void pipev_wheel_insert(struct pipeevent_wheel *w,
+    struct pipeevent_timer *tm)
+{
+    ev_uint64_t exp = pipev_timer_expiry(tm);
+    if (exp <= w->cur)
+        exp = w->cur + 1;
+
+    ev_uint64_t delta = exp - w->cur;
+    int level = 0;
+    while (level < PEV_WHEEL_LEVELS - 1 &&
+        delta >= ((ev_uint64_t)1 << (PEV_WHEEL_BITS * (level + 1))))
+        ++level;
+
+    // дальше последнего уровня - встанем в его край и перепроверим там
+    ev_uint64_t span = (ev_uint64_t)1 << (PEV_WHEEL_BITS * PEV_WHEEL_LEVELS);
+    if (delta >= span)
+        exp = w->cur + span - 1;
+
+    size_t slot = (size_t)(exp >> (PEV_WHEEL_BITS * level)) &
+        (PEV_WHEEL_SLOTS - 1);
+    pipev_timer_push(&w->slots[level][slot], tm);
+}
+
+static void pipev_wheel_unref(struct pipeevent_wheel *w)
+{
+    if (--w->refcnt)
+        return;
+
+    if (w->tick_added)
+        evtimer_del(&w->ev_tick);
+
+    for (struct pipeevent_wheel **pw = &wheels; *pw; pw = &(*pw)->next)
+    {
+        if (*pw == w)
+        {
+            *pw = w->next;
+            break;
+        }
+    }
+
+    free(w);
+}
+
+/* таймер истёк: выключаем направление и сообщаем пользователю */
+static void pipev_timer_fire(struct pipeevent_timer *tm)
+{
+    struct pipeevent *pev = tm->pev;
+
+    pipeevent_disable(pev, (tm->what & PEV_EVENT_READING) ? EV_READ : EV_WRITE);
+
+    // последним действием: callback может освободить pipeevent
+    if (pev->eventcb)
+        pev->eventcb(pev, PEV_EVENT_TIMEOUT|tm->what, pev->cb_ctx);
+}
+
+/* переложить слот верхнего уровня на нижние */
+static void pipev_wheel_cascade(struct pipeevent_wheel *w, int level)
+{
+    size_t slot = (size_t)(w->cur >> (PEV_WHEEL_BITS * level)) &
+        (PEV_WHEEL_SLOTS - 1);
+
+    struct pipeevent_timer *tm = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    while (tm)
+    {
+        struct pipeevent_timer *next = tm->next;
+        tm->list = NULL;
+        pipev_wheel_insert(w, tm);
+        tm = next;
+    }
+
+    if (!slot && level + 1 < PEV_WHEEL_LEVELS)
+        pipev_wheel_cascade(w, level + 1);
+}
+
+static void pipev_wheel_advance(struct pipeevent_wheel *w, ev_uint64_t now)
+{
+    while (w->cur < now && w->active)
+    {
+        ++w->cur;
+
+        size_t slot = (size_t)w->cur & (PEV_WHEEL_SLOTS - 1);
+        if (!slot)
+            pipev_wheel_cascade(w, 1);
+
+        // разбираем через отдельный список: callback может снять
+        // или освободить любой таймер, включая ещё не разобранные
+        w->expired = w->slots[0][slot];
+        w->slots[0][slot] = NULL;
+        for (struct pipeevent_timer *tm = w->expired; tm; tm = tm->next)
+            tm->list = &w->expired;
+
+        while (w->expired)
+        {
+            struct pipeevent_timer *tm = w->expired;
+            pipev_timer_unlink(tm);
+
+            // была активность - ленивый перезапуск от неё
+            if (pipev_timer_expiry(tm) > w->cur)
+            {
+                pipev_wheel_insert(w, tm);
+                continue;
+            }
+
+            --w->active;
+            pipev_timer_fire(tm);
+        }
+    }
+}
+
+static void pipev_wheel_on_tick(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd;
+    (void)what;
+    struct pipeevent_wheel *w = (struct pipeevent_wheel *)arg;
+
+    // не даём колесу исчезнуть, пока разбираем его из callback-ов
+    ++w->refcnt;
+
+    pipev_wheel_advance(w, pipev_wheel_now());
+
+    if (!w->active && w->tick_added)
+    {
+        evtimer_del(&w->ev_tick);
+        w->tick_added = 0;
+    }
+
+    pipev_wheel_unref(w);
+}
+
+static struct pipeevent_wheel *pipev_wheel_get(struct event_base *base)
+{
+    for (struct pipeevent_wheel *w = wheels; w; w = w->next)
+    {
+        if (w->base == base)
+        {
+            ++w->refcnt;
+            return w;
+        }
+    }
+
+    struct pipeevent_wheel *w =
+        (struct pipeevent_wheel *)calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+
+    w->base = base;
+    w->refcnt = 1;
+    w->cur = pipev_wheel_now();
+    event_assign(&w->ev_tick, base, -1, EV_PERSIST, pipev_wheel_on_tick, w);
+
+    w->next = wheels;
+    wheels = w;
+    return w;
+}
+
+static void pipev_timer_link(struct pipeevent_wheel *w,
+    struct pipeevent_timer *tm)
+{
+    if (!w->active++)
+    {
+        // колесо стояло - время в нём устарело
+        w->cur = pipev_wheel_now();
+        if (!w->tick_added)
+        {
+            struct timeval tv = { 0, PIPEEVENT_WHEEL_TICK_MS * 1000 };
+            evtimer_add(&w->ev_tick, &tv);
+            w->tick_added = 1;
+        }
+    }
+
+    tm->last = pipev_wheel_now();
+    pipev_wheel_insert(w, tm);
+}
+
+static void pipev_timer_drop(struct pipeevent_wheel *w,
+    struct pipeevent_timer *tm)
+{
+    if (!tm->list)
+        return;
+
+    pipev_timer_unlink(tm);
+    // тик остановится сам, когда увидит пустое колесо
+    --w->active;
+}
+
+static void pipev_timer_sync(struct pipeevent_wheel *w,
+    struct pipeevent_timer *tm, int wanted)
+{
+    if (wanted && tm->timeout)
+    {
+        if (!tm->list)
+            pipev_timer_link(w, tm);
+    }
+    else
+    {
+        pipev_timer_drop(w, tm);
+    }
+}
+
+void pipev_timer_update(struct pipeevent *pev)
+{
+    struct pipeevent_wheel *w = pev->wheel;
+    if (!w)
+        return;
+
+    pipev_timer_sync(w, &pev->tm_read,
+        (pev->enabled & EV_READ) && !pev->read_suspended);
+    pipev_timer_sync(w, &pev->tm_write,
+        (pev->enabled & EV_WRITE) && pev->ev_write_added);
+}
+
+void pipev_timer_free(struct pipeevent *pev)
+{
+    struct pipeevent_wheel *w = pev->wheel;
+    if (!w)
+        return;
+
+    pipev_timer_drop(w, &pev->tm_read);
+    pipev_timer_drop(w, &pev->tm_write);
+
+    pev->wheel = NULL;
+    pipev_wheel_unref(w);
+}
+
+void pipev_timer_attach(struct pipeevent *pev)
+{
+    if (pev->wheel || (!pev->tm_read.timeout && !pev->tm_write.timeout))
+        return;
+
+    // колесо нового event_base, отсчёт начинается заново
+    pev->wheel = pipev_wheel_get(pev->base);
+    pipev_timer_update(pev);
+}
+
+int pipeevent_set_timeouts(struct pipeevent *pev,
+    const struct timeval *tv_read, const struct timeval *tv_write)
+{
+    assert(pev);
+
+    if (!tv_read && !tv_write)
+    {
+        pipev_timer_free(pev);
+        pev->tm_read.timeout = 0;
+        pev->tm_write.timeout = 0;
+        return 0;
+    }
+
+    if (!pev->wheel)
+    {
+        pev->wheel = pipev_wheel_get(pev->base);
+        if (!pev->wheel)
+            return -1;
+
+        pev->tm_read.pev = pev;
+        pev->tm_read.what = PEV_EVENT_READING;
+        pev->tm_write.pev = pev;
+        pev->tm_write.what = PEV_EVENT_WRITING;
+    }
+
+    // новый тайм-аут отсчитывается с текущего момента
+    pipev_timer_drop(pev->wheel, &pev->tm_read);
+    pipev_timer_drop(pev->wheel, &pev->tm_write);
+
+    pev->tm_read.timeout = tv_read ? pipev_wheel_ticks(tv_read) : 0;
+    pev->tm_write.timeout = tv_write ? pipev_wheel_ticks(tv_write) : 0;
+
+    pipev_timer_update(pev);
+    return 0;
+}
@@ -0,0 +1,710 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+
+#include <assert.h>
+
+#if defined(__linux__) && defined(E4PIPE_WITH_IO_URING)
+
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// сколько раз подряд pipeevent_uring_free ждёт завершений без успеха, по 1 мс
+#define PEV_URING_FREE_STALLS 1000
+
+struct pipeevent_uring {
+    struct event_base *base;
+    int fd;
+    // eventfd завершений, его слушает libevent
+    int efd;
+    struct event ev_cq;
+    // одна отправка за проход цикла
+    struct event ev_submit;
+    size_t submit_active;
+
+    // SQ
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    // CQ
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_sz;
+    void *cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+
+    // операций в ядре
+    size_t inflight;
+    // pipeevent_uring_free: новые splice идут обычным путём
+    int closing;
+
+    // CQE операций pipeevent, снятые во время ожидания tee
+    struct io_uring_cqe *held;
+    size_t n_held;
+    size_t cap_held;
+
+    // pipeevent на движке
+    struct pipeevent *head;
+};
+
+static int pipev_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int pipev_io_uring_enter(int fd, unsigned to_submit,
+    unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+        flags, NULL, 0);
+}
+
+static int pipev_io_uring_register(int fd, unsigned op, void *arg,
+    unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr_args);
+}
+
+/* ядро умеет IORING_OP_SPLICE и IORING_OP_TEE */
+static int pipev_uring_probe(int fd)
+{
+    size_t n = IORING_OP_TEE + 1;
+    struct io_uring_probe *probe = (struct io_uring_probe *)calloc(1,
+        sizeof(*probe) + n * sizeof(struct io_uring_probe_op));
+    if (!probe)
+        return -1;
+
+    int rc = pipev_io_uring_register(fd, IORING_REGISTER_PROBE,
+        probe, (unsigned)n);
+    if (rc == 0 && (probe->last_op < IORING_OP_TEE ||
+        !(probe->ops[IORING_OP_SPLICE].flags & IO_URING_OP_SUPPORTED) ||
+        !(probe->ops[IORING_OP_TEE].flags & IO_URING_OP_SUPPORTED)))
+    {
+        errno = ENOSYS;
+        rc = -1;
+    }
+
+    free(probe);
+    return rc;
+}
+
+static int pipev_uring_submit(struct pipeevent_uring *r)
+{
+    while (r->to_submit)
+    {
+        int rc = pipev_io_uring_enter(r->fd, r->to_submit, 0, 0);
+        if (rc > 0)
+        {
+            r->to_submit -= (unsigned)rc;
+            continue;
+        }
+        if (rc < 0 && errno == EINTR)
+            continue;
+        return -1;
+    }
+    return 0;
+}
+
+static void pipev_uring_dispatch(struct pipeevent_uring *r,
+    const struct io_uring_cqe *cqe)
+{
+    (void)r;
+    void *user = (void *)(uintptr_t)cqe->user_data;
+    short kind = *(short *)user;
+
+    if (kind == PEV_UR_TEE)
+    {
+        struct pipev_tee *t = (struct pipev_tee *)user;
+        t->res = cqe->res;
+        t->pending = 0;
+        return;
+    }
+
+    pipev_uring_complete((struct pipeevent_uring_op *)user, cqe->res);
+}
+
+/* забрать один CQE, 0 - кольцо пусто */
+static int pipev_uring_pop(struct pipeevent_uring *r, struct io_uring_cqe *out)
+{
+    unsigned head = *r->cq_head;
+    unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return 0;
+
+    *out = r->cqes[head & r->cq_mask];
+    // голову двигаем до разбора: callback может снова зайти в кольцо
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    r->inflight--;
+    return 1;
+}
+
+static void pipev_uring_reap(struct pipeevent_uring *r)
+{
+    // сначала отложенные во время tee, по порядку
+    for (size_t i = 0; i < r->n_held; ++i)
+    {
+        struct io_uring_cqe cqe = r->held[i];
+        pipev_uring_dispatch(r, &cqe);
+    }
+    r->n_held = 0;
+
+    struct io_uring_cqe cqe;
+    while (pipev_uring_pop(r, &cqe))
+        pipev_uring_dispatch(r, &cqe);
+}
+
+static int pipev_uring_hold(struct pipeevent_uring *r,
+    const struct io_uring_cqe *cqe)
+{
+    if (r->n_held == r->cap_held)
+    {
+        size_t cap = r->cap_held ? r->cap_held * 2 : 64;
+        struct io_uring_cqe *h = (struct io_uring_cqe *)realloc(r->held,
+            cap * sizeof(*h));
+        if (!h)
+            return -1;
+        r->held = h;
+        r->cap_held = cap;
+    }
+
+    r->held[r->n_held++] = *cqe;
+    return 0;
+}
+
+/* накопленные SQE уйдут одним io_uring_enter на проходе цикла */
+static void pipev_uring_kick(struct pipeevent_uring *r)
+{
+    if (r->to_submit && !r->submit_active)
+    {
+        r->submit_active = 1;
+        event_active(&r->ev_submit, EV_TIMEOUT, 1);
+    }
+}
+
+static void pipev_uring_on_submit(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd;
+    (void)what;
+    struct pipeevent_uring *r = (struct pipeevent_uring *)arg;
+
+    r->submit_active = 0;
+    if (pipev_uring_submit(r) == 0)
+        return;
+
+    // CQ переполнен (EBUSY) или ядру не хватило памяти (EAGAIN): SQE
+    // остались в кольце, их операции busy. Разбираем завершения и
+    // повторяем на следующем проходе, иначе соединения стоят до чужого
+    // splice
+    if (errno == EBUSY || errno == EAGAIN)
+    {
+        pipev_uring_reap(r);
+        pipev_uring_kick(r);
+    }
+}
+
+static void pipev_uring_on_cq(evutil_socket_t fd, short what, void *arg)
+{
+    (void)what;
+    struct pipeevent_uring *r = (struct pipeevent_uring *)arg;
+
+    ev_uint64_t cnt;
+    while (read(fd, &cnt, sizeof(cnt)) < 0 && errno == EINTR)
+        ;
+
+    pipev_uring_reap(r);
+
+    // место в CQ освободилось: отправка, которой отказали, пойдёт снова
+    pipev_uring_kick(r);
+}
+
+static struct io_uring_sqe *pipev_uring_sqe(struct pipeevent_uring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sq_local_tail - head >= r->sq_entries)
+    {
+        // кольцо полно - отправляем накопленное прямо сейчас
+        pipev_uring_submit(r);
+        head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (r->sq_local_tail - head >= r->sq_entries)
+            return NULL;
+    }
+
+    unsigned idx = r->sq_local_tail & r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sq_array[idx] = idx;
+    return sqe;
+}
+
+/* снять k последних SQE, которые ещё не отправлены ядру */
+static void pipev_uring_rollback(struct pipeevent_uring *r, unsigned k)
+{
+    r->sq_local_tail -= k;
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    r->to_submit -= k;
+    r->inflight -= k;
+}
+
+static void pipev_uring_publish(struct pipeevent_uring *r)
+{
+    ++r->sq_local_tail;
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+    ++r->to_submit;
+    ++r->inflight;
+}
+
+static int pipev_uring_prep(struct pipeevent_uring *r, unsigned char op,
+    void *user, int fd_in, int fd_out, size_t len)
+{
+    struct io_uring_sqe *sqe = pipev_uring_sqe(r);
+    if (!sqe)
+        return -1;
+
+    sqe->opcode = op;
+    sqe->fd = fd_out;
+    // у tee смещений нет, ядро требует нули
+    if (op == IORING_OP_SPLICE)
+    {
+        sqe->off = (__u64)-1;
+        sqe->splice_off_in = (__u64)-1;
+    }
+    sqe->splice_fd_in = fd_in;
+    sqe->len = (len > 0x7ffff000u) ? 0x7ffff000u : (unsigned)len;
+    sqe->splice_flags = (op == IORING_OP_TEE) ?
+        SPLICE_F_NONBLOCK : SPLICE_F_MOVE|SPLICE_F_NONBLOCK;
+    sqe->user_data = (__u64)(uintptr_t)user;
+
+    pipev_uring_publish(r);
+    return 0;
+}
+
+int pipev_uring_splice(struct pipeevent_uring *r, void *user,
+    int fd_in, int fd_out, size_t len)
+{
+    if (r->closing ||
+        pipev_uring_prep(r, IORING_OP_SPLICE, user, fd_in, fd_out, len) != 0)
+        return -1;
+
+    // все splice этого прохода цикла уйдут одним io_uring_enter
+    pipev_uring_kick(r);
+    return 0;
+}
+
+int pipev_uring_tee_batch(struct pipeevent_uring *r,
+    struct pipev_tee *t, size_t n)
+{
+    size_t next = 0;
+    size_t pending = 0;
+    // io_uring_enter отказал: новых tee не ставим
+    int failed = 0;
+
+    while ((next < n && !failed) || pending)
+    {
+        while (next < n && !failed)
+        {
+            t[next].kind = PEV_UR_TEE;
+            if (pipev_uring_prep(r, IORING_OP_TEE, &t[next],
+                t[next].fd_in, t[next].fd_out, t[next].len) != 0)
+                break;
+            t[next].pending = 1;
+            ++pending;
+            ++next;
+        }
+
+        if (!pending)
+        {
+            // ни одна не встала в кольцо - остаток синхронным tee
+            return (int)next;
+        }
+
+        int rc = pipev_io_uring_enter(r->fd, failed ? 0 : r->to_submit, 1,
+            IORING_ENTER_GETEVENTS);
+        if (rc > 0 && !failed)
+            r->to_submit -= (unsigned)rc;
+        else if (rc < 0 && errno != EINTR && errno != EAGAIN &&
+            errno != EBUSY)
+        {
+            if (!failed)
+            {
+                // не отправленные tee - последние в SQ: снимаем их, они
+                // пойдут синхронным tee; отправленные t[] ядро ещё держит,
+                // их дожидаемся
+                unsigned k = (r->to_submit < pending) ?
+                    r->to_submit : (unsigned)pending;
+                pipev_uring_rollback(r, k);
+                for (size_t i = next - k; i < next; ++i)
+                    t[i].pending = 0;
+                next -= k;
+                pending -= k;
+                failed = 1;
+            }
+            else
+            {
+                // ждать через кольцо нельзя - опрашиваем CQ
+                sched_yield();
+            }
+        }
+
+        struct io_uring_cqe cqe;
+        while (pipev_uring_pop(r, &cqe))
+        {
+            short kind = *(short *)(uintptr_t)cqe.user_data;
+            if (kind == PEV_UR_TEE)
+            {
+                pipev_uring_dispatch(r, &cqe);
+                --pending;
+            }
+            else if (pipev_uring_hold(r, &cqe) != 0)
+            {
+                // без памяти под очередь - разбираем сразу
+                pipev_uring_dispatch(r, &cqe);
+            }
+        }
+    }
+
+    // отложенные CQE разберём в следующем проходе цикла
+    if (r->n_held)
+        event_active(&r->ev_cq, EV_READ, 1);
+
+    return (int)next;
+}
+
+void pipev_uring_unlink(struct pipeevent *pev)
+{
+    struct pipeevent_uring *r = pev->uring;
+    if (!r)
+        return;
+
+    if (pev->ur_prev)
+        pev->ur_prev->ur_next = pev->ur_next;
+    else
+        r->head = pev->ur_next;
+    if (pev->ur_next)
+        pev->ur_next->ur_prev = pev->ur_prev;
+
+    pev->ur_next = pev->ur_prev = NULL;
+}
+
+static void pipev_uring_unmap(struct pipeevent_uring *r)
+{
+    if (r->sqes)
+        munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ring && r->cq_ring != r->sq_ring)
+        munmap(r->cq_ring, r->cq_ring_sz);
+    if (r->sq_ring)
+        munmap(r->sq_ring, r->sq_ring_sz);
+}
+
+static int pipev_uring_map(struct pipeevent_uring *r,
+    const struct io_uring_params *p)
+{
+    r->sq_ring_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p->cq_off.cqes +
+        p->cq_entries * sizeof(struct io_uring_cqe);
+
+    int single = (p->features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && r->cq_ring_sz > r->sq_ring_sz)
+        r->sq_ring_sz = r->cq_ring_sz;
+
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED)
+    {
+        r->sq_ring = NULL;
+        return -1;
+    }
+
+    if (single)
+    {
+        r->cq_ring = r->sq_ring;
+    }
+    else
+    {
+        r->cq_ring = mmap(NULL, r->cq_ring_sz, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cq_ring == MAP_FAILED)
+        {
+            r->cq_ring = NULL;
+            return -1;
+        }
+    }
+
+    r->sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_sz,
+        PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+    {
+        r->sqes = NULL;
+        return -1;
+    }
+
+    char *sq = (char *)r->sq_ring;
+    r->sq_head = (unsigned *)(sq + p->sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p->sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p->sq_off.ring_mask);
+    r->sq_entries = *(unsigned *)(sq + p->sq_off.ring_entries);
+    r->sq_array = (unsigned *)(sq + p->sq_off.array);
+    r->sq_local_tail = *r->sq_tail;
+
+    char *cq = (char *)r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p->cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p->cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p->cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+
+    return 0;
+}
+
+struct pipeevent_uring *pipeevent_uring_new(struct event_base *base,
+    unsigned entries)
+{
+    if (!base)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct pipeevent_uring *r =
+        (struct pipeevent_uring *)calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+
+    r->base = base;
+    r->efd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CLAMP;
+
+    r->fd = pipev_io_uring_setup(entries ? entries : PIPEEVENT_URING_ENTRIES, &p);
+    if (r->fd < 0)
+    {
+        // ENOSYS на старых ядрах, EPERM при kernel.io_uring_disabled
+        free(r);
+        return NULL;
+    }
+
+    // без NODROP переполненная CQ теряет завершения
+    if (!(p.features & IORING_FEAT_NODROP))
+    {
+        errno = ENOSYS;
+        goto fail;
+    }
+
+    if (pipev_uring_probe(r->fd) != 0 || pipev_uring_map(r, &p) != 0)
+        goto fail;
+
+    r->efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (r->efd < 0)
+        goto fail;
+
+    if (pipev_io_uring_register(r->fd, IORING_REGISTER_EVENTFD, &r->efd, 1) != 0)
+        goto fail;
+
+    event_assign(&r->ev_cq, base, r->efd, EV_READ|EV_PERSIST,
+        pipev_uring_on_cq, r);
+    event_assign(&r->ev_submit, base, -1, 0, pipev_uring_on_submit, r);
+    if (event_add(&r->ev_cq, NULL) != 0)
+        goto fail;
+
+    return r;
+
+fail:
+    {
+        int err = errno;
+        pipev_uring_unmap(r);
+        if (r->efd >= 0)
+            close(r->efd);
+        close(r->fd);
+        free(r);
+        errno = err;
+    }
+    return NULL;
+}
+
+void pipeevent_uring_free(struct pipeevent_uring *r)
+{
+    if (!r)
+        return;
+
+    // оставшиеся pipeevent возвращаются на обычный путь, когда их
+    // операции завершатся; завершения больше не ставят новых
+    r->closing = 1;
+
+    // не принятые ядром SQE завершаем сами: CQE на них не придёт
+    if (pipev_uring_submit(r) != 0 && r->to_submit)
+    {
+        unsigned k = r->to_submit;
+        unsigned first = r->sq_local_tail - k;
+        for (unsigned i = 0; i < k; ++i)
+        {
+            struct io_uring_cqe cqe;
+            memset(&cqe, 0, sizeof(cqe));
+            cqe.user_data = r->sqes[(first + i) & r->sq_mask].user_data;
+            cqe.res = -ECANCELED;
+            if (pipev_uring_hold(r, &cqe) != 0)
+                break;
+        }
+        pipev_uring_rollback(r, k);
+    }
+
+    // splice неблокирующие и завершаются быстро; EAGAIN/EBUSY без
+    // завершений ждём с паузой, но не дольше PEV_URING_FREE_STALLS
+    unsigned stalls = 0;
+    pipev_uring_reap(r);
+    while (r->inflight && stalls < PEV_URING_FREE_STALLS)
+    {
+        size_t before = r->inflight;
+        int rc = pipev_io_uring_enter(r->fd, 0, 1, IORING_ENTER_GETEVENTS);
+        pipev_uring_reap(r);
+        if (rc < 0 && errno != EINTR && r->inflight == before)
+        {
+            if (errno != EAGAIN && errno != EBUSY)
+                break;
+            ++stalls;
+            usleep(1000);
+        }
+    }
+
+    // ядро не отдало завершения: операции pipeevent закрываем с ошибкой,
+    // ссылки на их сегменты и fd ядро держит само
+    for (struct pipeevent *pev = r->head; pev; )
+    {
+        struct pipeevent_uring_op *op = pev->ur_rd.busy ? &pev->ur_rd :
+            pev->ur_wr.busy ? &pev->ur_wr : NULL;
+        if (!op)
+        {
+            pev = pev->ur_next;
+            continue;
+        }
+        // callback может освободить любой pipeevent - идём с начала
+        pipev_uring_complete(op, -ECANCELED);
+        pev = r->head;
+    }
+
+    while (r->head)
+        pipeevent_set_uring(r->head, NULL);
+
+    event_del(&r->ev_cq);
+    event_del(&r->ev_submit);
+
+    pipev_uring_unmap(r);
+    close(r->efd);
+    close(r->fd);
+    free(r->held);
+    free(r);
+}
+
+int pipeevent_set_uring(struct pipeevent *pev, struct pipeevent_uring *r)
+{
+    assert(pev);
+
+    if (pev->uring == r)
+        return 0;
+
+    if (pev->ur_rd.busy || pev->ur_wr.busy)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (r && r->base != pev->base)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pipev_uring_unlink(pev);
+
+    // ev_read меняет режим (edge/level), переназначаем
+    int reading = (pev->enabled & EV_READ) && !pev->read_suspended;
+    if (reading)
+        event_del(&pev->ev_read);
+
+    pev->uring = r;
+    event_assign(&pev->ev_read, pev->base, pev->fd,
+        EV_READ|EV_PERSIST|(r ? EV_ET : 0), pipev_on_readable, pev);
+
+    if (reading)
+        event_add(&pev->ev_read, NULL);
+
+    if (r)
+    {
+        pev->ur_prev = NULL;
+        pev->ur_next = r->head;
+        if (r->head)
+            r->head->ur_prev = pev;
+        r->head = pev;
+    }
+
+    return 0;
+}
+
+#else
+
+struct pipeevent_uring *pipeevent_uring_new(struct event_base *base,
+    unsigned entries)
+{
+    (void)base;
+    (void)entries;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void pipeevent_uring_free(struct pipeevent_uring *r)
+{
+    (void)r;
+}
+
+int pipeevent_set_uring(struct pipeevent *pev, struct pipeevent_uring *r)
+{
+    assert(pev);
+
+    if (!r)
+        return 0;
+
+    errno = ENOSYS;
+    return -1;
+}
+
+int pipev_uring_splice(struct pipeevent_uring *r, void *user,
+    int fd_in, int fd_out, size_t len)
+{
+    (void)r;
+    (void)user;
+    (void)fd_in;
+    (void)fd_out;
+    (void)len;
+    return -1;
+}
+
+int pipev_uring_tee_batch(struct pipeevent_uring *r,
+    struct pipev_tee *t, size_t n)
+{
+    (void)r;
+    (void)t;
+    (void)n;
+    errno = ENOSYS;
+    return -1;
+}
+
+void pipev_uring_unlink(struct pipeevent *pev)
+{
+    (void)pev;
+}
+
+#endif
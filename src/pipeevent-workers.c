@@ -0,0 +1,677 @@
+#define _GNU_SOURCE
+
+#include "pipeevent-int.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <assert.h>
+
+enum pipev_job_type
+{
+    // создать pipeevent для fd
+    PEV_JOB_ASSIGN,
+    // принять переехавшие pipeevent
+    PEV_JOB_ATTACH,
+    // отдать count pipeevent воркеру target
+    PEV_JOB_REBALANCE,
+    // включить/выключить таймер rebalance
+    PEV_JOB_TIMER,
+    PEV_JOB_STOP
+};
+
+struct pipev_job {
+    struct pipev_job *next;
+    enum pipev_job_type type;
+
+    // PEV_JOB_ASSIGN
+    evutil_socket_t fd;
+    size_t options;
+    int has_cfg;
+    struct infinitypipe_config cfg;
+
+    // PEV_JOB_ATTACH: pipeevent и его пир relay
+    struct pipeevent *pev[2];
+    unsigned pools[2];
+
+    // PEV_JOB_REBALANCE
+    int target;
+    size_t count;
+
+    // PEV_JOB_TIMER
+    int has_tv;
+    struct timeval tv;
+
+    pipeevent_worker_cb cb;
+    void *ctx;
+};
+
+struct pipeevent_worker {
+    struct pipeevent_workers *wp;
+    int idx;
+    int cpu;
+    struct event_base *base;
+    pthread_t thread;
+    int started;
+
+    // очередь заданий от других потоков
+    int efd;
+    struct event ev_wake;
+    pthread_mutex_t lock;
+    struct pipev_job *jobs;
+    struct pipev_job *jobs_tail;
+
+    // pipeevent воркера плюс те, что уже едут к нему
+    atomic_size_t load;
+    // pipeevent воркера, трогает только его поток
+    struct pipeevent *head;
+
+    // периодический rebalance (только у воркера 0)
+    struct event ev_rebalance;
+    int rebalance_added;
+};
+
+struct pipeevent_workers {
+    int n;
+    unsigned flags;
+    struct pipeevent_worker *w;
+
+    pthread_mutex_t lock;
+    pipeevent_worker_cb migrate_cb;
+    void *migrate_ctx;
+};
+
+static void pipev_worker_join(struct pipeevent_worker *w,
+    struct pipeevent *pev)
+{
+    pev->worker = w;
+    pev->wk_prev = NULL;
+    pev->wk_next = w->head;
+    if (w->head)
+        w->head->wk_prev = pev;
+    w->head = pev;
+}
+
+void pipev_worker_leave(struct pipeevent *pev)
+{
+    struct pipeevent_worker *w = pev->worker;
+    if (!w)
+        return;
+
+    if (pev->wk_prev)
+        pev->wk_prev->wk_next = pev->wk_next;
+    else
+        w->head = pev->wk_next;
+    if (pev->wk_next)
+        pev->wk_next->wk_prev = pev->wk_prev;
+
+    pev->wk_next = pev->wk_prev = NULL;
+    pev->worker = NULL;
+    atomic_fetch_sub_explicit(&w->load, 1, memory_order_relaxed);
+}
+
+static int pipev_worker_post(struct pipeevent_worker *w, struct pipev_job *job)
+{
+    job->next = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->jobs_tail)
+        w->jobs_tail->next = job;
+    else
+        w->jobs = job;
+    w->jobs_tail = job;
+    pthread_mutex_unlock(&w->lock);
+
+    // eventfd копит счётчик, лишние пробуждения склеиваются
+    ev_uint64_t one = 1;
+    ssize_t rc;
+    do
+    {
+        rc = write(w->efd, &one, sizeof(one));
+    } while (rc < 0 && errno == EINTR);
+
+    return 0;
+}
+
+static size_t pipev_worker_load(const struct pipeevent_worker *w)
+{
+    return atomic_load_explicit(&w->load, memory_order_relaxed);
+}
+
+static int pipev_workers_least(const struct pipeevent_workers *wp)
+{
+    int best = 0;
+    size_t min = pipev_worker_load(&wp->w[0]);
+    for (int i = 1; i < wp->n; ++i)
+    {
+        size_t l = pipev_worker_load(&wp->w[i]);
+        if (l < min)
+        {
+            min = l;
+            best = i;
+        }
+    }
+    return best;
+}
+
+/* участник rate-группы, рассылки или движка io_uring живёт только
+   на своём event_base */
+static int pipev_migratable(const struct pipeevent *pev)
+{
+    return !pev->rate_group && !pev->bcast && !pev->uring;
+}
+
+static int pipev_migrate(struct pipeevent *pev, struct pipeevent_worker *to,
+    pipeevent_worker_cb cb, void *ctx)
+{
+    struct pipeevent *peer = pev->relay;
+
+    if (!pipev_migratable(pev) || (peer && !pipev_migratable(peer)) ||
+        pev->cb_running || (peer && peer->cb_running))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    struct pipev_job *job = (struct pipev_job *)calloc(1, sizeof(*job));
+    if (!job)
+        return -1;
+
+    job->type = PEV_JOB_ATTACH;
+    job->pev[0] = pev;
+    job->pev[1] = peer;
+    job->cb = cb;
+    job->ctx = ctx;
+
+    size_t n = peer ? 2 : 1;
+    for (size_t i = 0; i < n; ++i)
+    {
+        job->pools[i] = pipev_detach_base(job->pev[i]);
+        pipev_worker_leave(job->pev[i]);
+    }
+
+    atomic_fetch_add_explicit(&to->load, n, memory_order_relaxed);
+    pipev_worker_post(to, job);
+
+    // дальше pev принадлежит потоку воркера to
+    return (int)n;
+}
+
+/* отдать до count pipeevent воркеру target */
+static void pipev_worker_shed(struct pipeevent_worker *w,
+    const struct pipev_job *job)
+{
+    struct pipeevent_worker *to = &w->wp->w[job->target];
+    size_t moved = 0;
+
+    struct pipeevent *pev = w->head;
+    while (pev && moved < job->count)
+    {
+        // пир relay уедет вместе с pev
+        struct pipeevent *next = pev->wk_next;
+        if (next && next == pev->relay)
+            next = next->wk_next;
+
+        int rc = pipev_migrate(pev, to, job->cb, job->ctx);
+        if (rc > 0)
+            moved += (size_t)rc;
+
+        pev = next;
+    }
+}
+
+static void pipev_worker_on_rebalance(evutil_socket_t fd, short what,
+    void *arg)
+{
+    (void)fd;
+    (void)what;
+    struct pipeevent_worker *w = (struct pipeevent_worker *)arg;
+    pipeevent_workers_rebalance(w->wp);
+}
+
+static void pipev_worker_run(struct pipeevent_worker *w, struct pipev_job *job)
+{
+    switch (job->type)
+    {
+    case PEV_JOB_ASSIGN:
+    {
+        struct pipeevent *pev = pipeevent_socket_new_config(w->base, job->fd,
+            job->options, job->has_cfg ? &job->cfg : NULL);
+        if (pev)
+        {
+            pipev_worker_join(w, pev);
+        }
+        else
+        {
+            atomic_fetch_sub_explicit(&w->load, 1, memory_order_relaxed);
+            if (job->options & PEV_OPT_CLOSE_ON_FREE)
+                close(job->fd);
+        }
+
+        if (job->cb)
+            job->cb(pev, job->ctx);
+        break;
+    }
+    case PEV_JOB_ATTACH:
+        for (int i = 0; i < 2 && job->pev[i]; ++i)
+        {
+            pipev_attach_base(job->pev[i], w->base, job->pools[i]);
+            pipev_worker_join(w, job->pev[i]);
+        }
+        for (int i = 0; i < 2 && job->pev[i]; ++i)
+        {
+            if (job->cb)
+                job->cb(job->pev[i], job->ctx);
+        }
+        break;
+    case PEV_JOB_REBALANCE:
+        pipev_worker_shed(w, job);
+        break;
+    case PEV_JOB_TIMER:
+        if (w->rebalance_added)
+        {
+            event_del(&w->ev_rebalance);
+            w->rebalance_added = 0;
+        }
+        if (job->has_tv)
+        {
+            event_add(&w->ev_rebalance, &job->tv);
+            w->rebalance_added = 1;
+        }
+        break;
+    case PEV_JOB_STOP:
+        event_base_loopbreak(w->base);
+        break;
+    }
+}
+
+static void pipev_worker_on_wake(evutil_socket_t fd, short what, void *arg)
+{
+    (void)what;
+    struct pipeevent_worker *w = (struct pipeevent_worker *)arg;
+
+    ev_uint64_t cnt;
+    while (read(fd, &cnt, sizeof(cnt)) < 0 && errno == EINTR)
+        ;
+
+    pthread_mutex_lock(&w->lock);
+    struct pipev_job *job = w->jobs;
+    w->jobs = w->jobs_tail = NULL;
+    pthread_mutex_unlock(&w->lock);
+
+    while (job)
+    {
+        struct pipev_job *next = job->next;
+        pipev_worker_run(w, job);
+        free(job);
+        job = next;
+    }
+}
+
+static void *pipev_worker_main(void *arg)
+{
+    struct pipeevent_worker *w = (struct pipeevent_worker *)arg;
+
+    if (w->cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    event_base_loop(w->base, EVLOOP_NO_EXIT_ON_EMPTY);
+
+    // pipeevent, оставшиеся у воркера, освобождаются в его потоке
+    while (w->head)
+        pipeevent_free(w->head);
+
+    if (w->rebalance_added)
+        event_del(&w->ev_rebalance);
+    event_del(&w->ev_wake);
+
+    infinityseg_pool_clear(infinityseg_pool_thread());
+    return NULL;
+}
+
+/* idx-й CPU из доступных процессу */
+static int pipev_worker_cpu(int idx)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0)
+        return -1;
+
+    int n = CPU_COUNT(&set);
+    if (n <= 0)
+        return -1;
+
+    int k = idx % n;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (CPU_ISSET(cpu, &set) && k-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+static int pipev_workers_ncpu(void)
+{
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+        return CPU_COUNT(&set);
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? (int)n : 1;
+}
+
+struct pipeevent_workers *pipeevent_workers_new(int n, unsigned flags)
+{
+#ifndef __linux__
+    (void)n;
+    (void)flags;
+    errno = ENOSYS;
+    return NULL;
+#else
+    if (n < 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (n == 0)
+        n = pipev_workers_ncpu();
+
+    struct pipeevent_workers *wp =
+        (struct pipeevent_workers *)calloc(1, sizeof(*wp));
+    if (!wp)
+        return NULL;
+
+    wp->w = (struct pipeevent_worker *)calloc((size_t)n, sizeof(*wp->w));
+    if (!wp->w)
+    {
+        free(wp);
+        return NULL;
+    }
+
+    wp->flags = flags;
+    pthread_mutex_init(&wp->lock, NULL);
+
+    for (int i = 0; i < n; ++i)
+    {
+        struct pipeevent_worker *w = &wp->w[i];
+        w->wp = wp;
+        w->idx = i;
+        w->cpu = (flags & PEV_WORKERS_PIN_CPU) ? pipev_worker_cpu(i) : -1;
+        w->efd = -1;
+        pthread_mutex_init(&w->lock, NULL);
+        atomic_init(&w->load, 0);
+        // wp->n растёт по мере запуска, free разберёт только запущенные
+        wp->n = i + 1;
+
+        w->base = event_base_new();
+        if (!w->base)
+            goto fail;
+
+        w->efd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        if (w->efd < 0)
+            goto fail;
+
+        event_assign(&w->ev_wake, w->base, w->efd, EV_READ|EV_PERSIST,
+            pipev_worker_on_wake, w);
+        event_assign(&w->ev_rebalance, w->base, -1, EV_PERSIST,
+            pipev_worker_on_rebalance, w);
+        if (event_add(&w->ev_wake, NULL) != 0)
+            goto fail;
+
+        int rc = pthread_create(&w->thread, NULL, pipev_worker_main, w);
+        if (rc != 0)
+        {
+            errno = rc;
+            goto fail;
+        }
+        w->started = 1;
+    }
+
+    return wp;
+
+fail:
+    {
+        int err = errno;
+        pipeevent_workers_free(wp);
+        errno = err;
+    }
+    return NULL;
+#endif
+}
+
+void pipeevent_workers_free(struct pipeevent_workers *wp)
+{
+    if (!wp)
+        return;
+
+    for (int i = 0; i < wp->n; ++i)
+    {
+        struct pipeevent_worker *w = &wp->w[i];
+        if (!w->started)
+            continue;
+
+        struct pipev_job *job = (struct pipev_job *)calloc(1, sizeof(*job));
+        if (job)
+        {
+            job->type = PEV_JOB_STOP;
+            pipev_worker_post(w, job);
+        }
+        else
+        {
+            // без задания не остановить - пусть видит loopexit
+            event_base_loopexit(w->base, NULL);
+        }
+    }
+
+    for (int i = 0; i < wp->n; ++i)
+    {
+        struct pipeevent_worker *w = &wp->w[i];
+        if (w->started)
+            pthread_join(w->thread, NULL);
+    }
+
+    // задания, пришедшие после STOP; события переезжавших pipeevent
+    // привязаны к event_base, откуда они уехали, поэтому все base ещё живы
+    for (int i = 0; i < wp->n; ++i)
+    {
+        struct pipeevent_worker *w = &wp->w[i];
+        for (struct pipev_job *job = w->jobs; job; )
+        {
+            struct pipev_job *next = job->next;
+            if (job->type == PEV_JOB_ASSIGN &&
+                (job->options & PEV_OPT_CLOSE_ON_FREE))
+                close(job->fd);
+            if (job->type == PEV_JOB_ATTACH && w->base)
+            {
+                // пул потока воркера остался в его потоке
+                for (int k = 0; k < 2 && job->pev[k]; ++k)
+                    pipev_attach_base(job->pev[k], w->base, 0);
+                pipeevent_free(job->pev[0]);
+                pipeevent_free(job->pev[1]);
+            }
+            free(job);
+            job = next;
+        }
+        w->jobs = w->jobs_tail = NULL;
+    }
+
+    for (int i = 0; i < wp->n; ++i)
+    {
+        struct pipeevent_worker *w = &wp->w[i];
+        if (w->base)
+            event_base_free(w->base);
+        if (w->efd >= 0)
+            close(w->efd);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    pthread_mutex_destroy(&wp->lock);
+    free(wp->w);
+    free(wp);
+}
+
+int pipeevent_workers_count(const struct pipeevent_workers *wp)
+{
+    assert(wp);
+    return wp->n;
+}
+
+struct event_base *pipeevent_workers_get_base(struct pipeevent_workers *wp,
+    int idx)
+{
+    assert(wp);
+
+    if (idx < 0 || idx >= wp->n)
+        return NULL;
+    return wp->w[idx].base;
+}
+
+size_t pipeevent_workers_get_load(const struct pipeevent_workers *wp, int idx)
+{
+    assert(wp);
+
+    if (idx < 0 || idx >= wp->n)
+        return 0;
+    return pipev_worker_load(&wp->w[idx]);
+}
+
+int pipeevent_workers_assign(struct pipeevent_workers *wp, evutil_socket_t fd,
+    size_t options, const struct infinitypipe_config *cfg,
+    pipeevent_worker_cb cb, void *ctx)
+{
+    assert(wp);
+
+    if (fd < 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct pipev_job *job = (struct pipev_job *)calloc(1, sizeof(*job));
+    if (!job)
+        return -1;
+
+    job->type = PEV_JOB_ASSIGN;
+    job->fd = fd;
+    job->options = options;
+    if (cfg)
+    {
+        job->has_cfg = 1;
+        job->cfg = *cfg;
+    }
+    job->cb = cb;
+    job->ctx = ctx;
+
+    // нагрузка учитывается сразу, чтобы пачка assign разошлась по воркерам
+    struct pipeevent_worker *w = &wp->w[pipev_workers_least(wp)];
+    atomic_fetch_add_explicit(&w->load, 1, memory_order_relaxed);
+    return pipev_worker_post(w, job);
+}
+
+int pipeevent_migrate(struct pipeevent *pev, struct pipeevent_workers *wp,
+    int idx, pipeevent_worker_cb cb, void *ctx)
+{
+    assert(pev);
+    assert(wp);
+
+    if (idx < 0 || idx >= wp->n)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct pipeevent_worker *to = &wp->w[idx];
+    if (pev->worker == to)
+        return 0;
+
+    return (pipev_migrate(pev, to, cb, ctx) < 0) ? -1 : 0;
+}
+
+int pipeevent_workers_rebalance(struct pipeevent_workers *wp)
+{
+    assert(wp);
+
+    pthread_mutex_lock(&wp->lock);
+    pipeevent_worker_cb cb = wp->migrate_cb;
+    void *ctx = wp->migrate_ctx;
+    pthread_mutex_unlock(&wp->lock);
+
+    size_t *load = (size_t *)malloc((size_t)wp->n * sizeof(*load));
+    if (!load)
+        return -1;
+    for (int i = 0; i < wp->n; ++i)
+        load[i] = pipev_worker_load(&wp->w[i]);
+
+    // самый загруженный отдаёт половину разницы самому свободному
+    for (int round = 0; round < 4 * wp->n; ++round)
+    {
+        int hi = 0, lo = 0;
+        for (int i = 1; i < wp->n; ++i)
+        {
+            if (load[i] > load[hi])
+                hi = i;
+            if (load[i] < load[lo])
+                lo = i;
+        }
+
+        if (load[hi] - load[lo] <= 1)
+            break;
+
+        struct pipev_job *job = (struct pipev_job *)calloc(1, sizeof(*job));
+        if (!job)
+        {
+            free(load);
+            return -1;
+        }
+
+        size_t k = (load[hi] - load[lo]) / 2;
+        job->type = PEV_JOB_REBALANCE;
+        job->target = lo;
+        job->count = k;
+        job->cb = cb;
+        job->ctx = ctx;
+        pipev_worker_post(&wp->w[hi], job);
+
+        load[hi] -= k;
+        load[lo] += k;
+    }
+
+    free(load);
+    return 0;
+}
+
+int pipeevent_workers_set_rebalance(struct pipeevent_workers *wp,
+    const struct timeval *interval)
+{
+    assert(wp);
+
+    struct pipev_job *job = (struct pipev_job *)calloc(1, sizeof(*job));
+    if (!job)
+        return -1;
+
+    job->type = PEV_JOB_TIMER;
+    if (interval)
+    {
+        job->has_tv = 1;
+        job->tv = *interval;
+    }
+
+    // таймер живёт на воркере 0
+    return pipev_worker_post(&wp->w[0], job);
+}
+
+void pipeevent_workers_set_migrate_cb(struct pipeevent_workers *wp,
+    pipeevent_worker_cb cb, void *ctx)
+{
+    assert(wp);
+
+    pthread_mutex_lock(&wp->lock);
+    wp->migrate_cb = cb;
+    wp->migrate_ctx = ctx;
+    pthread_mutex_unlock(&wp->lock);
+}
@@ -8,11 +8,18 @@
 
 struct pipeevent *pipeevent_socket_new(struct event_base *base, 
     evutil_socket_t fd, size_t options)
+{
+    return pipeevent_socket_new_config(base, fd, options, NULL);
+}
+
+struct pipeevent *pipeevent_socket_new_config(struct event_base *base,
+    evutil_socket_t fd, size_t options, const struct infinitypipe_config *cfg)
 {
 #ifndef __linux__
     (void)base;
     (void)fd;
     (void)options;
+    (void)cfg;
     errno = ENOSYS;
     return NULL;
 #else
@@ -23,6 +30,7 @@ struct pipeevent *pipeevent_socket_new(struct event_base *base,
     pev->base = base;
     pev->fd = fd;
     pev->options = options;
+    pev->file_fd = -1;
 
     if (evutil_make_socket_nonblocking(fd) != 0)
     {
@@ -30,37 +38,163 @@ struct pipeevent *pipeevent_socket_new(struct event_base *base,
         return NULL;
     }
 
-    infinitypipe_init(&pev->in, INFINITYSEG_DEFAULT_CAPACITY,
-        IP_NONBLOCK|IP_CLOEXEC);
-    infinitypipe_init(&pev->out, INFINITYSEG_DEFAULT_CAPACITY,
-        IP_NONBLOCK|IP_CLOEXEC);
+    struct infinitypipe_config def;
+    if (!cfg)
+    {
+        infinitypipe_config_init(&def);
+        cfg = &def;
+    }
+
+    // сегменты pipeevent всегда неблокирующие
+    struct infinitypipe_config c = *cfg;
+    c.flags |= IP_NONBLOCK|IP_CLOEXEC;
+
+    infinitypipe_init_config(&pev->in, &c);
+    infinitypipe_init_config(&pev->out, &c);
 
     /* pipeevent is the "parent" */
     infinitypipe_setcb(&pev->in, pipev_ip_notify, pev);
     infinitypipe_setcb(&pev->out, pipev_ip_notify, pev);
 
-    event_assign(&pev->ev_read, base, fd, 
-        EV_READ|EV_PERSIST, pipev_on_readable, pev);
-    event_assign(&pev->ev_write, base, fd, 
-        EV_WRITE|EV_PERSIST, pipev_on_writable, pev);
-    evtimer_assign(&pev->ev_deferred, base, pipev_on_deferred, pev);
+    pipev_assign_events(pev);
 
     return pev;
 #endif
 }
 
+void pipev_assign_events(struct pipeevent *pev)
+{
+    // с io_uring чтение edge-triggered, см. pipev_on_readable
+    event_assign(&pev->ev_read, pev->base, pev->fd,
+        EV_READ|EV_PERSIST|(pev->uring ? EV_ET : 0), pipev_on_readable, pev);
+    event_assign(&pev->ev_write, pev->base, pev->fd,
+        EV_WRITE|EV_PERSIST, pipev_on_writable, pev);
+    evtimer_assign(&pev->ev_deferred, pev->base, pipev_on_deferred, pev);
+    evtimer_assign(&pev->ev_budget, pev->base, pipev_on_budget, pev);
+}
+
+// сегменты в пуле потока, который обслуживал pev
+#define PEV_POOL_IN  0x01
+#define PEV_POOL_OUT 0x02
+
+unsigned pipev_detach_base(struct pipeevent *pev)
+{
+    event_del(&pev->ev_read);
+    event_del(&pev->ev_write);
+    // deferred_scheduled остаётся, тик перезапустится на новом event_base
+    evtimer_del(&pev->ev_deferred);
+    evtimer_del(&pev->ev_budget);
+
+    pipev_rate_detach(pev);
+    // колесо и очередь планировщика принадлежат старому event_base
+    pipev_timer_free(pev);
+    pipev_sched_detach(pev);
+
+    // пул потока остаётся в своём потоке
+    unsigned pools = 0;
+    struct infinityseg_pool *tp = infinityseg_pool_thread();
+    if (pev->in.pool == tp)
+    {
+        pev->in.pool = NULL;
+        pools |= PEV_POOL_IN;
+    }
+    if (pev->out.pool == tp)
+    {
+        pev->out.pool = NULL;
+        pools |= PEV_POOL_OUT;
+    }
+
+    return pools;
+}
+
+void pipev_attach_base(struct pipeevent *pev, struct event_base *base,
+    unsigned pools)
+{
+    pev->base = base;
+    pipev_assign_events(pev);
+
+    if (pools & PEV_POOL_IN)
+        pev->in.pool = infinityseg_pool_thread();
+    if (pools & PEV_POOL_OUT)
+        pev->out.pool = infinityseg_pool_thread();
+
+    if ((pev->enabled & EV_READ) && !pev->read_suspended)
+        event_add(&pev->ev_read, NULL);
+    if (pev->ev_write_added)
+        event_add(&pev->ev_write, NULL);
+    struct timeval now = {0, 0};
+    if (pev->deferred_scheduled)
+        evtimer_add(&pev->ev_deferred, &now);
+    // бюджет общий для процесса, повторим уже на новом event_base
+    if ((pev->read_suspended & PEV_SUSPEND_BUDGET) ||
+        (pev->file_left && ip_is_empty(&pev->out)) ||
+        (pev->out.spill_len && !pev->out.head) ||
+        pev->tap_rd || pev->tap_wr)
+        evtimer_add(&pev->ev_budget, &now);
+
+    pipev_rate_attach(pev);
+    pipev_timer_attach(pev);
+    pipev_sched_attach(pev);
+}
+
+static void pipev_on_free(evutil_socket_t fd, short what, void *arg)
+{
+    (void)fd;
+    (void)what;
+    pipev_free_final((struct pipeevent *)arg);
+}
+
 void pipeevent_free(struct pipeevent *pev)
 {
     if (!pev)
         return;
 
+    if (pev->relay)
+        pipeevent_unrelay(pev);
+
+    pipev_rate_free(pev);
+    pipev_timer_free(pev);
+    pipev_sched_free(pev);
+    pipeevent_bcast_unsubscribe(pev);
+    pipev_worker_leave(pev);
+
     event_del(&pev->ev_read);
     event_del(&pev->ev_write);
     evtimer_del(&pev->ev_deferred);
+    evtimer_del(&pev->ev_budget);
 
+    // операции io_uring держат fd и сегменты - освободим по завершении
+    if (pipev_uring_detach(pev))
+        return;
+
+    // из своего readcb/writecb: стек выше ещё ходит в pev, память
+    // отдаём на следующем проходе цикла
+    if (pev->cb_running)
+    {
+        pev->enabled = 0;
+        pev->pending_flags = 0;
+        pev->readcb = NULL;
+        pev->writecb = NULL;
+        pev->eventcb = NULL;
+
+        struct timeval now = {0, 0};
+        event_base_once(pev->base, -1, EV_TIMEOUT, pipev_on_free, pev, &now);
+        return;
+    }
+
+    pipev_free_final(pev);
+}
+
+void pipev_free_final(struct pipeevent *pev)
+{
     infinitypipe_free(&pev->in);
     infinitypipe_free(&pev->out);
 
+    if (pev->file_left)
+        pipev_file_done(pev);
+
+    pipev_tap_free(pev);
+
     if ((pev->options & PEV_OPT_CLOSE_ON_FREE) && pev->fd >= 0)
         close(pev->fd);
 
@@ -73,20 +207,32 @@ int pipeevent_enable(struct pipeevent *pev, short events)
 
     if ((events & EV_READ) && !(pev->enabled & EV_READ))
     {
-        if (event_add(&pev->ev_read, NULL) != 0)
-            return -1;
-            
+        if (!pev->read_suspended)
+        {
+            if (event_add(&pev->ev_read, NULL) != 0)
+                return -1;
+            // edge-triggered: данные могли прийти до включения;
+            // у tap прочитанное может ждать доставки
+            if (pev->uring || pev->tap_rd)
+                event_active(&pev->ev_read, EV_READ, 1);
+        }
+
         pev->enabled |= EV_READ;
     }
 
     if (events & EV_WRITE)
     {
         pev->enabled |= EV_WRITE;
-        /* start flushing if already has data */
+        /* start flushing if already has data. Приращения output,
+           добавленного при выключенной записи, уже забраны - ставим сами */
         if (!ip_is_empty(&pev->out))
-            pipev_ip_notify(pev);
+        {
+            pev->pending_flags |= PEV_PENDING_WRITE;
+            pipev_run_pending(pev);
+        }
     }
 
+    pipev_timer_update(pev);
     return 0;
 }
 
@@ -110,9 +256,140 @@ int pipeevent_disable(struct pipeevent *pev, short events)
         pev->enabled &= ~EV_WRITE;
     }
 
+    pipev_timer_update(pev);
+    return 0;
+}
+
+int pipeevent_relay(struct pipeevent *a, struct pipeevent *b,
+    size_t high_watermark)
+{
+    assert(a);
+    assert(b);
+
+    // пара обслуживается одним потоком: callbacks трогают сегменты и
+    // события пира без блокировок
+    if (a == b || a->base != b->base)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (a->relay || b->relay || a->file_left || b->file_left)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (!high_watermark)
+        high_watermark = PIPEEVENT_RELAY_HWM;
+
+    a->relay = b;
+    b->relay = a;
+    a->relay_hwm = b->relay_hwm = high_watermark;
+    a->relay_flags = b->relay_flags = 0;
+
+    // никаких callbacks на каждый кусок: input не используется,
+    // output пира обслуживается напрямую из pipev_on_readable
+    infinitypipe_setcb(&a->in, NULL, NULL);
+    infinitypipe_setcb(&a->out, NULL, NULL);
+    infinitypipe_setcb(&b->in, NULL, NULL);
+    infinitypipe_setcb(&b->out, NULL, NULL);
+
+    // то, что уже прочитано, отправляем дальше
+    infinitypipe_move(&b->out, &a->in, INFINITYPIPE_MAX_SPLICE_AT_ONCE);
+    infinitypipe_move(&a->out, &b->in, INFINITYPIPE_MAX_SPLICE_AT_ONCE);
+
+    if (pipeevent_enable(a, EV_READ|EV_WRITE) != 0 ||
+        pipeevent_enable(b, EV_READ|EV_WRITE) != 0)
+    {
+        pipeevent_unrelay(a);
+        return -1;
+    }
+
+    pipev_flush_output(a);
+    pipev_flush_output(b);
+
     return 0;
 }
 
+void pipeevent_unrelay(struct pipeevent *pev)
+{
+    assert(pev);
+
+    struct pipeevent *peer = pev->relay;
+    if (!peer)
+        return;
+
+    // чтение в output пира уже в ядре - теперь оно ляжет в свой input
+    if (pev->ur_rd.busy && pev->ur_rd.ip == &peer->out)
+        pev->ur_rd.ip = &pev->in;
+    if (peer->ur_rd.busy && peer->ur_rd.ip == &pev->out)
+        peer->ur_rd.ip = &peer->in;
+
+    pev->relay = peer->relay = NULL;
+    pev->relay_flags = peer->relay_flags = 0;
+
+    infinitypipe_setcb(&pev->in, pipev_ip_notify, pev);
+    infinitypipe_setcb(&pev->out, pipev_ip_notify, pev);
+    infinitypipe_setcb(&peer->in, pipev_ip_notify, peer);
+    infinitypipe_setcb(&peer->out, pipev_ip_notify, peer);
+
+    // изменения за время relay никому не нужны
+    struct infinitypipe_info st;
+    infinitypipe_get_stat(&pev->in, &st);
+    infinitypipe_get_stat(&pev->out, &st);
+    infinitypipe_get_stat(&peer->in, &st);
+    infinitypipe_get_stat(&peer->out, &st);
+
+    pipev_unsuspend_read(pev, PEV_SUSPEND_RELAY);
+    pipev_unsuspend_read(peer, PEV_SUSPEND_RELAY);
+}
+
+void pipeevent_setwatermark(struct pipeevent *pev, short events,
+    size_t lowmark, size_t highmark)
+{
+    assert(pev);
+
+    if (events & EV_WRITE)
+    {
+        pev->wm_write_low = lowmark;
+        pev->wm_write_high = highmark;
+    }
+
+    if (events & EV_READ)
+    {
+        pev->wm_read_low = lowmark;
+        pev->wm_read_high = highmark;
+        pipev_check_read_wm(pev);
+    }
+}
+
+int pipeevent_getwatermark(struct pipeevent *pev, short events,
+    size_t *lowmark, size_t *highmark)
+{
+    assert(pev);
+
+    if (events == EV_WRITE)
+    {
+        if (lowmark)
+            *lowmark = pev->wm_write_low;
+        if (highmark)
+            *highmark = pev->wm_write_high;
+        return 0;
+    }
+
+    if (events == EV_READ)
+    {
+        if (lowmark)
+            *lowmark = pev->wm_read_low;
+        if (highmark)
+            *highmark = pev->wm_read_high;
+        return 0;
+    }
+
+    return -1;
+}
+
 void pipeevent_setcb(struct pipeevent *pev,
     pipeevent_data_cb readcb, pipeevent_data_cb writecb,
     pipeevent_event_cb eventcb, void *cb_ctx)
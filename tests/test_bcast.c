@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+#include "e4pipe/infinitypipe_struct.h"
+
+#include <event2/event.h>
+
+#include "test_util.h"
+
+enum { MSG = 16 * 1024, N_MSG = 64, LAG = 4 * MSG };
+
+struct sub
+{
+    int sv[2];
+    struct pipeevent *pev;
+    char *out;
+    size_t got;
+    int detached;
+};
+
+static void sub_init(struct sub *s, struct event_base *base)
+{
+    make_socketpair(s->sv);
+    s->pev = pipeevent_socket_new(base, s->sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(s->pev);
+    pipeevent_enable(s->pev, EV_WRITE);
+    s->out = malloc((size_t)MSG * N_MSG);
+    CHECK(s->out);
+    s->got = 0;
+    s->detached = 0;
+}
+
+static void sub_read(struct sub *s)
+{
+    ssize_t n;
+    while (s->got < (size_t)MSG * N_MSG &&
+        (n = read(s->sv[0], s->out + s->got, (size_t)MSG * N_MSG - s->got)) > 0)
+        s->got += (size_t)n;
+}
+
+static void sub_free(struct sub *s)
+{
+    pipeevent_free(s->pev);
+    close(s->sv[0]);
+    free(s->out);
+}
+
+static void on_detach(struct pipeevent_bcast *b, struct pipeevent *pev,
+    void *ctx)
+{
+    (void)b;
+    struct sub *s = (struct sub *)ctx;
+    CHECK(s->pev == pev);
+    s->detached++;
+}
+
+/* N_MSG сообщений: быстрый подписчик получает все, медленный (его
+   сокет не читают) упирается в max_lag */
+static void run_bcast(struct event_base *base,
+    enum pipeevent_bcast_policy policy, struct sub *fast, struct sub *slow)
+{
+    struct infinitypipe src;
+    CHECK(infinitypipe_init(&src, MSG, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    sub_init(fast, base);
+    sub_init(slow, base);
+
+    struct pipeevent_bcast *b = pipeevent_bcast_new(&src, LAG, policy);
+    CHECK(b);
+    pipeevent_bcast_setcb(b, on_detach, slow);
+
+    CHECK(pipeevent_bcast_subscribe(b, fast->pev) == 0);
+    CHECK(pipeevent_bcast_subscribe(b, slow->pev) == 0);
+    CHECK(pipeevent_bcast_subscribe(b, slow->pev) == -1 && errno == EBUSY);
+
+    static char msg[MSG];
+    for (int i = 0; i < N_MSG; ++i)
+    {
+        fill_pattern(msg, MSG, (size_t)i * MSG);
+        CHECK(infinitypipe_add(&src, msg, MSG) == MSG);
+        CHECK(pipeevent_bcast_dispatch(b) == MSG);
+        CHECK(infinitypipe_get_length(&src) == 0);
+
+        for (int k = 0; k < 4; ++k)
+        {
+            event_base_loop(base, EVLOOP_NONBLOCK);
+            sub_read(fast);
+        }
+    }
+
+    for (unsigned spins = 0; fast->got < (size_t)MSG * N_MSG; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        event_base_loop(base, EVLOOP_NONBLOCK);
+        sub_read(fast);
+    }
+
+    size_t queued, dropped;
+    CHECK(pipeevent_bcast_get_lag(fast->pev, &queued, &dropped) == 0);
+    CHECK(queued == 0 && dropped == 0);
+
+    // медленный подписчик дочитывает то, что ему досталось
+    if (!slow->detached)
+    {
+        CHECK(pipeevent_bcast_get_lag(slow->pev, &queued, &dropped) == 0);
+        CHECK(pipeevent_bcast_unsubscribe(slow->pev) == 0);
+    }
+    else
+    {
+        CHECK(pipeevent_bcast_get_lag(slow->pev, NULL, NULL) == -1 &&
+            errno == EINVAL);
+        dropped = 0;
+    }
+    for (unsigned spins = 0; ; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        size_t before = slow->got;
+        event_base_loop(base, EVLOOP_NONBLOCK);
+        sub_read(slow);
+        if (slow->got == before &&
+            infinitypipe_get_length(pipeevent_get_output(slow->pev)) == 0)
+            break;
+    }
+    if (!slow->detached)
+        CHECK(slow->got + dropped == (size_t)MSG * N_MSG);
+
+    pipeevent_bcast_free(b);
+    infinitypipe_free(&src);
+}
+
+/* DROP: быстрый получает всё, медленный - целые сообщения по порядку */
+static void test_bcast_drop(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    struct sub fast, slow;
+    run_bcast(base, PEV_BCAST_DROP, &fast, &slow);
+
+    static char msg[MSG];
+    for (int i = 0; i < N_MSG; ++i)
+    {
+        fill_pattern(msg, MSG, (size_t)i * MSG);
+        CHECK(memcmp(fast.out + (size_t)i * MSG, msg, MSG) == 0);
+    }
+
+    CHECK(slow.detached == 0);
+    CHECK(slow.got % MSG == 0);
+    CHECK(slow.got < (size_t)MSG * N_MSG);
+
+    // каждое сообщение медленного - одно из разосланных, номера растут
+    int next = 0;
+    for (size_t off = 0; off < slow.got; off += MSG)
+    {
+        int found = -1;
+        for (int i = next; i < N_MSG && found < 0; ++i)
+        {
+            fill_pattern(msg, MSG, (size_t)i * MSG);
+            if (memcmp(slow.out + off, msg, MSG) == 0)
+                found = i;
+        }
+        CHECK(found >= 0);
+        next = found + 1;
+    }
+
+    sub_free(&fast);
+    sub_free(&slow);
+    event_base_free(base);
+}
+
+/* DETACH: медленный отключается один раз, с detachcb */
+static void test_bcast_detach(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    struct sub fast, slow;
+    run_bcast(base, PEV_BCAST_DETACH, &fast, &slow);
+
+    CHECK(slow.detached == 1);
+    CHECK(slow.got % MSG == 0);
+
+    static char msg[MSG];
+    for (size_t off = 0; off < slow.got; off += MSG)
+    {
+        fill_pattern(msg, MSG, off);
+        CHECK(memcmp(slow.out + off, msg, MSG) == 0);
+    }
+
+    sub_free(&fast);
+    sub_free(&slow);
+    event_base_free(base);
+}
+
+int main(void)
+{
+    test_bcast_drop();
+    test_bcast_detach();
+    return 0;
+}
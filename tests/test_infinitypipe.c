@@ -0,0 +1,777 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/infinitybuf.h"
+#include "e4pipe/infinitypipe.h"
+#include "e4pipe/infinitypipe_struct.h"
+
+#include <event2/buffer.h>
+#include <sys/mman.h>
+
+#include "test_util.h"
+
+/* сверх max_size - в файл вытеснения, на выходе тот же порядок байт */
+static void test_spill_refill(void)
+{
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = 16u * 1024u;
+    cfg.max_size = 64u * 1024u;
+    cfg.spill_max = 4u * 1024u * 1024u;
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init_config(&ip, &cfg) == 0);
+
+    size_t len = 1024u * 1024u;
+    char *data = malloc(len);
+    char *out = malloc(len);
+    CHECK(data && out);
+    fill_pattern(data, len, 1);
+
+    ingest(&ip, data, len);
+    CHECK(infinitypipe_get_spill_length(&ip) > 0);
+    CHECK(infinitypipe_get_length(&ip) + infinitypipe_get_spill_length(&ip) ==
+        len);
+
+    CHECK(drain(&ip, out, len) == len);
+    CHECK(memcmp(out, data, len) == 0);
+    CHECK(infinitypipe_get_spill_length(&ip) == 0);
+    CHECK(infinitypipe_get_length(&ip) == 0);
+
+    infinitypipe_free(&ip);
+    free(data);
+    free(out);
+}
+
+/* add не выходит за max_size: без вытеснения остаток - EAGAIN,
+   с вытеснением - в файл, порядок байт тот же */
+static void test_add_limits(void)
+{
+    enum { MAX = 64 * 1024, LEN = 200 * 1024 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 19);
+
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = 16u * 1024u;
+    cfg.max_size = MAX;
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init_config(&ip, &cfg) == 0);
+    CHECK(infinitypipe_add(&ip, data, LEN) == MAX);
+    errno = 0;
+    CHECK(infinitypipe_add(&ip, data, 1) == -1 && errno == EAGAIN);
+    CHECK(infinitypipe_get_length(&ip) == MAX);
+    infinitypipe_free(&ip);
+
+    cfg.spill_max = 1024u * 1024u;
+    CHECK(infinitypipe_init_config(&ip, &cfg) == 0);
+
+    // два буфера: граница max_size внутри первого
+    struct iovec v[2];
+    v[0].iov_base = data;
+    v[0].iov_len = LEN / 2;
+    v[1].iov_base = data + LEN / 2;
+    v[1].iov_len = LEN - LEN / 2;
+    CHECK(infinitypipe_addv(&ip, v, 2) == LEN);
+    CHECK(infinitypipe_get_length(&ip) == MAX);
+    CHECK(infinitypipe_get_spill_length(&ip) == LEN - MAX);
+
+    CHECK(drain(&ip, out, LEN) == LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+    infinitypipe_free(&ip);
+}
+
+/* мелкие сегменты от tee_append сливаются, слив отдаёт те же байты */
+static void test_compact_drain(void)
+{
+    struct infinitypipe dst;
+    CHECK(infinitypipe_init(&dst, 64u * 1024u, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    enum { PARTS = 64, PART = 1000 };
+    char data[PARTS * PART];
+    char out[PARTS * PART];
+    fill_pattern(data, sizeof(data), 7);
+
+    for (int k = 0; k < PARTS; ++k)
+    {
+        struct infinitypipe src;
+        CHECK(infinitypipe_init(&src, 64u * 1024u, IP_NONBLOCK|IP_CLOEXEC) == 0);
+        CHECK(infinitypipe_add(&src, data + k * PART, PART) == PART);
+        CHECK(infinitypipe_tee_append(&dst, &src) == PART);
+        infinitypipe_free(&src);
+    }
+
+    size_t segs = dst.n_segs;
+    CHECK(segs == PARTS);
+    CHECK(infinitypipe_compact(&dst) > 0);
+    CHECK(dst.n_segs < segs);
+    CHECK(infinitypipe_get_length(&dst) == sizeof(data));
+
+    // сначала часть, потом остаток: граница внутри слитого сегмента
+    CHECK(drain(&dst, out, 2500) == 2500);
+    CHECK(drain(&dst, out + 2500, sizeof(out) - 2500) == sizeof(out) - 2500);
+    CHECK(memcmp(out, data, sizeof(data)) == 0);
+
+    infinitypipe_free(&dst);
+}
+
+/* уплотнение IP_MODE_COMPACT внутри tee_append доливает в сегмент
+   отметки: отметка больше не действует, а не указывает чужую границу */
+static void test_compact_mark(void)
+{
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = 64u * 1024u;
+    cfg.mode = IP_MODE_COMPACT;
+
+    struct infinitypipe dst;
+    CHECK(infinitypipe_init_config(&dst, &cfg) == 0);
+
+    enum { PARTS = 16, PART = 1000 };
+    char data[(PARTS + 1) * PART];
+    char out[(PARTS + 1) * PART];
+    fill_pattern(data, sizeof(data), 13);
+
+    CHECK(infinitypipe_add(&dst, data, PART) == PART);
+    struct infinitypipe_mark m;
+    infinitypipe_mark(&dst, &m);
+
+    for (int k = 1; k <= PARTS; ++k)
+    {
+        struct infinitypipe src;
+        CHECK(infinitypipe_init(&src, 64u * 1024u, IP_NONBLOCK|IP_CLOEXEC) == 0);
+        CHECK(infinitypipe_add(&src, data + k * PART, PART) == PART);
+        CHECK(infinitypipe_tee_append(&dst, &src) == PART);
+        infinitypipe_free(&src);
+    }
+    CHECK(dst.n_segs < PARTS);
+
+    errno = 0;
+    CHECK(infinitypipe_insert_at_mark(&dst, &m, "X", 1) == -1);
+    CHECK(errno == EINVAL);
+
+    int p[2];
+    CHECK(pipe2(p, O_NONBLOCK) == 0);
+    errno = 0;
+    CHECK(infinitypipe_tee_pipe(&dst, &m, p[1], sizeof(data)) == -1);
+    CHECK(errno == EINVAL);
+    close(p[0]);
+    close(p[1]);
+
+    CHECK(drain(&dst, out, sizeof(out)) == sizeof(out));
+    CHECK(memcmp(out, data, sizeof(data)) == 0);
+
+    infinitypipe_free(&dst);
+}
+
+/* prepend и insert_at_mark в буфер, голову которого уже отправили */
+static void test_insert_partly_drained(void)
+{
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, 4096, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    enum { LEN = 256 * 1024, TAIL = 2000 };
+    static char data[LEN + TAIL];
+    static char out[LEN + TAIL + 16];
+    fill_pattern(data, sizeof(data), 3);
+
+    // отметка в первом сегменте, который уйдёт целиком
+    CHECK(infinitypipe_add(&ip, data, 100) == 100);
+    struct infinitypipe_mark gone;
+    infinitypipe_mark(&ip, &gone);
+    CHECK(infinitypipe_add(&ip, data + 100, LEN - 100) == LEN - 100);
+    CHECK(ip.n_segs > 1);
+
+    // голова и ещё часть следующего сегмента
+    size_t sent = ip.head->len + 1000;
+    CHECK(drain(&ip, out, sent) == sent);
+    CHECK(memcmp(out, data, sent) == 0);
+
+    struct infinitypipe_mark m;
+    infinitypipe_mark(&ip, &m);
+    CHECK(infinitypipe_insert_at_mark(&ip, &m, "MID", 3) == 3);
+    CHECK(infinitypipe_add(&ip, data + LEN, TAIL) == TAIL);
+    CHECK(infinitypipe_prepend(&ip, "HDR", 3) == 3);
+
+    // сегмента отметки уже нет в буфере
+    errno = 0;
+    CHECK(infinitypipe_insert_at_mark(&ip, &gone, "X", 1) == -1);
+    CHECK(errno == EINVAL);
+
+    size_t left = 3 + (LEN - sent) + 3 + TAIL;
+    CHECK(infinitypipe_get_length(&ip) == left);
+    CHECK(drain(&ip, out, left) == left);
+
+    char *p = out;
+    CHECK(memcmp(p, "HDR", 3) == 0);
+    p += 3;
+    CHECK(memcmp(p, data + sent, LEN - sent) == 0);
+    p += LEN - sent;
+    CHECK(memcmp(p, "MID", 3) == 0);
+    p += 3;
+    CHECK(memcmp(p, data + LEN, TAIL) == 0);
+
+    infinitypipe_free(&ip);
+}
+
+/* полные сегменты не в хвосте запечатаны, данные из них читаются */
+static void test_sealed_segments(void)
+{
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, 4096, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    enum { LEN = 64 * 1024 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, sizeof(data), 11);
+
+    CHECK(infinitypipe_add(&ip, data, LEN) == LEN);
+    CHECK(ip.n_segs > 1);
+
+    size_t sealed = 0;
+    for (struct infinityseg *s = ip.head; s; s = s->next)
+    {
+        if (s != ip.tail && s->len >= s->cap)
+        {
+            CHECK(s->p[1] < 0);
+            ++sealed;
+        }
+    }
+    CHECK(sealed > 0);
+    CHECK(ip.tail->p[1] >= 0);
+
+    CHECK(drain(&ip, out, LEN) == LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    infinitypipe_free(&ip);
+}
+
+/* сегменты копии tee_append берутся и отдаются через счётчики dst */
+static void test_tee_counters(void)
+{
+    struct infinitypipe src, dst;
+    CHECK(infinitypipe_init(&src, 4096, IP_NONBLOCK|IP_CLOEXEC) == 0);
+    CHECK(infinitypipe_init(&dst, 4096, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    struct infinitypipe_counters c;
+    if (infinitypipe_get_counters(&dst, &c) != 0)
+    {
+        // сборка без E4PIPE_WITH_COUNTERS
+        CHECK(errno == ENOSYS);
+        infinitypipe_free(&src);
+        infinitypipe_free(&dst);
+        return;
+    }
+
+    enum { LEN = 32 * 1024 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, sizeof(data), 13);
+
+    CHECK(infinitypipe_add(&src, data, LEN) == LEN);
+    CHECK(infinitypipe_tee_append(&dst, &src) == LEN);
+
+    CHECK(infinitypipe_get_counters(&dst, &c) == 0);
+    CHECK(c.segs_live == dst.n_segs);
+    CHECK(c.segs_created - c.segs_freed == c.segs_live);
+
+    CHECK(drain(&dst, out, LEN) == LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    CHECK(infinitypipe_get_counters(&dst, &c) == 0);
+    CHECK(c.segs_live == 0);
+    CHECK(c.segs_created == c.segs_freed);
+    CHECK(c.segs_created > 0);
+
+    infinitypipe_free(&src);
+    infinitypipe_free(&dst);
+}
+
+/* peek и search не меняют буфер, совпадение на границе сегментов и
+   окна поиска находится; readln забирает строку вместе с концом строки */
+static void test_peek_search(void)
+{
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, 4096, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    enum { LEN = 40 * 1024 };
+    static char data[LEN];
+    memset(data, 'a', sizeof(data));
+    // через границу сегментов (4096) и окна поиска (16 KiB)
+    memcpy(data + 4094, "XYZ", 3);
+    memcpy(data + 16383, "\r\nQ", 3);
+    data[LEN - 1] = '\n';
+    CHECK(infinitypipe_add(&ip, data, LEN) == LEN);
+    CHECK(ip.n_segs > 1);
+
+    static char buf[LEN];
+    CHECK(infinitypipe_peek(&ip, 4000, buf, 200) == 200);
+    CHECK(memcmp(buf, data + 4000, 200) == 0);
+    CHECK(infinitypipe_peek(&ip, LEN - 10, buf, 100) == 10);
+    CHECK(infinitypipe_get_length(&ip) == LEN);
+
+    CHECK(infinitypipe_search(&ip, "XYZ", 3, 0) == 4094);
+    CHECK(infinitypipe_search(&ip, "XYZ", 3, 4095) == -1);
+    CHECK(infinitypipe_search(&ip, "\r\nQ", 3, 0) == 16383);
+    CHECK(infinitypipe_search(&ip, "nope", 4, 0) == -1);
+    CHECK(infinitypipe_search(&ip, "", 0, 0) == -1 && errno == EINVAL);
+
+    size_t n = 0;
+    char *line = infinitypipe_readln(&ip, &n, IP_EOL_CRLF_STRICT);
+    CHECK(line && n == 16383);
+    CHECK(memcmp(line, data, n) == 0 && line[n] == '\0');
+    free(line);
+    CHECK(infinitypipe_get_length(&ip) == LEN - 16385);
+
+    line = infinitypipe_readln(&ip, &n, IP_EOL_LF);
+    CHECK(line && n == LEN - 16385 - 1);
+    CHECK(memcmp(line, data + 16385, n) == 0);
+    free(line);
+    CHECK(infinitypipe_get_length(&ip) == 0);
+
+    // неполной строки нет - буфер не трогается
+    CHECK(infinitypipe_add(&ip, "tail", 4) == 4);
+    CHECK(infinitypipe_readln(&ip, &n, IP_EOL_LF) == NULL);
+    CHECK(infinitypipe_get_length(&ip) == 4);
+
+    infinitypipe_free(&ip);
+}
+
+/* copyout и removev раскладывают байты по iovec разной длины поперёк
+   границ сегментов; copyout буфер не меняет */
+static void test_removev(void)
+{
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, 4096, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    enum { LEN = 20 * 1024 };
+    static char data[LEN];
+    // с запасом под iovec длиннее остатка
+    static char out[2 * LEN];
+    fill_pattern(data, sizeof(data), 47);
+    CHECK(infinitypipe_add(&ip, data, LEN) == LEN);
+
+    // 1, 7, 4093, 5000, 1, ... - куски не совпадают с сегментами
+    static const size_t lens[] = { 1, 7, 4093, 0, 5000, 1, 3000, 8000 };
+    enum { N = sizeof(lens) / sizeof(lens[0]) };
+    struct iovec vec[N];
+    size_t room = 0;
+    for (int i = 0; i < N; ++i)
+    {
+        vec[i].iov_base = out + room;
+        vec[i].iov_len = lens[i];
+        room += lens[i];
+    }
+    CHECK(room < LEN);
+
+    memset(out, 0, sizeof(out));
+    CHECK(infinitypipe_copyout(&ip, vec, N) == (ssize_t)room);
+    CHECK(memcmp(out, data, room) == 0);
+    CHECK(infinitypipe_get_length(&ip) == LEN);
+
+    memset(out, 0, sizeof(out));
+    CHECK(infinitypipe_removev(&ip, vec, N) == (ssize_t)room);
+    CHECK(memcmp(out, data, room) == 0);
+    CHECK(infinitypipe_get_length(&ip) == LEN - room);
+
+    // iovec длиннее остатка - забирается всё, что есть
+    struct iovec rest = { out + room, LEN };
+    CHECK(infinitypipe_removev(&ip, &rest, 1) == (ssize_t)(LEN - room));
+    CHECK(memcmp(out, data, LEN) == 0);
+    CHECK(infinitypipe_get_length(&ip) == 0);
+    CHECK(infinitypipe_removev(&ip, NULL, -1) == -1 && errno == EINVAL);
+
+    infinitypipe_free(&ip);
+}
+
+/* пул держит не больше max_count пустых сегментов и отдаёт их обратно;
+   infinitypipe с пулом возвращает туда опустевшие сегменты */
+static void test_segment_pool(void)
+{
+    enum { CAP = 16 * 1024, MAX = 4, LEN = 8 * CAP };
+    const int flags = IP_NONBLOCK|IP_CLOEXEC;
+
+    struct infinityseg_pool pool = { 0 };
+    infinityseg_pool_init(&pool, CAP, flags, MAX);
+    CHECK(infinityseg_pool_prewarm(&pool, 2 * MAX) == MAX);
+    CHECK(pool.count == MAX);
+
+    struct infinityseg *head = pool.head;
+    struct infinityseg *s = infinityseg_pool_get(&pool, CAP, flags);
+    CHECK(s == head);
+    CHECK(pool.count == MAX - 1);
+
+    // непустой сегмент в пул не попадает
+    CHECK(infinityseg_write(s, "x", 1) == 1);
+    infinityseg_pool_put(&pool, s);
+    CHECK(pool.count == MAX - 1);
+
+    // сверх max_count сегменты закрываются
+    infinityseg_pool_put(&pool, infinityseg_pool_get(NULL, CAP, flags));
+    CHECK(pool.count == MAX);
+    infinityseg_pool_put(&pool, infinityseg_pool_get(NULL, CAP, flags));
+    CHECK(pool.count == MAX);
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, CAP, flags) == 0);
+    infinitypipe_set_pool(&ip, &pool);
+
+    static char data[LEN];
+    static char out[LEN];
+    for (int round = 0; round < 2; ++round)
+    {
+        fill_pattern(data, LEN, 71 + (size_t)round);
+        CHECK(infinitypipe_add(&ip, data, LEN) == LEN);
+        CHECK(pool.count == 0);
+        CHECK(drain(&ip, out, LEN) == LEN);
+        CHECK(memcmp(out, data, LEN) == 0);
+        CHECK(pool.count > 0 && pool.count <= MAX);
+    }
+
+    infinitypipe_free(&ip);
+    infinityseg_pool_clear(&pool);
+    CHECK(pool.count == 0 && pool.head == NULL);
+}
+
+/* сверх бюджета fd сегменты не выдаются (EAGAIN), splice_in
+   останавливается; освобождённое возвращается в бюджет */
+static void test_segment_budget(void)
+{
+    enum { CAP = 16 * 1024, LEN = 4 * CAP };
+    const int flags = IP_NONBLOCK|IP_CLOEXEC;
+
+    struct infinityseg_budget saved, b;
+    infinityseg_budget_get(&saved);
+
+    // ровно один сегмент сверх занятого
+    infinityseg_budget_set(saved.fds + 2, 0);
+    struct infinityseg *s = infinityseg_new(CAP, flags);
+    CHECK(s);
+    CHECK(infinityseg_new(CAP, flags) == NULL && errno == EAGAIN);
+    infinityseg_budget_get(&b);
+    CHECK(b.fds == saved.fds + 2);
+    CHECK(b.n_denied == saved.n_denied + 1);
+
+    infinityseg_free(s);
+    infinityseg_budget_get(&b);
+    CHECK(b.fds == saved.fds);
+    s = infinityseg_new(CAP, flags);
+    CHECK(s);
+    infinityseg_free(s);
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, CAP, flags) == 0);
+    infinitypipe_set_pool(&ip, NULL);
+
+    int sv[2];
+    make_socketpair(sv);
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 73);
+    CHECK(write(sv[0], data, LEN) == LEN);
+
+    infinityseg_budget_get(&b);
+    infinityseg_budget_set(b.fds + 2, 0);
+    size_t got = 0;
+    ssize_t rc;
+    while ((rc = infinitypipe_splice_in(&ip, sv[1], LEN - got)) > 0)
+        got += (size_t)rc;
+    CHECK(rc < 0 && errno == EAGAIN);
+    CHECK(got > 0 && got < LEN);
+
+    // бюджет снят - чтение продолжается с того же места
+    infinityseg_budget_set(saved.max_fds, saved.max_bytes);
+    while (got < LEN && (rc = infinitypipe_splice_in(&ip, sv[1], LEN - got)) > 0)
+        got += (size_t)rc;
+    CHECK(got == LEN);
+    CHECK(drain(&ip, out, LEN) == LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    infinitypipe_free(&ip);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/* discard: частичная голова и целые сегменты; опустевшие пайпы уходят
+   в пул, остаток буфера - те же байты со сдвигом */
+static void test_discard(void)
+{
+    enum { CAP = 16 * 1024, LEN = 8 * CAP, MAX = 2 };
+    const int flags = IP_NONBLOCK|IP_CLOEXEC;
+
+    struct infinityseg_pool pool = { 0 };
+    infinityseg_pool_init(&pool, CAP, flags, MAX);
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, CAP, flags) == 0);
+    infinitypipe_set_pool(&ip, &pool);
+
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 79);
+    CHECK(infinitypipe_add(&ip, data, LEN) == LEN);
+    size_t segs = ip.n_segs;
+    CHECK(segs == LEN / CAP);
+
+    CHECK(infinitypipe_discard(&ip, 100) == 100);
+    CHECK(ip.n_segs == segs);
+    CHECK(pool.count == 0);
+
+    // остаток головы и три целых сегмента, два из них попадают в пул
+    CHECK(infinitypipe_discard(&ip, 4 * CAP - 100) == 4 * CAP - 100);
+    CHECK(ip.n_segs == segs - 4);
+    CHECK(pool.count == MAX);
+    CHECK(infinitypipe_get_length(&ip) == LEN - 4 * CAP);
+
+    CHECK(infinitypipe_discard(&ip, CAP / 2) == CAP / 2);
+    size_t rest = LEN - 4 * CAP - CAP / 2;
+    CHECK(drain(&ip, out, rest) == rest);
+    CHECK(memcmp(out, data + LEN - rest, rest) == 0);
+
+    // больше, чем есть - отбрасывается всё
+    CHECK(infinitypipe_add(&ip, data, CAP) == CAP);
+    CHECK(infinitypipe_discard(&ip, LEN) == CAP);
+    CHECK(infinitypipe_get_length(&ip) == 0);
+
+    infinitypipe_free(&ip);
+    infinityseg_pool_clear(&pool);
+}
+
+/* IP_MODE_ADAPTIVE: крупные пачки растят ёмкость новых сегментов до
+   seg_max, мелкие возвращают её к seg_min; FIONREAD - сразу под очередь */
+static void test_adaptive_capacity(void)
+{
+    enum { MIN = 4096, MAX = 256 * 1024, BULK = 128 * 1024 };
+
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = MIN;
+    cfg.seg_min = MIN;
+    cfg.seg_max = MAX;
+    cfg.mode = IP_MODE_ADAPTIVE;
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init_config(&ip, &cfg) == 0);
+    CHECK(infinitypipe_get_seg_capacity(&ip) == MIN);
+
+    int sv[2];
+    make_socketpair(sv);
+    static char data[BULK];
+    static char out[BULK];
+
+    // пачка: len байт в сокет, splice_in одним вызовом, буфер пустеет
+    for (int round = 0; round < 16; ++round)
+    {
+        fill_pattern(data, BULK, (size_t)round);
+        size_t sent = 0, got = 0;
+        while (got < BULK)
+        {
+            ssize_t n;
+            if (sent < BULK && (n = write(sv[0], data + sent, BULK - sent)) > 0)
+                sent += (size_t)n;
+            ssize_t rc = infinitypipe_splice_in(&ip, sv[1], BULK - got);
+            if (rc > 0)
+                got += (size_t)rc;
+        }
+        CHECK(drain(&ip, out, BULK) == BULK);
+        CHECK(memcmp(out, data, BULK) == 0);
+    }
+    size_t cap = infinitypipe_get_seg_capacity(&ip);
+    CHECK(cap > MIN && cap <= MAX);
+    CHECK((cap & (cap - 1)) == 0);
+
+    for (int round = 0; round < 64; ++round)
+    {
+        CHECK(write(sv[0], data, 100) == 100);
+        CHECK(infinitypipe_splice_in(&ip, sv[1], BULK) == 100);
+        CHECK(drain(&ip, out, 100) == 100);
+    }
+    CHECK(infinitypipe_splice_in(&ip, sv[1], BULK) == -1 && errno == EAGAIN);
+    CHECK(infinitypipe_get_seg_capacity(&ip) == MIN);
+    infinitypipe_free(&ip);
+
+    // FIONREAD: первый же сегмент под всю очередь сокета
+    cfg.mode = IP_MODE_ADAPTIVE|IP_MODE_FIONREAD;
+    CHECK(infinitypipe_init_config(&ip, &cfg) == 0);
+    enum { QUEUED = 32 * 1024 };
+    CHECK(write(sv[0], data, QUEUED) == QUEUED);
+    CHECK(infinitypipe_splice_in(&ip, sv[1], BULK) == QUEUED);
+    CHECK(infinitypipe_get_seg_capacity(&ip) >= QUEUED);
+    CHECK(ip.n_segs == 1);
+    CHECK(drain(&ip, out, QUEUED) == QUEUED);
+    CHECK(memcmp(out, data, QUEUED) == 0);
+
+    infinitypipe_free(&ip);
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/* add_reference: страницы ссылаются из пайпа, на выходе те же байты;
+   подарок - только целыми страницами; мелкие add дописываются в tail */
+static void test_add_reference(void)
+{
+    enum { CAP = 64 * 1024, LEN = 256 * 1024 };
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, CAP, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 97);
+
+    // без подарка выравнивание не нужно
+    CHECK(infinitypipe_add_reference(&ip, data + 1, LEN - 1, 0) == LEN - 1);
+    CHECK(drain(&ip, out, LEN - 1) == LEN - 1);
+    CHECK(memcmp(out, data + 1, LEN - 1) == 0);
+
+    char *gift = mmap(NULL, LEN, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    CHECK(gift != MAP_FAILED);
+    memcpy(gift, data, LEN);
+    CHECK(infinitypipe_add_reference(&ip, gift + 1, page, IP_ADD_GIFT) == -1 &&
+        errno == EINVAL);
+    CHECK(infinitypipe_add_reference(&ip, gift, page + 1, IP_ADD_GIFT) == -1 &&
+        errno == EINVAL);
+    CHECK(infinitypipe_get_length(&ip) == 0);
+    CHECK(infinitypipe_add_reference(&ip, gift, LEN, IP_ADD_GIFT) == LEN);
+    CHECK(drain(&ip, out, LEN) == LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+    munmap(gift, LEN);
+
+    // мелкие записи ложатся в один сегмент
+    enum { SMALL = 10, N_SMALL = 1000 };
+    for (int i = 0; i < N_SMALL; ++i)
+        CHECK(infinitypipe_add(&ip, data + i * SMALL, SMALL) == SMALL);
+    CHECK(ip.n_segs == 1);
+    CHECK(drain(&ip, out, SMALL * N_SMALL) == SMALL * N_SMALL);
+    CHECK(memcmp(out, data, SMALL * N_SMALL) == 0);
+
+    infinitypipe_free(&ip);
+}
+
+/* мост с evbuffer: кусков больше, чем iovec за проход, границы
+   max_bytes и max_size внутри кусков, порядок байт сохраняется */
+static void test_evbuffer_bridge(void)
+{
+    enum { PIECE = 777, N_PIECE = 40, LEN = PIECE * N_PIECE, MAX = 16 * 1024 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 101);
+
+    struct evbuffer *src = evbuffer_new();
+    struct evbuffer *dst = evbuffer_new();
+    CHECK(src && dst);
+    for (int i = 0; i < N_PIECE; ++i)
+        CHECK(evbuffer_add_reference(src, data + i * PIECE, PIECE,
+            NULL, NULL) == 0);
+
+    struct infinitypipe_config cfg;
+    infinitypipe_config_init(&cfg);
+    cfg.seg_capacity = 4096;
+    cfg.max_size = MAX;
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init_config(&ip, &cfg) == 0);
+
+    CHECK(infinitypipe_read(&ip, src, 1000) == 1000);
+    CHECK(evbuffer_get_length(src) == LEN - 1000);
+    CHECK(infinitypipe_read(&ip, src, LEN) == MAX - 1000);
+    CHECK(infinitypipe_get_length(&ip) == MAX);
+    CHECK(evbuffer_get_length(src) == LEN - MAX);
+
+    size_t got = 0;
+    while (got < LEN)
+    {
+        CHECK(infinitypipe_write(&ip, dst, 3000) > 0);
+        ev_ssize_t n = evbuffer_remove(dst, out + got, LEN - got);
+        CHECK(n > 0);
+        got += (size_t)n;
+        if (evbuffer_get_length(src))
+            CHECK(infinitypipe_read(&ip, src, LEN) > 0);
+    }
+    CHECK(infinitypipe_get_length(&ip) == 0);
+    CHECK(infinitypipe_write(&ip, dst, LEN) == 0);
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    infinitypipe_free(&ip);
+    evbuffer_free(src);
+    evbuffer_free(dst);
+}
+
+/* файл с позиции offset в буфер и из буфера в другой файл: позиция
+   файла не двигается, *offset сдвигается на переданное */
+static void test_file_splice(void)
+{
+    enum { LEN = 1024 * 1024, SKIP = 1000, AT = 500 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 107);
+
+    char src_path[] = "/tmp/e4pipe-file-XXXXXX";
+    char dst_path[] = "/tmp/e4pipe-file-XXXXXX";
+    int src = mkstemp(src_path);
+    int dst = mkstemp(dst_path);
+    CHECK(src >= 0 && dst >= 0);
+    unlink(src_path);
+    unlink(dst_path);
+    CHECK(write(src, data, LEN) == LEN);
+    CHECK(lseek(src, 7, SEEK_SET) == 7);
+
+    struct infinitypipe ip;
+    CHECK(infinitypipe_init(&ip, 64u * 1024u, IP_NONBLOCK|IP_CLOEXEC) == 0);
+
+    off_t off = SKIP;
+    size_t got = 0;
+    while (got < LEN - SKIP)
+    {
+        ssize_t rc = infinitypipe_splice_in_file(&ip, src, &off,
+            LEN - SKIP - got);
+        CHECK(rc > 0);
+        got += (size_t)rc;
+        CHECK(off == (off_t)(SKIP + got));
+    }
+    CHECK(infinitypipe_splice_in_file(&ip, src, &off, LEN) == 0);
+    CHECK(lseek(src, 0, SEEK_CUR) == 7);
+    CHECK(infinitypipe_get_length(&ip) == LEN - SKIP);
+
+    off = AT;
+    size_t put = 0;
+    while (put < LEN - SKIP)
+    {
+        ssize_t rc = infinitypipe_splice_out_file(&ip, dst, &off, LEN);
+        CHECK(rc > 0);
+        put += (size_t)rc;
+        CHECK(off == (off_t)(AT + put));
+    }
+    CHECK(infinitypipe_get_length(&ip) == 0);
+    CHECK(lseek(dst, 0, SEEK_CUR) == 0);
+    CHECK(pread(dst, out, LEN, AT) == LEN - SKIP);
+    CHECK(memcmp(out, data + SKIP, LEN - SKIP) == 0);
+
+    infinitypipe_free(&ip);
+    close(src);
+    close(dst);
+}
+
+int main(void)
+{
+    test_spill_refill();
+    test_add_limits();
+    test_compact_drain();
+    test_compact_mark();
+    test_insert_partly_drained();
+    test_sealed_segments();
+    test_tee_counters();
+    test_peek_search();
+    test_removev();
+    test_segment_pool();
+    test_segment_budget();
+    test_discard();
+    test_adaptive_capacity();
+    test_add_reference();
+    test_evbuffer_bridge();
+    test_file_splice();
+    return 0;
+}
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+
+#include "test_util.h"
+
+static void on_read(struct pipeevent *pev, void *ctx)
+{
+    (void)pev;
+    ++*(int *)ctx;
+}
+
+/* порог чтения на сокете: ядро будит fd, когда пришло rcvlowat байт;
+   set_lowat(0, 0) снимает его */
+static void test_lowat_socket(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    int calls = 0;
+    pipeevent_setcb(pev, on_read, NULL, NULL, &calls);
+    pipeevent_enable(pev, EV_READ);
+
+    // не TCP - порога отправки нет
+    CHECK(pipeevent_set_lowat(pev, 0, 4096) == -1 && errno == ENOPROTOOPT);
+
+    enum { LOWAT = 4096 };
+    CHECK(pipeevent_set_lowat(pev, LOWAT, 0) == 0);
+    int v = 0;
+    socklen_t len = sizeof(v);
+    CHECK(getsockopt(sv[1], SOL_SOCKET, SO_RCVLOWAT, &v, &len) == 0);
+    CHECK(v == LOWAT);
+
+    static char data[LOWAT];
+    fill_pattern(data, sizeof(data), 43);
+    struct infinitypipe *in = pipeevent_get_input(pev);
+
+    CHECK(write(sv[0], data, LOWAT) == LOWAT);
+    for (unsigned spins = 0; infinitypipe_get_length(in) < LOWAT; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    CHECK(calls > 0);
+
+    static char out[LOWAT];
+    CHECK(infinitypipe_remove(in, out, LOWAT) == LOWAT);
+    CHECK(memcmp(out, data, LOWAT) == 0);
+
+    CHECK(pipeevent_set_lowat(pev, 0, 0) == 0);
+    CHECK(getsockopt(sv[1], SOL_SOCKET, SO_RCVLOWAT, &v, &len) == 0);
+    CHECK(v == 1);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+}
+
+/* на пайпе порогов нет: снять их можно, выставить - ENOTSOCK */
+static void test_lowat_pipe(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int p[2];
+    CHECK(pipe2(p, O_NONBLOCK|O_CLOEXEC) == 0);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, p[0], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    CHECK(pipeevent_set_lowat(pev, 0, 0) == 0);
+    CHECK(pipeevent_set_lowat(pev, 0, 0) == 0);
+    CHECK(pipeevent_set_lowat(pev, 4096, 0) == -1 && errno == ENOTSOCK);
+    CHECK(pipeevent_set_lowat(pev, 0, 0) == 0);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(p[1]);
+}
+
+int main(void)
+{
+    test_lowat_socket();
+    test_lowat_pipe();
+    return 0;
+}
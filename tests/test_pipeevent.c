@@ -0,0 +1,399 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+#include <stdint.h>
+
+#include "test_util.h"
+
+/* a[0] -> relay a[1] <-> b[1] -> b[0]: байты на выходе те же и в том же
+   порядке; uring - через движок io_uring, если ядро его даёт */
+static void test_relay(int uring)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    struct pipeevent_uring *r = NULL;
+    if (uring)
+    {
+        r = pipeevent_uring_new(base, 0);
+        if (!r)
+        {
+            printf("relay over io_uring skipped: %s\n", strerror(errno));
+            event_base_free(base);
+            return;
+        }
+    }
+
+    int a[2];
+    int b[2];
+    make_socketpair(a);
+    make_socketpair(b);
+
+    struct pipeevent *pa =
+        pipeevent_socket_new(base, a[1], PEV_OPT_CLOSE_ON_FREE);
+    struct pipeevent *pb =
+        pipeevent_socket_new(base, b[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pa && pb);
+    if (r)
+    {
+        CHECK(pipeevent_set_uring(pa, r) == 0);
+        CHECK(pipeevent_set_uring(pb, r) == 0);
+    }
+
+    CHECK(pipeevent_relay(pa, pb, 0) == 0);
+    pipeevent_enable(pa, EV_READ|EV_WRITE);
+    pipeevent_enable(pb, EV_READ|EV_WRITE);
+
+    size_t len = 4u * 1024u * 1024u;
+    char *data = malloc(len);
+    char *out = malloc(len);
+    CHECK(data && out);
+    fill_pattern(data, len, 5);
+
+    size_t sent = 0;
+    size_t got = 0;
+    for (unsigned spins = 0; got < len; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        while (sent < len)
+        {
+            size_t n = len - sent;
+            if (n > 65536)
+                n = 65536;
+            ssize_t w = write(a[0], data + sent, n);
+            if (w <= 0)
+                break;
+            sent += (size_t)w;
+        }
+
+        ssize_t n;
+        while ((n = read(b[0], out + got, len - got)) > 0)
+            got += (size_t)n;
+
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+
+    CHECK(memcmp(out, data, len) == 0);
+
+    pipeevent_free(pa);
+    pipeevent_free(pb);
+    if (r)
+        pipeevent_uring_free(r);
+    event_base_free(base);
+    close(a[0]);
+    close(b[0]);
+    free(data);
+    free(out);
+}
+
+/* output pipeevent: add в буфер, на сокете та же последовательность */
+static void test_output(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+    pipeevent_enable(pev, EV_WRITE);
+
+    enum { LEN = 1024 * 1024, PART = 777 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 9);
+
+    struct infinitypipe *o = pipeevent_get_output(pev);
+    size_t added = 0;
+    size_t got = 0;
+    for (unsigned spins = 0; got < LEN; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        // порции не кратны ни странице, ни сегменту
+        if (added < LEN && infinitypipe_get_length(o) < 256u * 1024u)
+        {
+            size_t n = (LEN - added < PART) ? LEN - added : PART;
+            CHECK(infinitypipe_add(o, data + added, n) == (ssize_t)n);
+            added += n;
+        }
+
+        ssize_t n;
+        while ((n = read(sv[0], out + got, LEN - got)) > 0)
+            got += (size_t)n;
+
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+}
+
+static void on_count(struct pipeevent *pev, void *ctx)
+{
+    (void)pev;
+    ++*(int *)ctx;
+}
+
+static void spin(struct event_base *base, int n)
+{
+    for (int i = 0; i < n; ++i)
+        event_base_loop(base, EVLOOP_NONBLOCK);
+}
+
+/* отметки чтения: readcb не раньше lowmark, input не больше highmark,
+   чтение продолжается после вычитывания; writecb - когда output
+   опустился до нижней отметки записи */
+static void test_watermarks(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    int reads = 0, writes = 0;
+    pipeevent_setcb(pev, on_count, NULL, NULL, &reads);
+    enum { LOW = 1000, HIGH = 8192, LEN = 64 * 1024 };
+    pipeevent_setwatermark(pev, EV_READ, LOW, HIGH);
+    size_t lo, hi;
+    CHECK(pipeevent_getwatermark(pev, EV_READ, &lo, &hi) == 0);
+    CHECK(lo == LOW && hi == HIGH);
+    CHECK(pipeevent_getwatermark(pev, EV_READ|EV_WRITE, &lo, &hi) == -1);
+    pipeevent_enable(pev, EV_READ);
+
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 83);
+    struct infinitypipe *in = pipeevent_get_input(pev);
+
+    CHECK(write(sv[0], data, LOW / 2) == LOW / 2);
+    spin(base, 100);
+    CHECK(infinitypipe_get_length(in) == LOW / 2);
+    CHECK(reads == 0);
+
+    CHECK(write(sv[0], data + LOW / 2, LEN - LOW / 2) == LEN - LOW / 2);
+    spin(base, 100);
+    CHECK(reads > 0);
+    CHECK(infinitypipe_get_length(in) == HIGH);
+
+    size_t got = 0;
+    for (unsigned spins = 0; got < LEN; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        CHECK(infinitypipe_get_length(in) <= HIGH);
+        ssize_t n = infinitypipe_remove(in, out + got, LEN - got);
+        if (n > 0)
+            got += (size_t)n;
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    // запись: writecb только когда в output осталось не больше 4K
+    enum { BIG = 1024 * 1024, WLOW = 4096 };
+    char *big = malloc(BIG);
+    char *bout = malloc(BIG);
+    CHECK(big && bout);
+    fill_pattern(big, BIG, 89);
+
+    pipeevent_setcb(pev, NULL, on_count, NULL, &writes);
+    pipeevent_setwatermark(pev, EV_WRITE, WLOW, 0);
+    CHECK(pipeevent_getwatermark(pev, EV_WRITE, &lo, &hi) == 0);
+    CHECK(lo == WLOW && hi == 0);
+    pipeevent_enable(pev, EV_WRITE);
+
+    struct infinitypipe *o = pipeevent_get_output(pev);
+    CHECK(infinitypipe_add(o, big, BIG) == BIG);
+    spin(base, 100);
+    CHECK(infinitypipe_get_length(o) > WLOW);
+    CHECK(writes == 0);
+
+    got = 0;
+    for (unsigned spins = 0; got < BIG; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        ssize_t n;
+        while ((n = read(sv[0], bout + got, BIG - got)) > 0)
+            got += (size_t)n;
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    CHECK(memcmp(bout, big, BIG) == 0);
+    CHECK(writes > 0);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+    free(big);
+    free(bout);
+}
+
+/* эхо: всё прочитанное уходит обратно */
+static void on_echo(struct pipeevent *pev, void *ctx)
+{
+    (void)ctx;
+    CHECK(infinitypipe_move(pipeevent_get_output(pev),
+        pipeevent_get_input(pev), SIZE_MAX) >= 0);
+}
+
+/* счётчики эха: принято и отправлено ровно LEN, callbacks посчитаны,
+   сумма процесса не меньше и печатается dump */
+static void test_counters(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    struct pipeevent_counters c;
+    if (pipeevent_get_counters(pev, &c) != 0)
+    {
+        // сборка без E4PIPE_WITH_COUNTERS
+        CHECK(errno == ENOSYS);
+        CHECK(pipeevent_get_global_counters(&c) == -1 && errno == ENOSYS);
+        pipeevent_free(pev);
+        event_base_free(base);
+        close(sv[0]);
+        return;
+    }
+    CHECK(c.io.bytes_in == 0 && c.io.bytes_out == 0 && c.n_callbacks == 0);
+
+    pipeevent_setcb(pev, on_echo, NULL, NULL, NULL);
+    pipeevent_enable(pev, EV_READ|EV_WRITE);
+
+    enum { LEN = 512 * 1024 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 103);
+
+    size_t sent = 0, got = 0;
+    for (unsigned spins = 0; got < LEN; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        ssize_t n;
+        if (sent < LEN && (n = write(sv[0], data + sent, LEN - sent)) > 0)
+            sent += (size_t)n;
+        while ((n = read(sv[0], out + got, LEN - got)) > 0)
+            got += (size_t)n;
+
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    CHECK(pipeevent_get_counters(pev, &c) == 0);
+    CHECK(c.io.bytes_in == LEN);
+    CHECK(c.io.bytes_out == LEN);
+    CHECK(c.io.n_splice > 0);
+    CHECK(c.n_callbacks > 0);
+    CHECK(c.io.segs_created - c.io.segs_freed == c.io.segs_live);
+
+    struct pipeevent_counters g;
+    CHECK(pipeevent_get_global_counters(&g) == 0);
+    CHECK(g.io.bytes_in >= c.io.bytes_in);
+    CHECK(g.io.bytes_out >= c.io.bytes_out);
+    CHECK(g.n_callbacks >= c.n_callbacks);
+
+    char buf[1024];
+    FILE *f = fmemopen(buf, sizeof(buf), "w");
+    CHECK(f);
+    CHECK(pipeevent_counters_dump(f) == 0);
+    fclose(f);
+    CHECK(strstr(buf, "bytes_in ") && strstr(buf, "callbacks "));
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+}
+
+/* add_file: заголовок из output уходит перед файлом, файл - с offset
+   до конца; второй файл в очередь не встаёт, writecb - после файла */
+static void test_add_file(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    int writes = 0;
+    pipeevent_setcb(pev, NULL, on_count, NULL, &writes);
+
+    enum { LEN = 2 * 1024 * 1024, SKIP = 4000, HDR = 100 };
+    char *data = malloc(LEN);
+    char *out = malloc(HDR + LEN);
+    CHECK(data && out);
+    fill_pattern(data, LEN, 109);
+
+    char path[] = "/tmp/e4pipe-file-XXXXXX";
+    int fd = mkstemp(path);
+    CHECK(fd >= 0);
+    unlink(path);
+    CHECK(write(fd, data, LEN) == LEN);
+
+    char hdr[HDR];
+    fill_pattern(hdr, HDR, 113);
+    CHECK(infinitypipe_add(pipeevent_get_output(pev), hdr, HDR) == HDR);
+    CHECK(pipeevent_add_file(pev, fd, -1, -1, 0) == -1 && errno == EINVAL);
+    CHECK(pipeevent_add_file(pev, fd, SKIP, -1, PEV_FILE_CLOSE) == 0);
+    CHECK(pipeevent_add_file(pev, fd, 0, -1, 0) == -1 && errno == EBUSY);
+    pipeevent_enable(pev, EV_WRITE);
+
+    size_t want = HDR + LEN - SKIP;
+    size_t got = 0;
+    for (unsigned spins = 0; got < want; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        ssize_t n;
+        while ((n = read(sv[0], out + got, want - got)) > 0)
+            got += (size_t)n;
+        if (got < want)
+            CHECK(writes == 0);
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+    CHECK(memcmp(out, hdr, HDR) == 0);
+    CHECK(memcmp(out + HDR, data + SKIP, LEN - SKIP) == 0);
+
+    spin(base, 100);
+    CHECK(writes > 0);
+    // PEV_FILE_CLOSE: fd закрыт вместе с концом файла
+    CHECK(fcntl(fd, F_GETFD) == -1 && errno == EBADF);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+    free(data);
+    free(out);
+}
+
+int main(void)
+{
+    test_output();
+    test_watermarks();
+    test_counters();
+    test_add_file();
+    test_relay(0);
+    test_relay(1);
+    return 0;
+}
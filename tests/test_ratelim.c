@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+#include <time.h>
+
+#include "test_util.h"
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* len байт из output: на сокете те же байты; возвращает, сколько мс ушло */
+static int64_t send_limited(struct event_base *base, struct pipeevent *pev,
+    int peer, const char *data, char *out, size_t len)
+{
+    int64_t start = now_ms();
+    CHECK(infinitypipe_add(pipeevent_get_output(pev), data, len) ==
+        (ssize_t)len);
+
+    size_t got = 0;
+    for (unsigned spins = 0; got < len; ++spins)
+    {
+        CHECK(spins < 10000000u);
+
+        ssize_t n;
+        while ((n = read(peer, out + got, len - got)) > 0)
+            got += (size_t)n;
+
+        event_base_loop(base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+        if (got < len)
+            usleep(100);
+    }
+
+    CHECK(memcmp(out, data, len) == 0);
+    return now_ms() - start;
+}
+
+// ведро полно в начале и пополняется на границах тиков, выровненных по
+// часам: первая граница может наступить сразу, поэтому LEN байт идут не
+// меньше (LEN / RATE - 2) тиков
+enum { RATE = 16 * 1024, TICK_MS = 50, LEN = 4 * RATE,
+    MIN_MS = (LEN / RATE - 2) * TICK_MS };
+
+static void rate_cfg(struct pipeevent_rate_cfg *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->write_rate = RATE;
+    cfg->write_burst = RATE;
+    cfg->tick.tv_usec = TICK_MS * 1000;
+}
+
+static void test_rate_limit(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+    pipeevent_enable(pev, EV_WRITE);
+
+    struct pipeevent_rate_cfg cfg;
+    rate_cfg(&cfg);
+    CHECK(pipeevent_set_rate_limit(pev, &cfg) == 0);
+
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 29);
+
+    int64_t ms = send_limited(base, pev, sv[0], data, out, LEN);
+    CHECK(ms >= MIN_MS);
+
+    // без лимита та же порция уходит сразу
+    CHECK(pipeevent_set_rate_limit(pev, NULL) == 0);
+    fill_pattern(data, LEN, 31);
+    ms = send_limited(base, pev, sv[0], data, out, LEN);
+    CHECK(ms < MIN_MS);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+}
+
+/* группа делит одно ведро; pipeevent чужого event_base не принимается */
+static void test_rate_group(void)
+{
+    struct event_base *base = event_base_new();
+    struct event_base *other = event_base_new();
+    CHECK(base && other);
+
+    int sv[2], sw[2], su[2];
+    make_socketpair(sv);
+    make_socketpair(sw);
+    make_socketpair(su);
+
+    struct pipeevent *a =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    struct pipeevent *b =
+        pipeevent_socket_new(base, sw[1], PEV_OPT_CLOSE_ON_FREE);
+    struct pipeevent *c = pipeevent_socket_new(other, su[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(a && b && c);
+    pipeevent_enable(a, EV_WRITE);
+    pipeevent_enable(b, EV_WRITE);
+
+    struct pipeevent_rate_cfg cfg;
+    rate_cfg(&cfg);
+    struct pipeevent_rate_group *g = pipeevent_rate_group_new(base, &cfg);
+    CHECK(g);
+
+    CHECK(pipeevent_add_to_rate_group(c, g) == -1 && errno == EINVAL);
+    CHECK(pipeevent_add_to_rate_group(a, g) == 0);
+    CHECK(pipeevent_add_to_rate_group(a, g) == 0);
+    CHECK(pipeevent_add_to_rate_group(b, g) == 0);
+
+    static char da[LEN / 2], db[LEN / 2];
+    static char oa[LEN / 2], ob[LEN / 2];
+    fill_pattern(da, sizeof(da), 37);
+    fill_pattern(db, sizeof(db), 41);
+
+    int64_t start = now_ms();
+    CHECK(infinitypipe_add(pipeevent_get_output(a), da, sizeof(da)) ==
+        (ssize_t)sizeof(da));
+    CHECK(infinitypipe_add(pipeevent_get_output(b), db, sizeof(db)) ==
+        (ssize_t)sizeof(db));
+
+    size_t ga = 0, gb = 0;
+    for (unsigned spins = 0; ga < sizeof(oa) || gb < sizeof(ob); ++spins)
+    {
+        CHECK(spins < 10000000u);
+
+        ssize_t n;
+        while ((n = read(sv[0], oa + ga, sizeof(oa) - ga)) > 0)
+            ga += (size_t)n;
+        while ((n = read(sw[0], ob + gb, sizeof(ob) - gb)) > 0)
+            gb += (size_t)n;
+
+        event_base_loop(base, EVLOOP_ONCE|EVLOOP_NONBLOCK);
+        usleep(100);
+    }
+
+    // вдвоём через одно ведро - не быстрее, чем один через такое же
+    CHECK(now_ms() - start >= MIN_MS);
+    CHECK(memcmp(oa, da, sizeof(da)) == 0);
+    CHECK(memcmp(ob, db, sizeof(db)) == 0);
+
+    CHECK(pipeevent_remove_from_rate_group(a) == 0);
+    CHECK(pipeevent_remove_from_rate_group(a) == 0);
+    pipeevent_rate_group_free(g);
+
+    pipeevent_free(a);
+    pipeevent_free(b);
+    pipeevent_free(c);
+    event_base_free(base);
+    event_base_free(other);
+    close(sv[0]);
+    close(sw[0]);
+    close(su[0]);
+}
+
+int main(void)
+{
+    test_rate_limit();
+    test_rate_group();
+    return 0;
+}
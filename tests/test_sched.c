@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+
+#include "test_util.h"
+
+/* смена класса и снятие планировщика посреди отправки: байты на сокете
+   те же, pipeevent_free после смены не трогает освобождённое */
+static void test_reconfigure(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    struct pipeevent_sched_cfg cfg;
+    pipeevent_sched_cfg_init(&cfg);
+    cfg.cls = (enum pipeevent_sched_class)PEV_SCHED_CLASSES;
+    CHECK(pipeevent_set_sched(pev, &cfg) == -1 && errno == EINVAL);
+
+    cfg.cls = PEV_SCHED_BULK;
+    cfg.quantum = 4096;
+    CHECK(pipeevent_set_sched(pev, &cfg) == 0);
+    pipeevent_enable(pev, EV_WRITE);
+
+    enum { LEN = 1024 * 1024 };
+    static char data[LEN];
+    static char out[LEN];
+    fill_pattern(data, LEN, 17);
+
+    struct infinitypipe *o = pipeevent_get_output(pev);
+    CHECK(infinitypipe_add(o, data, LEN / 2) == LEN / 2);
+
+    size_t got = 0;
+    int step = 0;
+    for (unsigned spins = 0; got < LEN; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        ssize_t n;
+        while ((n = read(sv[0], out + got, LEN - got)) > 0)
+            got += (size_t)n;
+
+        if (step == 0 && got >= LEN / 4)
+        {
+            // тот же планировщик event_base, другой класс
+            cfg.cls = PEV_SCHED_INTERACTIVE;
+            CHECK(pipeevent_set_sched(pev, &cfg) == 0);
+            CHECK(infinitypipe_add(o, data + LEN / 2, LEN / 2) == LEN / 2);
+            ++step;
+        }
+        else if (step == 1 && got >= LEN / 2)
+        {
+            CHECK(pipeevent_set_sched(pev, NULL) == 0);
+            ++step;
+        }
+        else if (step == 2 && got >= 3 * (LEN / 4))
+        {
+            cfg.cls = PEV_SCHED_NORMAL;
+            CHECK(pipeevent_set_sched(pev, &cfg) == 0);
+            CHECK(pipeevent_set_sched(pev, &cfg) == 0);
+            ++step;
+        }
+
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+
+    CHECK(step == 3);
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+}
+
+int main(void)
+{
+    test_reconfigure();
+    return 0;
+}
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+
+#include "test_util.h"
+
+/* склеить файлы <path>.000000, <path>.000001, ... в buf */
+static size_t read_tap_files(const char *path, unsigned files,
+    char *buf, size_t len)
+{
+    size_t got = 0;
+    for (unsigned i = 0; i < files; ++i)
+    {
+        char name[256];
+        snprintf(name, sizeof(name), "%s.%06u", path, i);
+        int fd = open(name, O_RDONLY|O_CLOEXEC);
+        CHECK(fd >= 0);
+
+        ssize_t n;
+        while (got < len && (n = read(fd, buf + got, len - got)) > 0)
+            got += (size_t)n;
+
+        close(fd);
+        unlink(name);
+    }
+    return got;
+}
+
+/* прочитанное через tap: в input и в файлах те же байты; после
+   detach чтение идёт дальше, мимо файлов */
+static void test_tap_read(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    char dir[] = "/tmp/e4pipe-tap-XXXXXX";
+    CHECK(mkdtemp(dir));
+    char path[128];
+    snprintf(path, sizeof(path), "%s/rd", dir);
+
+    struct pipeevent_tap_cfg cfg;
+    pipeevent_tap_cfg_init(&cfg);
+    cfg.path = path;
+    cfg.rotate_bytes = 64u * 1024u;
+    cfg.policy = PEV_TAP_BACKPRESSURE;
+    CHECK(pipeevent_tap_attach(pev, EV_READ, &cfg) == 0);
+    CHECK(pipeevent_tap_attach(pev, EV_READ, &cfg) == -1 && errno == EBUSY);
+    pipeevent_enable(pev, EV_READ);
+
+    enum { LEN = 256 * 1024, TAIL = 16 * 1024 };
+    static char data[LEN + TAIL];
+    static char out[LEN + TAIL];
+    static char rec[LEN + TAIL];
+    fill_pattern(data, sizeof(data), 19);
+
+    struct infinitypipe *in = pipeevent_get_input(pev);
+    size_t sent = 0, got = 0;
+    for (unsigned spins = 0; got < LEN; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        ssize_t n;
+        if (sent < LEN && (n = write(sv[0], data + sent, LEN - sent)) > 0)
+            sent += (size_t)n;
+
+        event_base_loop(base, EVLOOP_NONBLOCK);
+
+        n = infinitypipe_remove(in, out + got, LEN - got);
+        if (n > 0)
+            got += (size_t)n;
+    }
+    CHECK(memcmp(out, data, LEN) == 0);
+
+    // поток записи догоняет сам, цикл событий его не ждёт
+    struct pipeevent_tap_stat st;
+    for (unsigned spins = 0; ; ++spins)
+    {
+        CHECK(spins < 10000u);
+        CHECK(pipeevent_tap_get_stat(pev, EV_READ, &st) == 0);
+        if (st.written == LEN)
+            break;
+        usleep(1000);
+    }
+    CHECK(st.captured == LEN);
+    CHECK(st.dropped == 0);
+    CHECK(st.error == 0);
+    CHECK(st.files == LEN / cfg.rotate_bytes);
+    unsigned files = st.files;
+
+    CHECK(pipeevent_tap_detach(pev, EV_READ) == 0);
+    CHECK(pipeevent_tap_get_stat(pev, EV_READ, &st) == -1 && errno == ENOENT);
+    CHECK(pipeevent_tap_detach(pev, EV_READ) == 0);
+
+    CHECK(write(sv[0], data + LEN, TAIL) == TAIL);
+    for (unsigned spins = 0; got < LEN + TAIL; ++spins)
+    {
+        CHECK(spins < 1000000u);
+        event_base_loop(base, EVLOOP_NONBLOCK);
+        ssize_t n = infinitypipe_remove(in, out + got, LEN + TAIL - got);
+        if (n > 0)
+            got += (size_t)n;
+    }
+    CHECK(memcmp(out, data, LEN + TAIL) == 0);
+
+    // после detach в файлы ничего не добавилось
+    CHECK(read_tap_files(path, files, rec, sizeof(rec)) == LEN);
+    CHECK(memcmp(rec, data, LEN) == 0);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+    rmdir(dir);
+}
+
+int main(void)
+{
+    test_tap_read();
+    return 0;
+}
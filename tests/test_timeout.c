@@ -0,0 +1,144 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+#include <time.h>
+
+#include "test_util.h"
+
+static int64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+struct events
+{
+    short what;
+    int calls;
+    int64_t at;
+};
+
+static void on_event(struct pipeevent *pev, short what, void *ctx)
+{
+    (void)pev;
+    struct events *e = (struct events *)ctx;
+    e->what = what;
+    e->calls++;
+    e->at = now_ms();
+}
+
+/* крутить цикл ms миллисекунд или пока не придёт событие */
+static void run_for(struct event_base *base, const struct events *e, int ms)
+{
+    int64_t end = now_ms() + ms;
+    int calls = e->calls;
+    while (now_ms() < end && e->calls == calls)
+    {
+        event_base_loop(base, EVLOOP_NONBLOCK);
+        usleep(1000);
+    }
+}
+
+enum { TIMEOUT_MS = 100 };
+
+/* активность сбрасывает таймер чтения; после тишины - тайм-аут и
+   чтение выключено */
+static void test_read_timeout(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    struct events e = { 0, 0, 0 };
+    pipeevent_setcb(pev, NULL, NULL, on_event, &e);
+    pipeevent_enable(pev, EV_READ);
+
+    struct timeval tv = { 0, TIMEOUT_MS * 1000 };
+    CHECK(pipeevent_set_timeouts(pev, &tv, NULL) == 0);
+
+    struct infinitypipe *in = pipeevent_get_input(pev);
+    int64_t quiet = 0;
+    for (int i = 0; i < 6; ++i)
+    {
+        quiet = now_ms();
+        CHECK(write(sv[0], "x", 1) == 1);
+        run_for(base, &e, TIMEOUT_MS / 2);
+        CHECK(e.calls == 0);
+    }
+    CHECK(infinitypipe_get_length(in) == 6);
+
+    run_for(base, &e, 10 * TIMEOUT_MS);
+    CHECK(e.calls == 1);
+    CHECK(e.what == (PEV_EVENT_TIMEOUT|PEV_EVENT_READING));
+    CHECK(e.at - quiet >= TIMEOUT_MS);
+
+    // направление выключено: новые байты не читаются, второго события нет
+    CHECK(write(sv[0], "y", 1) == 1);
+    run_for(base, &e, 2 * TIMEOUT_MS);
+    CHECK(e.calls == 1);
+    CHECK(infinitypipe_get_length(in) == 6);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+}
+
+/* output ждёт сокета, который никто не читает - тайм-аут записи;
+   снятый NULL таймер не срабатывает */
+static void test_write_timeout(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+
+    struct events e = { 0, 0, 0 };
+    pipeevent_setcb(pev, NULL, NULL, on_event, &e);
+    pipeevent_enable(pev, EV_READ|EV_WRITE);
+
+    struct timeval tv = { 0, TIMEOUT_MS * 1000 };
+    CHECK(pipeevent_set_timeouts(pev, &tv, &tv) == 0);
+    CHECK(pipeevent_set_timeouts(pev, NULL, &tv) == 0);
+
+    enum { LEN = 4 * 1024 * 1024 };
+    char *data = malloc(LEN);
+    CHECK(data);
+    fill_pattern(data, LEN, 53);
+    CHECK(infinitypipe_add(pipeevent_get_output(pev), data, LEN) == LEN);
+
+    run_for(base, &e, 10 * TIMEOUT_MS);
+    CHECK(e.calls == 1);
+    CHECK(e.what == (PEV_EVENT_TIMEOUT|PEV_EVENT_WRITING));
+    CHECK(infinitypipe_get_length(pipeevent_get_output(pev)) > 0);
+
+    // таймер чтения снят: тишина на чтении события не даёт
+    run_for(base, &e, 3 * TIMEOUT_MS);
+    CHECK(e.calls == 1);
+
+    pipeevent_free(pev);
+    event_base_free(base);
+    close(sv[0]);
+    free(data);
+}
+
+int main(void)
+{
+    test_read_timeout();
+    test_write_timeout();
+    return 0;
+}
@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+#include "e4pipe/infinitypipe_struct.h"
+
+#include <event2/event.h>
+
+#include "test_util.h"
+
+struct freed
+{
+    struct pipeevent *pev;
+};
+
+// "отправили ответ - освобождаем": writecb приходит, когда output ушёл
+static void free_on_write(struct pipeevent *pev, void *arg)
+{
+    struct freed *f = (struct freed *)arg;
+    CHECK(f->pev == pev);
+    pipeevent_free(pev);
+    f->pev = NULL;
+}
+
+/* writecb не раньше, чем голова из записи io_uring ушла в сокет:
+   pipeevent_free в нём не теряет хвост частичного splice */
+static void test_free_in_writecb(struct event_base *base,
+    struct pipeevent_uring *r)
+{
+    int sv[2];
+    make_socketpair(sv);
+    // маленький буфер сокета: splice головы уходит по частям
+    int sz = 4096;
+    CHECK(setsockopt(sv[1], SOL_SOCKET, SO_SNDBUF, &sz, sizeof(sz)) == 0);
+
+    struct freed f;
+    f.pev = pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(f.pev);
+    CHECK(pipeevent_set_uring(f.pev, r) == 0);
+    pipeevent_setcb(f.pev, NULL, free_on_write, NULL, &f);
+
+    enum { LEN = 512 * 1024 };
+    static char data[LEN];
+    static char out[LEN + 1];
+    fill_pattern(data, LEN, 21);
+    pipeevent_enable(f.pev, EV_WRITE);
+    CHECK(infinitypipe_add(pipeevent_get_output(f.pev), data, LEN) == LEN);
+
+    size_t got = 0;
+    for (unsigned spins = 0; ; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        ssize_t n;
+        while ((n = read(sv[0], out + got, sizeof(out) - got)) > 0)
+            got += (size_t)n;
+        // fd закрыт вместе с pipeevent, всё прочитано
+        if (n == 0)
+            break;
+
+        event_base_loop(base, EVLOOP_NONBLOCK);
+    }
+
+    CHECK(!f.pev);
+    CHECK(got == LEN);
+    CHECK(memcmp(out, data, LEN) == 0);
+    close(sv[0]);
+}
+
+/* мелкие чтения дописывают хвост input, а не добавляют по сегменту */
+static void test_small_reads(struct event_base *base,
+    struct pipeevent_uring *r)
+{
+    int sv[2];
+    make_socketpair(sv);
+
+    struct pipeevent *pev =
+        pipeevent_socket_new(base, sv[1], PEV_OPT_CLOSE_ON_FREE);
+    CHECK(pev);
+    CHECK(pipeevent_set_uring(pev, r) == 0);
+    pipeevent_enable(pev, EV_READ);
+
+    enum { PARTS = 200, PART = 10 };
+    char data[PARTS * PART];
+    char out[PARTS * PART];
+    fill_pattern(data, sizeof(data), 23);
+
+    struct infinitypipe *in = pipeevent_get_input(pev);
+    for (int k = 0; k < PARTS; ++k)
+    {
+        CHECK(write(sv[0], data + k * PART, PART) == PART);
+        for (unsigned spins = 0;
+            infinitypipe_get_length(in) < (size_t)(k + 1) * PART; ++spins)
+        {
+            CHECK(spins < 100000u);
+            event_base_loop(base, EVLOOP_NONBLOCK);
+        }
+    }
+
+    // хвост дописывается, пока у пайпа есть буферы (каждое чтение -
+    // отдельный буфер), а не по сегменту на чтение
+    CHECK(in->n_segs <= PARTS / 16);
+    CHECK(infinitypipe_remove(in, out, sizeof(out)) == sizeof(out));
+    CHECK(memcmp(out, data, sizeof(data)) == 0);
+
+    pipeevent_free(pev);
+    close(sv[0]);
+}
+
+int main(void)
+{
+    struct event_base *base = event_base_new();
+    CHECK(base);
+
+    struct pipeevent_uring *r = pipeevent_uring_new(base, 0);
+    if (!r)
+    {
+        printf("io_uring skipped: %s\n", strerror(errno));
+        event_base_free(base);
+        return 0;
+    }
+
+    test_free_in_writecb(base, r);
+    test_small_reads(base, r);
+
+    pipeevent_uring_free(r);
+    event_base_free(base);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "e4pipe/infinitypipe.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define CHECK(cond) \
+    do \
+    { \
+        if (!(cond)) \
+        { \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+// известная последовательность: сдвиг виден по любому байту
+static inline void fill_pattern(char *buf, size_t len, size_t seed)
+{
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = (char)((seed + i) * 13 + ((seed + i) >> 11));
+}
+
+static inline void make_socketpair(int sv[2])
+{
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    CHECK(fcntl(sv[0], F_SETFL, O_NONBLOCK) == 0);
+    CHECK(fcntl(sv[1], F_SETFL, O_NONBLOCK) == 0);
+}
+
+/* data -> сокет -> splice_in в ip, пока не примет всё */
+static inline void ingest(struct infinitypipe *ip, const char *data, size_t len)
+{
+    int sv[2];
+    make_socketpair(sv);
+
+    size_t sent = 0;
+    size_t got = 0;
+    while (got < len)
+    {
+        if (sent < len)
+        {
+            ssize_t n = write(sv[0], data + sent, len - sent);
+            if (n > 0)
+                sent += (size_t)n;
+            else
+                CHECK(errno == EAGAIN);
+        }
+
+        ssize_t rc = infinitypipe_splice_in(ip, sv[1], len - got);
+        if (rc > 0)
+            got += (size_t)rc;
+        else
+            CHECK(rc < 0 && errno == EAGAIN);
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+}
+
+/* splice_out из ip в сокет и read обратно, до want байт */
+static inline size_t drain(struct infinitypipe *ip, char *out, size_t want)
+{
+    int sv[2];
+    make_socketpair(sv);
+
+    size_t got = 0;
+    while (got < want)
+    {
+        ssize_t rc = infinitypipe_splice_out(ip, sv[0], want - got);
+        if (rc < 0)
+            CHECK(errno == EAGAIN);
+
+        ssize_t n;
+        while ((n = read(sv[1], out + got, want - got)) > 0)
+            got += (size_t)n;
+
+        // буфер опустел раньше, чем набралось want
+        if (rc <= 0 && !infinitypipe_get_length(ip) &&
+            !infinitypipe_get_spill_length(ip))
+            break;
+    }
+
+    close(sv[0]);
+    close(sv[1]);
+    return got;
+}
@@ -0,0 +1,206 @@
+#define _GNU_SOURCE
+
+#include "e4pipe/pipeevent.h"
+#include "e4pipe/infinitypipe.h"
+
+#include <event2/event.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "test_util.h"
+
+enum { HELLO = 4096, LEN = 256 * 1024, N_FD = 6 };
+
+struct conn
+{
+    struct pipeevent_workers *wp;
+    int sv[2];
+    int target;
+    atomic_int ready;
+    struct event_base *base;
+};
+
+/* эхо: всё прочитанное уходит обратно */
+static void on_read(struct pipeevent *pev, void *ctx)
+{
+    (void)ctx;
+    CHECK(infinitypipe_move(pipeevent_get_output(pev),
+        pipeevent_get_input(pev), SIZE_MAX) >= 0);
+}
+
+static int worker_of(struct pipeevent_workers *wp, struct pipeevent *pev)
+{
+    for (int i = 0; i < pipeevent_workers_count(wp); ++i)
+        if (pipeevent_workers_get_base(wp, i) == pipeevent_get_base(pev))
+            return i;
+    return -1;
+}
+
+static void on_migrated(struct pipeevent *pev, void *ctx)
+{
+    struct conn *c = (struct conn *)ctx;
+    CHECK(pev);
+    CHECK(worker_of(c->wp, pev) == c->target);
+    pipeevent_enable(pev, EV_READ|EV_WRITE);
+    c->base = pipeevent_get_base(pev);
+    atomic_store(&c->ready, 1);
+}
+
+/* в потоке воркера: output уже не пуст, pev уезжает к target */
+static void on_assigned(struct pipeevent *pev, void *ctx)
+{
+    struct conn *c = (struct conn *)ctx;
+    CHECK(pev);
+    pipeevent_setcb(pev, on_read, NULL, NULL, c);
+
+    char hello[HELLO];
+    fill_pattern(hello, HELLO, 59);
+    CHECK(infinitypipe_add(pipeevent_get_output(pev), hello, HELLO) == HELLO);
+
+    int idx = worker_of(c->wp, pev);
+    CHECK(idx >= 0);
+    CHECK(pipeevent_migrate(pev, c->wp, -1, NULL, NULL) == -1 &&
+        errno == EINVAL);
+
+    if (c->target < 0)
+        c->target = 1 - idx;
+    if (c->target == idx)
+    {
+        // переезд к себе - ничего не делает, cb не зовётся
+        CHECK(pipeevent_migrate(pev, c->wp, idx, on_migrated, c) == 0);
+        on_migrated(pev, c);
+        return;
+    }
+    CHECK(pipeevent_migrate(pev, c->wp, c->target, on_migrated, c) == 0);
+}
+
+static void wait_ready(struct conn *c)
+{
+    for (unsigned spins = 0; !atomic_load(&c->ready); ++spins)
+    {
+        CHECK(spins < 10000u);
+        usleep(1000);
+    }
+}
+
+/* len байт в сокет, обратно - expect и те же байты */
+static void roundtrip(struct conn *c, const char *expect, size_t skip,
+    const char *data, size_t len)
+{
+    static char out[HELLO + LEN];
+    size_t sent = 0, got = 0;
+    for (unsigned spins = 0; got < skip + len; ++spins)
+    {
+        CHECK(spins < 1000000u);
+
+        ssize_t n;
+        if (sent < len && (n = write(c->sv[0], data + sent, len - sent)) > 0)
+            sent += (size_t)n;
+        while ((n = read(c->sv[0], out + got, skip + len - got)) > 0)
+            got += (size_t)n;
+        if (got < skip + len)
+            usleep(100);
+    }
+    CHECK(memcmp(out, expect, skip) == 0);
+    CHECK(memcmp(out + skip, data, len) == 0);
+}
+
+/* assign отдаёт fd воркеру, migrate переносит pev с output к другому;
+   после переезда эхо работает уже там */
+static void test_migrate(void)
+{
+    struct pipeevent_workers *wp = pipeevent_workers_new(2, 0);
+    CHECK(wp);
+    CHECK(pipeevent_workers_count(wp) == 2);
+    CHECK(pipeevent_workers_get_base(wp, 0) != pipeevent_workers_get_base(wp, 1));
+
+    static struct conn c;
+    c.wp = wp;
+    c.target = -1;
+    atomic_init(&c.ready, 0);
+    make_socketpair(c.sv);
+
+    CHECK(pipeevent_workers_assign(wp, c.sv[1], PEV_OPT_CLOSE_ON_FREE,
+        NULL, on_assigned, &c) == 0);
+    wait_ready(&c);
+    CHECK(c.base == pipeevent_workers_get_base(wp, c.target));
+    CHECK(pipeevent_workers_get_load(wp, c.target) == 1);
+    CHECK(pipeevent_workers_get_load(wp, 1 - c.target) == 0);
+
+    static char hello[HELLO];
+    static char data[LEN];
+    fill_pattern(hello, HELLO, 59);
+    fill_pattern(data, LEN, 61);
+    roundtrip(&c, hello, HELLO, data, LEN);
+
+    pipeevent_workers_free(wp);
+    close(c.sv[0]);
+}
+
+static atomic_int moved;
+
+static void on_moved(struct pipeevent *pev, void *ctx)
+{
+    (void)ctx;
+    CHECK(pev);
+    atomic_fetch_add(&moved, 1);
+}
+
+/* все fd собраны на воркере 0; rebalance отдаёт половину воркеру 1,
+   переехавшие продолжают отвечать */
+static void test_rebalance(void)
+{
+    struct pipeevent_workers *wp = pipeevent_workers_new(2, 0);
+    CHECK(wp);
+    pipeevent_workers_set_migrate_cb(wp, on_moved, NULL);
+
+    static struct conn c[N_FD];
+    for (int i = 0; i < N_FD; ++i)
+    {
+        c[i].wp = wp;
+        c[i].target = 0;
+        atomic_init(&c[i].ready, 0);
+        make_socketpair(c[i].sv);
+        CHECK(pipeevent_workers_assign(wp, c[i].sv[1], PEV_OPT_CLOSE_ON_FREE,
+            NULL, on_assigned, &c[i]) == 0);
+    }
+    for (int i = 0; i < N_FD; ++i)
+        wait_ready(&c[i]);
+    CHECK(pipeevent_workers_get_load(wp, 0) == N_FD);
+    CHECK(pipeevent_workers_get_load(wp, 1) == 0);
+
+    atomic_init(&moved, 0);
+    CHECK(pipeevent_workers_rebalance(wp) == 0);
+    for (unsigned spins = 0; atomic_load(&moved) < N_FD / 2; ++spins)
+    {
+        CHECK(spins < 10000u);
+        usleep(1000);
+    }
+    CHECK(pipeevent_workers_get_load(wp, 0) == N_FD / 2);
+    CHECK(pipeevent_workers_get_load(wp, 1) == N_FD / 2);
+
+    // выровнено: повторный rebalance ничего не двигает
+    CHECK(pipeevent_workers_rebalance(wp) == 0);
+    usleep(20000);
+    CHECK(atomic_load(&moved) == N_FD / 2);
+
+    static char hello[HELLO];
+    static char data[LEN];
+    fill_pattern(hello, HELLO, 59);
+    for (int i = 0; i < N_FD; ++i)
+    {
+        fill_pattern(data, LEN, 67 + (size_t)i);
+        roundtrip(&c[i], hello, HELLO, data, LEN);
+    }
+
+    pipeevent_workers_free(wp);
+    for (int i = 0; i < N_FD; ++i)
+        close(c[i].sv[0]);
+}
+
+int main(void)
+{
+    test_migrate();
+    test_rebalance();
+    return 0;
+}